@@ -0,0 +1,113 @@
+/* file: BoundedQueue.h
+ * ---------------------
+ * Fixed capacity lock-free queue for many producers and many consumers.
+ * Each cell carries a sequence number telling whether it is ready to be
+ * written or read for a given position, so producers and consumers only
+ * contend on the position counters.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <stdexcept>
+
+template <typename T>
+class BoundedQueue {
+  public:
+   // capacity is rounded up to a power of two.
+   explicit BoundedQueue(size_t capacity);
+   // Returns false instead of blocking when the queue is full.
+   bool push(const T& val);
+   // Returns false instead of blocking when the queue is empty.
+   bool pop(T& val);
+
+  private:
+   struct Cell {
+      std::atomic<size_t> seq;
+      T val;
+   };
+
+   std::unique_ptr<Cell[]> cells;
+   size_t mask;
+   alignas(64) std::atomic<size_t> tail; // Next position to push to.
+   alignas(64) std::atomic<size_t> head; // Next position to pop from.
+};
+
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : tail(0), head(0) {
+   if (capacity == 0)
+      throw std::invalid_argument("BoundedQueue needs a non-zero capacity.");
+   size_t n = 1;
+   while (n < capacity) n <<= 1;
+   cells.reset(new Cell[n]);
+   mask = n - 1;
+   for (size_t i = 0; i < n; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+
+template <typename T>
+bool BoundedQueue<T>::push(const T& val) {
+   size_t pos = tail.load(std::memory_order_relaxed);
+   while (true) {
+      Cell& cell = cells[pos & mask];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      if (seq == pos) {
+         if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.val = val;
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return true;
+         }
+      } else if (seq < pos) {
+         return false; // Cell still holds the value pushed a lap ago.
+      } else {
+         pos = tail.load(std::memory_order_relaxed);
+      }
+   }
+}
+
+
+template <typename T>
+bool BoundedQueue<T>::pop(T& val) {
+   size_t pos = head.load(std::memory_order_relaxed);
+   while (true) {
+      Cell& cell = cells[pos & mask];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      if (seq == pos + 1) {
+         if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            val = cell.val;
+            cell.seq.store(pos + mask + 1, std::memory_order_release);
+            return true;
+         }
+      } else if (seq < pos + 1) {
+         return false; // Nothing pushed to this cell yet.
+      } else {
+         pos = head.load(std::memory_order_relaxed);
+      }
+   }
+}
@@ -0,0 +1,148 @@
+/* file: Chunker.cc
+ * -----------------
+ * Content-defined chunking in the manner of FastCDC.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Chunker.h"
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+
+/* function: gearTable
+ * -------------------
+ *  Random values for every byte, from a fixed splitmix64 sequence so chunk
+ *  ends do not change between runs.
+ */
+static constexpr array<uint64_t, 256> gearTable() {
+   array<uint64_t, 256> gear{};
+   uint64_t s = 0x243f6a8885a308d3ULL;
+   for (size_t i = 0; i < gear.size(); i++) {
+      uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      gear[i] = z ^ (z >> 31);
+   }
+   return gear;
+}
+
+static constexpr array<uint64_t, 256> kGear = gearTable();
+
+
+/* function: topBits
+ * -----------------
+ *  Mask of the bits top bits of a fingerprint. Bit k of the gear hash only
+ *  depends on the last k+1 bytes, so the top bits see the widest window.
+ */
+static uint64_t topBits(unsigned bits) {
+   return (bits == 0) ? 0 : ~0ULL << (64 - bits);
+}
+
+
+/* function: Chunker
+ * -----------------
+ */
+Chunker::Chunker(const Options& o, Sink s) : opts(o), onChunk(s), fp(0),
+                                             len(0) {
+   if (opts.minLen == 0 || opts.minLen > opts.avgLen || opts.avgLen > opts.maxLen ||
+       opts.maxLen > UINT32_MAX)
+      throw invalid_argument("Chunker needs 0 < minLen <= avgLen <= maxLen < 4G.");
+   unsigned bits = 0;
+   while ((size_t(2) << bits) <= opts.avgLen)
+      bits++;
+   // Two bits stricter, then two looser, as FastCDC normalizes.
+   maskS = topBits(min(bits + 2, 63u));
+   maskL = topBits(bits > 2 ? bits - 2 : 1);
+   opts.avgLen = size_t(1) << bits;
+   hasher = Hasher::create(Hasher::kXxh128);
+}
+
+
+/* function: withAverage
+ * ---------------------
+ */
+Chunker::Options Chunker::withAverage(size_t avgLen) {
+   Options o;
+   o.avgLen = avgLen;
+   o.minLen = max<size_t>(avgLen / 4, 1);
+   o.maxLen = avgLen * 8;
+   return o;
+}
+
+
+/* function: update
+ * ----------------
+ *  The first minLen bytes of a chunk cannot end it, so they are skipped
+ *  without rolling the hash over them.
+ */
+void Chunker::update(const unsigned char* data, size_t n) {
+   size_t start = 0; // Of the bytes not yet digested.
+   size_t i = 0;
+   while (i < n) {
+      if (len < opts.minLen) {
+         size_t skip = min(n - i, opts.minLen - len);
+         i += skip;
+         len += skip;
+         continue;
+      }
+      fp = (fp << 1) + kGear[data[i++]];
+      len++;
+      if ((fp & (len < opts.avgLen ? maskS : maskL)) == 0 || len >= opts.maxLen) {
+         hasher->update(data + start, i - start);
+         start = i;
+         cut();
+      }
+   }
+   if (start < n)
+      hasher->update(data + start, n - start);
+}
+
+
+/* function: final
+ * ---------------
+ */
+void Chunker::final() {
+   if (len > 0)
+      cut();
+}
+
+
+/* function: cut
+ * -------------
+ */
+void Chunker::cut() {
+   unsigned char res[Hasher::kMaxDigestLen];
+   hasher->final(res);
+   Chunk chunk;
+   memcpy(chunk.key, res, sizeof(chunk.key));
+   chunk.len = len;
+   onChunk(chunk);
+   hasher = Hasher::create(Hasher::kXxh128);
+   fp = 0;
+   len = 0;
+}
@@ -0,0 +1,78 @@
+/* file: Chunker.h
+ * ----------------
+ * Content-defined chunking in the manner of FastCDC: a gear hash rolls over
+ * the bytes of a file and a chunk ends where its top bits are all zero, so
+ * an insertion only moves the chunk ends near it. A stricter mask before
+ * the average length and a looser one after keep lengths close to it.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "Hasher.h"
+#include <functional>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+class Chunker {
+  public:
+   // Bounds on the length of every chunk but the last of a file, which may
+   // be shorter than minLen.
+   struct Options {
+      size_t minLen = 2 << 10;
+      size_t avgLen = 8 << 10; // Rounded down to a power of two.
+      size_t maxLen = 64 << 10;
+   };
+   // The xxh128 digest of the bytes of a chunk, and their number.
+   struct Chunk {
+      uint64_t key[2];
+      uint32_t len;
+   };
+   typedef std::function<void(const Chunk&)> Sink;
+
+   Chunker(const Options& opts, Sink onChunk);
+   // Feeds the next len bytes of the file. Chunks are digested as they
+   // pass, so no byte is held.
+   void update(const unsigned char* data, size_t len);
+   // Ends the file, cutting the chunk under way if it holds any bytes.
+   void final();
+   // So a Chunker can be handed to readers as a sink.
+   void operator()(const unsigned char* data, size_t len) { update(data, len); }
+   // Options averaging avgLen, with chunks from a quarter of it to eight
+   // times it.
+   static Options withAverage(size_t avgLen);
+
+  private:
+   // Hands the chunk under way to onChunk and starts the next one.
+   void cut();
+
+   Options opts;
+   Sink onChunk;
+   uint64_t maskS; // Before avgLen.
+   uint64_t maskL; // From avgLen.
+   uint64_t fp;
+   size_t len; // Of the chunk under way.
+   std::unique_ptr<Hasher> hasher;
+};
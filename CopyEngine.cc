@@ -0,0 +1,427 @@
+/* file: CopyEngine.cc
+ * --------------------
+ * Implementation of CopyEngine.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "CopyEngine.h"
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+using namespace std;
+
+const size_t CopyEngine::kBufLen;
+
+// Most bytes sendfile and copy_file_range move in one call.
+static const size_t kMaxChunk = 0x7ffff000;
+
+
+/* function: unsupported
+ * ---------------------
+ * Whether a failed clone or in-kernel copy may still be done another way.
+ */
+static bool unsupported(int err) {
+   return err == ENOSYS || err == EOPNOTSUPP || err == ENOTTY ||
+          err == EINVAL || err == EXDEV;
+}
+
+
+/* function: name
+ * --------------
+ */
+const char* CopyEngine::name(Method method) {
+   switch (method) {
+      case kClone: return "clone";
+      case kCopyRange: return "copy_file_range";
+      case kSendfile: return "sendfile";
+      case kLink: return "hard link";
+      case kMove: return "rename";
+      default: return "read/write";
+   }
+}
+
+
+/* function: mkdir
+ * ---------------
+ */
+void CopyEngine::mkdir(const string& path) {
+   if (::mkdir(path.c_str(), 0777) == 0)
+      return;
+   int err = errno;
+   struct stat st;
+   if (err == EEXIST && stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      return;
+   throw system_error(err, system_category(), path);
+}
+
+
+/* function: copy
+ * --------------
+ */
+void CopyEngine::copy(const string& src, const string& dstDir) {
+   size_t slash = src.find_last_of('/');
+   copyTo(src, dstDir + "/" + src.substr(slash == string::npos ? 0 : slash + 1));
+}
+
+
+/* function: copyTree
+ * ------------------
+ * Entries are listed before any is copied, so the copy of a folder into
+ * itself would not go on forever. Kept files let a resumed plan pick up an
+ * interrupted copy where it stopped.
+ */
+void CopyEngine::copyTree(const string& src, const string& dstDir) {
+   size_t slash = src.find_last_of('/');
+   string dst = dstDir + "/" + src.substr(slash == string::npos ? 0 : slash + 1);
+   mkdir(dst);
+   DIR* dir = opendir(src.c_str());
+   if (dir == nullptr)
+      throw system_error(errno, system_category(), src);
+   vector<string> names;
+   errno = 0;
+   while (struct dirent* ent = readdir(dir)) {
+      if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+         names.push_back(ent->d_name);
+   }
+   int err = errno;
+   closedir(dir);
+   if (err != 0)
+      throw system_error(err, system_category(), src);
+   sort(names.begin(), names.end());
+   for (const string& entry : names) {
+      string path = src + "/" + entry;
+      struct stat sst, dst_st;
+      if (stat(path.c_str(), &sst) < 0)
+         throw system_error(errno, system_category(), path);
+      if (S_ISDIR(sst.st_mode)) {
+         copyTree(path, dst);
+         continue;
+      }
+      string to = dst + "/" + entry;
+      if (lstat(to.c_str(), &dst_st) == 0 && S_ISREG(dst_st.st_mode) &&
+          dst_st.st_size == sst.st_size &&
+          dst_st.st_mtim.tv_sec == sst.st_mtim.tv_sec &&
+          dst_st.st_mtim.tv_nsec == sst.st_mtim.tv_nsec)
+         continue;
+      copyTo(path, to);
+   }
+}
+
+
+/* function: copyTo
+ * ----------------
+ * The copy is created exclusively, so a file appearing at the destination
+ * after it was moved aside is not overwritten. Written unnamed, a copy cut
+ * short by a crash leaves nothing at the destination, so a resumed plan
+ * finds the step not done rather than a torn file in the way.
+ */
+void CopyEngine::copyTo(const string& src, const string& dst,
+                        bool keepExisting) {
+   int sfd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+   if (sfd < 0)
+      throw system_error(errno, system_category(), src);
+   int dfd = -1;
+   bool unnamed = false;
+   try {
+      struct stat sst;
+      if (fstat(sfd, &sst) < 0)
+         throw system_error(errno, system_category(), src);
+      if (!makeRoom(dst, &sst, keepExisting)) {
+         if (!keepExisting)
+            throw invalid_argument(src + " and " + dst + " are the same file.");
+         close(sfd);
+         return;
+      }
+      Method method;
+      while (true) {
+         dfd = create(dst, sst.st_mode & 0777, unnamed);
+         method = transfer(sfd, dfd, sst.st_size, src);
+         struct timespec times[2] = {sst.st_atim, sst.st_mtim};
+         if (fchmod(dfd, sst.st_mode & 07777) < 0 || futimens(dfd, times) < 0)
+            throw system_error(errno, system_category(), dst);
+         if (!unnamed || name(dfd, dst))
+            break;
+         // Copied again, named from the start.
+         close(dfd);
+         dfd = -1;
+         if (lseek(sfd, 0, SEEK_SET) < 0)
+            throw system_error(errno, system_category(), src);
+      }
+      unnamed = false; // Named now.
+      int closed = close(dfd);
+      dfd = -1;
+      if (closed < 0) {
+         int err = errno;
+         unlink(dst.c_str());
+         throw system_error(err, system_category(), dst);
+      }
+      counts[method]++;
+      copied += sst.st_size;
+   } catch (...) {
+      if (dfd >= 0) {
+         close(dfd);
+         if (!unnamed)
+            unlink(dst.c_str());
+      }
+      close(sfd);
+      throw;
+   }
+   close(sfd);
+}
+
+
+/* function: create
+ * ----------------
+ */
+int CopyEngine::create(const string& dst, mode_t mode, bool& unnamed) {
+#ifdef O_TMPFILE
+   if (tmpfileOk) {
+      size_t slash = dst.find_last_of('/');
+      string dir = (slash == string::npos) ? "." : dst.substr(0, max(slash, (size_t)1));
+      int fd = open(dir.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, mode);
+      if (fd >= 0) {
+         unnamed = true;
+         return fd;
+      }
+      // Older kernels and filesystems without unnamed files.
+      if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+         throw system_error(errno, system_category(), dst);
+      tmpfileOk = false;
+   }
+#endif
+   unnamed = false;
+   int fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+   if (fd < 0)
+      throw system_error(errno, system_category(), dst);
+   return fd;
+}
+
+
+/* function: name
+ * --------------
+ * Linking by descriptor needs privileges, linking through /proc needs it
+ * mounted; either will do. Like an exclusive create, fails if dst exists.
+ */
+bool CopyEngine::name(int dfd, const string& dst) {
+#ifdef AT_EMPTY_PATH
+   if (linkat(dfd, "", AT_FDCWD, dst.c_str(), AT_EMPTY_PATH) == 0)
+      return true;
+   if (errno != ENOENT && errno != EPERM)
+      throw system_error(errno, system_category(), dst);
+#endif
+   string proc = "/proc/self/fd/" + to_string(dfd);
+   if (linkat(AT_FDCWD, proc.c_str(), AT_FDCWD, dst.c_str(), AT_SYMLINK_FOLLOW) == 0)
+      return true;
+   int err = errno;
+   if ((err != ENOENT && err != EPERM && err != EACCES) ||
+       (err == ENOENT && access(proc.c_str(), F_OK) == 0)) // dst's folder.
+      throw system_error(err, system_category(), dst);
+   tmpfileOk = false;
+   return false;
+}
+
+
+/* function: link
+ * --------------
+ * A dst already linked to target is moved aside as well, as cp would do
+ * with an identical copy.
+ */
+void CopyEngine::link(const string& target, const string& dst) {
+   makeRoom(dst, nullptr, false);
+   if (::link(target.c_str(), dst.c_str()) == 0) {
+      counts[kLink]++;
+      return;
+   }
+   // Too many links, another filesystem, or one without hard links.
+   if (errno == EMLINK || errno == EXDEV || errno == EPERM || errno == ENOTSUP)
+      copyTo(target, dst);
+   else
+      throw system_error(errno, system_category(), dst);
+}
+
+
+/* function: move
+ * --------------
+ */
+void CopyEngine::move(const string& src, const string& dst) {
+   struct stat st;
+   if (lstat(src.c_str(), &st) < 0)
+      throw system_error(errno, system_category(), src);
+   if (!makeRoom(dst, &st, false))
+      return;
+   if (rename(src.c_str(), dst.c_str()) == 0) {
+      counts[kMove]++;
+      return;
+   }
+   if (errno != EXDEV)
+      throw system_error(errno, system_category(), dst);
+   copyTo(src, dst);
+   if (unlink(src.c_str()) < 0)
+      throw system_error(errno, system_category(), src);
+}
+
+
+/* function: makeRoom
+ * ------------------
+ */
+bool CopyEngine::makeRoom(const string& path, const struct stat* st,
+                          bool keepExisting) {
+   struct stat dst_st;
+   if (lstat(path.c_str(), &dst_st) < 0) {
+      if (errno != ENOENT)
+         throw system_error(errno, system_category(), path);
+      return true;
+   }
+   if (S_ISDIR(dst_st.st_mode))
+      throw system_error(EISDIR, system_category(), path);
+   if (keepExisting || (st != nullptr && dst_st.st_dev == st->st_dev &&
+                        dst_st.st_ino == st->st_ino))
+      return false;
+   backup(path);
+   return true;
+}
+
+
+/* function: transfer
+ * ------------------
+ * Each way continues from where the previous one stopped, since they all
+ * move the file offsets. A file which shrank while being copied is copied
+ * up to its new end.
+ */
+CopyEngine::Method CopyEngine::transfer(int sfd, int dfd, size_t len,
+                                        const string& src) {
+   size_t done = 0;
+#ifdef __linux__
+   if (cloneOk) {
+      if (ioctl(dfd, FICLONE, sfd) == 0)
+         return kClone;
+      if (!unsupported(errno))
+         throw system_error(errno, system_category(), src);
+      if (errno != EXDEV)
+         cloneOk = false;
+   }
+   if (copyRangeOk) {
+      while (done < len) {
+         ssize_t n = copy_file_range(sfd, nullptr, dfd, nullptr,
+                                     min(len - done, kMaxChunk), 0);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n < 0 && unsupported(errno)) {
+            if (errno != EXDEV)
+               copyRangeOk = false;
+            break;
+         }
+         if (n < 0)
+            throw system_error(errno, system_category(), src);
+         if (n == 0)
+            return kCopyRange;
+         done += n;
+      }
+      if (done == len)
+         return kCopyRange;
+   }
+   if (sendfileOk) {
+      while (done < len) {
+         ssize_t n = sendfile(dfd, sfd, nullptr, min(len - done, kMaxChunk));
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n < 0 && unsupported(errno)) {
+            sendfileOk = false;
+            break;
+         }
+         if (n < 0)
+            throw system_error(errno, system_category(), src);
+         if (n == 0)
+            return kSendfile;
+         done += n;
+      }
+      if (done == len)
+         return kSendfile;
+   }
+#endif
+   buf.resize(kBufLen);
+   while (true) {
+      ssize_t n = read(sfd, buf.data(), buf.size());
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         throw system_error(errno, system_category(), src);
+      if (n == 0)
+         return kReadWrite;
+      for (ssize_t written = 0; written < n; ) {
+         ssize_t w = write(dfd, buf.data() + written, n - written);
+         if (w < 0 && errno == EINTR)
+            continue;
+         if (w < 0)
+            throw system_error(errno, system_category(), src);
+         written += w;
+      }
+   }
+}
+
+
+/* function: backup
+ * ----------------
+ * Same numbering as cp --backup=numbered: path.~1~, path.~2~ and so on.
+ */
+void CopyEngine::backup(const string& path) {
+   size_t slash = path.find_last_of('/');
+   string dir = path.substr(0, slash);
+   string prefix = path.substr(slash + 1) + ".~";
+   DIR* d = opendir(dir.c_str());
+   if (d == nullptr)
+      throw system_error(errno, system_category(), dir);
+   unsigned long highest = 0;
+   struct dirent* entry;
+   while ((entry = readdir(d)) != nullptr) {
+      const char* name = entry->d_name;
+      if (strncmp(name, prefix.c_str(), prefix.size()) != 0 ||
+          !isdigit((unsigned char)name[prefix.size()]))
+         continue;
+      char* end;
+      unsigned long n = strtoul(name + prefix.size(), &end, 10);
+      if (end[0] == '~' && end[1] == '\0')
+         highest = max(highest, n);
+   }
+   closedir(d);
+   string aside = path + ".~" + to_string(highest + 1) + "~";
+   if (rename(path.c_str(), aside.c_str()) < 0)
+      throw system_error(errno, system_category(), path);
+}
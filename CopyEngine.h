@@ -0,0 +1,100 @@
+/* file: CopyEngine.h
+ * -------------------
+ * Carries out mkdir and cp steps of a plan within the process. Files are
+ * cloned when the filesystem shares extents, else copied in the kernel
+ * with copy_file_range or sendfile, else read and written. Copies keep
+ * the mode and timestamps of their source. A file already at the
+ * destination is renamed aside like cp --backup=numbered does.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <sys/stat.h>
+
+class CopyEngine {
+  public:
+   // How a copy was made.
+   enum Method { kClone, kCopyRange, kSendfile, kReadWrite, kLink, kMove,
+                 kMethods };
+
+   CopyEngine() : cloneOk(true), copyRangeOk(true), sendfileOk(true),
+                  tmpfileOk(true), counts(kMethods, 0), copied(0) {}
+   // Creates the folder at path. An existing folder is not an error.
+   void mkdir(const std::string& path);
+   // Copies the file at src into the folder dstDir, under the same name.
+   void copy(const std::string& src, const std::string& dstDir);
+   // Copies the folder at src into the folder dstDir, under the same name,
+   // with everything under it. Links are followed. Files already there with
+   // the size and mtime of their source, as a copy left them, are kept.
+   void copyTree(const std::string& src, const std::string& dstDir);
+   // Copies the file at src to the path dst. A file already at dst is moved
+   // aside, or kept and nothing copied with keepExisting. The copy only
+   // appears at dst once whole where the filesystem has unnamed files.
+   void copyTo(const std::string& src, const std::string& dst,
+               bool keepExisting = false);
+   // Hard links dst to the file at target, moving aside a file already at
+   // dst. Copies instead where the filesystem cannot link them.
+   void link(const std::string& target, const std::string& dst);
+   // Moves the file at src to the path dst, moving aside a file already
+   // at dst. Copies and removes it where it cannot be renamed.
+   void move(const std::string& src, const std::string& dst);
+   // Files copied with method so far.
+   size_t count(Method method) const { return counts[method]; }
+   // Bytes of the files copied so far, by any method but kLink and kMove.
+   size_t bytesCopied() const { return copied; }
+   static const char* name(Method method);
+
+  private:
+   // Whether path is free to be created, after moving aside a file there.
+   // False if the file is kept, or is the file st describes unless st is
+   // null. Throws if path is a folder.
+   bool makeRoom(const std::string& path, const struct stat* st,
+                 bool keepExisting);
+   // Renames path to path.~N~, N one more than the highest existing backup.
+   void backup(const std::string& path);
+   // Opens a new file to copy to dst: an unnamed file in its folder, setting
+   // unnamed, or dst itself.
+   int create(const std::string& dst, mode_t mode, bool& unnamed);
+   // Names the unnamed file dfd dst. False if unnamed files cannot be
+   // named here.
+   bool name(int dfd, const std::string& dst);
+   // Copies len bytes from sfd to dfd, returning how.
+   Method transfer(int sfd, int dfd, size_t len, const std::string& src);
+
+   // Cleared when the kernel or filesystem says a method is unsupported,
+   // so later copies go straight to the next one.
+   bool cloneOk;
+   bool copyRangeOk;
+   bool sendfileOk;
+   bool tmpfileOk;
+   std::vector<size_t> counts;
+   size_t copied;
+   std::vector<char> buf; // For read and write.
+
+   static const size_t kBufLen = 1 << 20;
+};
@@ -0,0 +1,80 @@
+/* file: Digest.h
+ * ---------------
+ * Fixed width key grouping files in a FileStore: what is known of a file's
+ * contents so far, from its size alone to a digest of all of its bytes.
+ * Keys of different kinds or sizes never compare equal.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "Hasher.h"
+#include <cstdint>
+#include <cstring>
+
+struct Digest {
+   enum Kind : uint8_t { kNone, kSize, kFingerprint, kContent };
+
+   // Key of a file only known by its size.
+   static Digest bySize(uint64_t size) {
+      Digest d;
+      d.kind = kSize;
+      d.size = size;
+      return d;
+   }
+   // Key of a file whose bytes, or head and tail for kFingerprint, digest
+   // to the len bytes at res.
+   static Digest of(Kind kind, uint64_t size, const unsigned char* res,
+                    size_t len) {
+      Digest d;
+      d.kind = kind;
+      d.size = size;
+      memcpy(d.bytes, res, len);
+      return d;
+   }
+
+   bool operator==(const Digest& o) const { return memcmp(this, &o, sizeof(*this)) == 0; }
+   bool operator!=(const Digest& o) const { return !(*this == o); }
+   // Mixes every word, since size keys carry no digest bytes.
+   uint64_t hash() const {
+      uint64_t words[sizeof(Digest) / 8];
+      memcpy(words, this, sizeof(words));
+      uint64_t h = 0;
+      for (uint64_t w : words) {
+         h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+         h ^= h >> 29;
+      }
+      return h;
+   }
+
+   uint64_t size = 0;
+   // Sets apart files whose digests match but whose bytes differ, see
+   // HashPipeline::verifyShared.
+   uint32_t split = 0;
+   Kind kind = kNone;
+   uint8_t pad[3] = {}; // No implicit padding, so digests compare as bytes.
+   unsigned char bytes[Hasher::kMaxDigestLen] = {};
+};
+
+static_assert(sizeof(Digest) == 16 + Hasher::kMaxDigestLen, "Digest has padding.");
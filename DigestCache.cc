@@ -0,0 +1,358 @@
+/* file: DigestCache.cc
+ * ---------------------
+ * Persistent cache of file digests, so files unchanged since a previous run
+ * are not read again. Entries are keyed by device and inode, and only hit
+ * if size, mtime and ctime are unchanged. The cache file is a header
+ * followed by fixed size binary records, each with a checksum. New records
+ * are appended, so a crash can at worst leave a torn last record, which is
+ * dropped when loading. Compacting rewrites the file aside and renames it
+ * over the old one.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "DigestCache.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <system_error>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+using namespace std;
+
+const size_t DigestCache::kDigestLen;
+const uint8_t DigestCache::kHasFingerprint;
+const uint8_t DigestCache::kHasContent;
+
+// File starts with kMagic then the record length, which changes with the
+// layout, both in host byte order.
+static const char kMagic[8] = {'u', 'n', 'i', 'd', 'u', 'p', 'e', 'C'};
+static const size_t kHeaderLen = sizeof(kMagic) + sizeof(uint32_t);
+// dev, ino, size, mtime sec, ctime sec, mtime ns, ctime ns, flags, algo,
+// padding, two digests and checksum.
+static const size_t kRecordLen = 5*8 + 2*4 + 4 + 2*DigestCache::kDigestLen + 4;
+
+
+/* function: checksum
+ * ------------------
+ * FNV-1a, enough to tell a torn or garbled record.
+ */
+static uint32_t checksum(const unsigned char* data, size_t len) {
+   uint32_t h = 2166136261u;
+   for (size_t i = 0; i < len; i++) {
+      h ^= data[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+/* function: writeAll
+ * ------------------
+ */
+static void writeAll(int fd, const vector<unsigned char>& buf, const string& path) {
+   size_t done = 0;
+   while (done < buf.size()) {
+      ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         throw system_error(errno, system_category(), path);
+      done += n;
+   }
+}
+
+
+/* function: DigestCache
+ * ---------------------
+ */
+DigestCache::DigestCache(const string& p, Hasher::Algo a) : path(p), algo(a), onDisk(0),
+      needsRewrite(false) {
+   load();
+}
+
+
+/* function: defaultPath
+ * ---------------------
+ */
+string DigestCache::defaultPath() {
+   const char* xdg = getenv("XDG_CACHE_HOME");
+   const char* home = getenv("HOME");
+   string dir;
+   if (xdg != nullptr && *xdg != '\0')
+      dir = xdg;
+   else if (home != nullptr)
+      dir = string(home) + "/.cache";
+   else
+      dir = ".";
+   return dir + "/unidupe/digests";
+}
+
+
+/* function: find
+ * --------------
+ */
+bool DigestCache::find(const FsNode& nd, bool fingerprint, unsigned char* digest) {
+   lock_guard<mutex> lk(mtx);
+   unordered_map<FileId, Entry, FileIdHash>::iterator it =
+      entries.find(FileId{(uint64_t)nd.dev, (uint64_t)nd.ino});
+   if (it == entries.end() || !matches(it->second, nd))
+      return false;
+   Entry& entry = it->second;
+   uint8_t flag = fingerprint ? kHasFingerprint : kHasContent;
+   if (!(entry.flags & flag))
+      return false;
+   memcpy(digest, fingerprint ? entry.fingerprint : entry.content, kDigestLen);
+   return true;
+}
+
+
+/* function: record
+ * ----------------
+ */
+void DigestCache::record(const FsNode& nd, bool fingerprint,
+                         const unsigned char* digest) {
+   lock_guard<mutex> lk(mtx);
+   Entry& entry = entryFor(nd);
+   entry.flags |= fingerprint ? kHasFingerprint : kHasContent;
+   memcpy(fingerprint ? entry.fingerprint : entry.content, digest, kDigestLen);
+   dirty.insert(FileId{(uint64_t)nd.dev, (uint64_t)nd.ino});
+}
+
+
+/* function: entryFor
+ * ------------------
+ */
+DigestCache::Entry& DigestCache::entryFor(const FsNode& nd) {
+   Entry& entry = entries[FileId{(uint64_t)nd.dev, (uint64_t)nd.ino}];
+   if (!matches(entry, nd) || entry.flags == 0) {
+      memset(&entry, 0, sizeof(entry));
+      entry.size = nd.size;
+      entry.mtimeSec = nd.date_modified.tv_sec;
+      entry.mtimeNsec = nd.date_modified.tv_nsec;
+      entry.ctimeSec = nd.date_changed.tv_sec;
+      entry.ctimeNsec = nd.date_changed.tv_nsec;
+      entry.algo = algo;
+   }
+   return entry;
+}
+
+
+/* function: matches
+ * -----------------
+ */
+bool DigestCache::matches(const Entry& entry, const FsNode& nd) const {
+   return entry.algo == algo && entry.size == nd.size &&
+          entry.mtimeSec == nd.date_modified.tv_sec &&
+          entry.mtimeNsec == (uint32_t)nd.date_modified.tv_nsec &&
+          entry.ctimeSec == nd.date_changed.tv_sec &&
+          entry.ctimeNsec == (uint32_t)nd.date_changed.tv_nsec;
+}
+
+
+/* function: load
+ * --------------
+ * Reads the whole file at once. Later records supersede earlier ones.
+ */
+void DigestCache::load() {
+   int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      needsRewrite = true;
+      return;
+   }
+   vector<unsigned char> buf;
+   struct stat st;
+   if (fstat(fd, &st) == 0) {
+      buf.resize(st.st_size);
+      size_t got = 0;
+      while (got < buf.size()) {
+         ssize_t n = read(fd, buf.data() + got, buf.size() - got);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n <= 0)
+            break;
+         got += n;
+      }
+      buf.resize(got);
+   }
+   close(fd);
+
+   uint32_t recLen = 0;
+   if (buf.size() >= kHeaderLen)
+      memcpy(&recLen, buf.data() + sizeof(kMagic), sizeof(recLen));
+   if (buf.size() < kHeaderLen || memcmp(buf.data(), kMagic, sizeof(kMagic)) != 0 ||
+       recLen != kRecordLen) {
+      needsRewrite = true;
+      return;
+   }
+   size_t pos = kHeaderLen;
+   for (; pos + kRecordLen <= buf.size(); pos += kRecordLen) {
+      const unsigned char* r = buf.data() + pos;
+      uint32_t check;
+      memcpy(&check, r + kRecordLen - 4, 4);
+      if (check != checksum(r, kRecordLen - 4))
+         break;
+      FileId id;
+      Entry entry;
+      memcpy(&id.dev, r, 8);
+      memcpy(&id.ino, r + 8, 8);
+      memcpy(&entry.size, r + 16, 8);
+      memcpy(&entry.mtimeSec, r + 24, 8);
+      memcpy(&entry.ctimeSec, r + 32, 8);
+      memcpy(&entry.mtimeNsec, r + 40, 4);
+      memcpy(&entry.ctimeNsec, r + 44, 4);
+      entry.flags = r[48];
+      entry.algo = r[49];
+      memcpy(entry.fingerprint, r + 52, kDigestLen);
+      memcpy(entry.content, r + 52 + kDigestLen, kDigestLen);
+      entries[id] = entry;
+      onDisk++;
+   }
+   needsRewrite = (pos != buf.size());
+}
+
+
+/* function: write
+ * ---------------
+ * Writes records of ids, or of every entry if ids is null.
+ */
+void DigestCache::write(int fd, bool header,
+                        const unordered_set<FileId, FileIdHash>* ids) {
+   vector<unsigned char> buf;
+   if (header) {
+      uint32_t recLen = kRecordLen;
+      buf.insert(buf.end(), kMagic, kMagic + sizeof(kMagic));
+      buf.insert(buf.end(), (unsigned char*)&recLen, (unsigned char*)&recLen + 4);
+   }
+   unsigned char r[kRecordLen];
+   for (const pair<const FileId, Entry>& it : entries) {
+      if (ids != nullptr && ids->find(it.first) == ids->end())
+         continue;
+      const Entry& entry = it.second;
+      memset(r, 0, sizeof(r));
+      memcpy(r, &it.first.dev, 8);
+      memcpy(r + 8, &it.first.ino, 8);
+      memcpy(r + 16, &entry.size, 8);
+      memcpy(r + 24, &entry.mtimeSec, 8);
+      memcpy(r + 32, &entry.ctimeSec, 8);
+      memcpy(r + 40, &entry.mtimeNsec, 4);
+      memcpy(r + 44, &entry.ctimeNsec, 4);
+      r[48] = entry.flags;
+      r[49] = entry.algo;
+      memcpy(r + 52, entry.fingerprint, kDigestLen);
+      memcpy(r + 52 + kDigestLen, entry.content, kDigestLen);
+      uint32_t check = checksum(r, kRecordLen - 4);
+      memcpy(r + kRecordLen - 4, &check, 4);
+      buf.insert(buf.end(), r, r + kRecordLen);
+   }
+   writeAll(fd, buf, path);
+}
+
+
+/* function: flush
+ * ---------------
+ */
+void DigestCache::flush() {
+   lock_guard<mutex> lk(mtx);
+   if (dirty.empty() && !needsRewrite)
+      return;
+   if (needsRewrite || onDisk + dirty.size() > 2 * entries.size() + 1024) {
+      rewrite();
+      return;
+   }
+   int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+   if (fd < 0)
+      throw system_error(errno, system_category(), path);
+   try {
+      flock(fd, LOCK_EX);
+      write(fd, false, &dirty);
+      if (fdatasync(fd) < 0)
+         throw system_error(errno, system_category(), path);
+   } catch (...) {
+      close(fd);
+      throw;
+   }
+   close(fd);
+   onDisk += dirty.size();
+   dirty.clear();
+}
+
+
+/* function: compact
+ * -----------------
+ */
+void DigestCache::compact() {
+   lock_guard<mutex> lk(mtx);
+   rewrite();
+}
+
+
+/* function: rewrite
+ * -----------------
+ * The new file is synced before being renamed over the old one, so the cache
+ * is either the old or the new file after a crash.
+ */
+void DigestCache::rewrite() {
+   // Create the cache's folder, and its parent, if this is the first run.
+   size_t slash = path.find_last_of('/');
+   if (slash != string::npos && slash > 0) {
+      string dir = path.substr(0, slash);
+      size_t up = dir.find_last_of('/');
+      if (up != string::npos && up > 0)
+         mkdir(dir.substr(0, up).c_str(), 0755);
+      mkdir(dir.c_str(), 0755);
+   }
+   string tmp = path + ".tmp";
+   int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      throw system_error(errno, system_category(), tmp);
+   try {
+      write(fd, true, nullptr);
+      if (fsync(fd) < 0)
+         throw system_error(errno, system_category(), tmp);
+   } catch (...) {
+      close(fd);
+      unlink(tmp.c_str());
+      throw;
+   }
+   close(fd);
+   if (rename(tmp.c_str(), path.c_str()) < 0)
+      throw system_error(errno, system_category(), path);
+   // Make the rename itself durable.
+   int dfd = open(slash == string::npos ? "." : path.substr(0, max(slash, (size_t)1)).c_str(),
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (dfd >= 0) {
+      fsync(dfd);
+      close(dfd);
+   }
+   onDisk = entries.size();
+   dirty.clear();
+   needsRewrite = false;
+}
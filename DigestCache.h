@@ -0,0 +1,112 @@
+/* file: DigestCache.h
+ * --------------------
+ * Persistent cache of file digests, so files unchanged since a previous run
+ * are not read again. Entries are keyed by device and inode, and only hit
+ * if size, mtime and ctime are unchanged. The cache file is a header
+ * followed by fixed size binary records, each with a checksum. New records
+ * are appended, so a crash can at worst leave a torn last record, which is
+ * dropped when loading. Compacting rewrites the file aside and renames it
+ * over the old one.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FsNode.h"
+#include "Hasher.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <cstdint>
+#include <sys/types.h>
+
+class DigestCache {
+  public:
+   static const size_t kDigestLen = Hasher::kMaxDigestLen;
+
+   // Loads the cache at path. A missing or unreadable file is an empty cache.
+   // Digests recorded with another algo than algo are not found.
+   explicit DigestCache(const std::string& path, Hasher::Algo algo = Hasher::kMd5);
+   // $XDG_CACHE_HOME/unidupe/digests, or ~/.cache/unidupe/digests.
+   static std::string defaultPath();
+   // Copies to digest the fingerprint or content digest recorded for nd, if
+   // any was recorded while the file had the same size, mtime and ctime.
+   // Digests shorter than kDigestLen are padded with zeros.
+   // Thread safe.
+   bool find(const FsNode& nd, bool fingerprint, unsigned char* digest);
+   // Records the fingerprint or content digest of nd. Thread safe.
+   void record(const FsNode& nd, bool fingerprint, const unsigned char* digest);
+   // Writes records made since loading to the file, compacting it instead if
+   // it is mostly made of superseded records.
+   void flush();
+   // Rewrites the file with only the latest record of each file.
+   void compact();
+   size_t size() const { return entries.size(); }
+
+  private:
+   // Identifies a file on the system.
+   struct FileId {
+      uint64_t dev;
+      uint64_t ino;
+      bool operator==(const FileId& o) const { return dev == o.dev && ino == o.ino; }
+   };
+   struct FileIdHash {
+      size_t operator()(const FileId& id) const { return id.dev * 0x9e3779b97f4a7c15ULL ^ id.ino; }
+   };
+   // What is known of a file, as stored in a record.
+   struct Entry {
+      uint64_t size;
+      int64_t mtimeSec;
+      int64_t ctimeSec;
+      uint32_t mtimeNsec;
+      uint32_t ctimeNsec;
+      uint8_t flags; // kHasFingerprint | kHasContent
+      uint8_t algo; // Hasher::Algo of both digests.
+      unsigned char fingerprint[kDigestLen];
+      unsigned char content[kDigestLen];
+   };
+   // Entry for nd's current state, replacing a stale one. mtx must be held.
+   Entry& entryFor(const FsNode& nd);
+   // Whether entry describes nd as it is now, digested with algo.
+   bool matches(const Entry& entry, const FsNode& nd) const;
+   // Loads records, stopping at the first torn or corrupt one.
+   void load();
+   // Writes every entry to a new file renamed over the old one. mtx must be
+   // held.
+   void rewrite();
+   // Writes the header, then a record per id, to fd.
+   void write(int fd, bool header, const std::unordered_set<FileId, FileIdHash>* ids);
+
+   std::string path;
+   Hasher::Algo algo;
+   std::mutex mtx;
+   std::unordered_map<FileId, Entry, FileIdHash> entries;
+   std::unordered_set<FileId, FileIdHash> dirty; // Recorded since loading.
+   size_t onDisk; // Records in the file, superseded ones included.
+   bool needsRewrite; // File missing, corrupt or from another version.
+
+   static const uint8_t kHasFingerprint = 1;
+   static const uint8_t kHasContent = 2;
+};
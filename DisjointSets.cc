@@ -0,0 +1,85 @@
+/* file: DisjointSets.cc
+ * ---------------------
+ * Union-find by size with path halving.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "DisjointSets.h"
+#include <utility>
+
+using namespace std;
+
+/* function: add
+ * -------------
+ */
+DisjointSets::Id DisjointSets::add() {
+   Id id = parents.size();
+   parents.push_back(id);
+   sizes.push_back(1);
+   return id;
+}
+
+
+/* function: find
+ * --------------
+ *  Points every other id on the way at its grandparent, which halves the
+ *  path for the next find.
+ */
+DisjointSets::Id DisjointSets::find(Id id) {
+   while (parents[id] != id) {
+      parents[id] = parents[parents[id]];
+      id = parents[id];
+   }
+   return id;
+}
+
+
+/* function: unite
+ * ---------------
+ *  The smaller set hangs under the larger, so no path grows longer than the
+ *  log of the number of ids.
+ */
+bool DisjointSets::unite(Id a, Id b) {
+   a = find(a);
+   b = find(b);
+   if (a == b)
+      return false;
+   if (sizes[a] < sizes[b])
+      swap(a, b);
+   parents[b] = a;
+   sizes[a] += sizes[b];
+   return true;
+}
+
+
+/* function: clear
+ * ---------------
+ */
+void DisjointSets::clear() {
+   parents.clear();
+   parents.shrink_to_fit();
+   sizes.clear();
+   sizes.shrink_to_fit();
+}
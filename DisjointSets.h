@@ -0,0 +1,56 @@
+/* file: DisjointSets.h
+ * --------------------
+ * Union-find over dense ids, used to gather files which are duplicates of
+ * one another by content or by path, however they chain. Union by size and
+ * path halving keep every operation near constant time.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class DisjointSets {
+  public:
+   typedef uint32_t Id;
+
+   // Adds a set holding only the id returned, the number of ids added
+   // before it.
+   Id add();
+   // Id representing the set holding id. Equal for ids of the same set
+   // until the set is joined to another one.
+   Id find(Id id);
+   // Joins the sets holding a and b. False if they were the same set.
+   bool unite(Id a, Id b);
+   // Number of ids in the set holding id.
+   Id setSize(Id id) { return sizes[find(id)]; }
+   size_t size() const { return parents.size(); }
+   void clear();
+
+  private:
+   std::vector<Id> parents; // Of an id, itself for the id representing a set.
+   std::vector<Id> sizes; // Of the set an id represents.
+};
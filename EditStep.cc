@@ -1,7 +1,7 @@
 /* file: EditStep.cc
  * ----------------
  *  From FsNodes, contains command to generate file on file system
- *  using cp or mkdir in terminal.
+ *  using cp, ln or mkdir in terminal.
  *
  * -----------------------------------------------------------------
  *  MIT License
@@ -30,49 +30,122 @@
 #include "EditStep.h"
 #include <stdexcept>
 #include <cstring>
+#include <algorithm>
 using namespace std;
 
+/* function: newArg
+ * ----------------
+ * Dynamically allocates and copies string contents for commands.
+ */
+static char* newArg(const string& arg) {
+   char* c = new char[arg.size() + 1];
+   arg.copy(c, arg.size());
+   c[arg.size()] = '\0';
+   return c;
+}
+
+
 EditStep::EditStep(string o, FsNode* s = nullptr, FsNode* d = nullptr) : op(o) {
    if (d == nullptr)
       throw invalid_argument("Null pointer as destination.");
-   if (op != "mkdir" && op != "cp")
-      throw invalid_argument("EditStep must be of type mkdir or cp.");
-   // Dynamically allocate and copy string contents for commands.
-   size_t arg0len = op.size()+1;
-   com[0] = new char[arg0len];
-   op.copy(com[0], arg0len - 1);
-   com[0][arg0len-1] = '\0';
+   if (op != "mkdir" && op != "cp" && op != "tree")
+      throw invalid_argument("EditStep must be of type mkdir, cp or tree.");
+   if (op != "mkdir" && s == nullptr)
+      throw invalid_argument("EditStep: Null pointer as source.");
+   fill(com, com + UNIDUPE_MAX_ARGS, nullptr);
+   // Paths are only built here, from parent links.
+   vector<string> command = EditStep::command(op, s ? s->path() : "", d->dstPath());
+   for (size_t i = 0; i < command.size(); i++)
+      com[i] = newArg(command[i]);
    if (op == "mkdir") {
-      size_t arg1len = d->path.size()+1;
-      com[1] = new char[arg1len];
-      d->path.copy(com[1], arg1len - 1);
-      com[1][arg1len-1] = '\0';
-
-      com[2] = com[3] = nullptr;
       acting = d;
-   } else if (op == "cp") {
-      string opt = "--backup=numbered";
-      size_t arg1len = opt.size()+1;
-      com[1] = new char[arg1len];
-      opt.copy(com[1], arg1len - 1);
-      com[1][arg1len-1] = '\0';
+      // Only the root is not planned in another folder.
+      waitsOn[0] = d->dstParent;
+   } else {
+      acting = s;
+      waitsOn[0] = d;
+   }
+   waitsOn[1] = nullptr;
+}
+
 
-      if (s == nullptr)
-         throw invalid_argument("EditStep: Null pointer as source.");
+EditStep::EditStep(string o, FsNode* a, const string& src, const string& dst,
+                   FsNode* after, FsNode* also) : op(o), acting(a) {
+   if (a == nullptr)
+      throw invalid_argument("EditStep: Null pointer as acting node.");
+   if (op != "link" && op != "reflink" && op != "pool" && op != "mv")
+      throw invalid_argument("EditStep must be of type link, reflink, pool or mv.");
+   fill(com, com + UNIDUPE_MAX_ARGS, nullptr);
+   vector<string> command = EditStep::command(op, src, dst);
+   for (size_t i = 0; i < command.size(); i++)
+      com[i] = newArg(command[i]);
+   waitsOn[0] = after;
+   waitsOn[1] = also;
+}
 
-      size_t arg2len = s->path.size()+1;
-      com[2] = new char[arg2len];
-      s->path.copy(com[2], arg2len - 1);
-      com[2][arg2len-1] = '\0';
-      
-      size_t arg3len = d->path.size()+1;
-      com[3] = new char[arg3len];
-      d->path.copy(com[3], arg3len - 1);
-      com[3][arg3len-1] = '\0';
 
-      acting = s;
-   }
-   com[4] = nullptr;
+EditStep::EditStep(string o, const vector<string>& command) : op(o), acting(nullptr) {
+   if (op != "mkdir" && op != "cp" && op != "tree" && op != "link" &&
+       op != "reflink" && op != "pool" && op != "mv")
+      throw invalid_argument("EditStep: Unknown op " + op + ".");
+   // A command and at least one path, null terminated.
+   if (command.size() < 2 || command.size() >= UNIDUPE_MAX_ARGS ||
+       (op != "mkdir" && command.size() < 3))
+      throw invalid_argument("EditStep: Bad command for " + op + ".");
+   fill(com, com + UNIDUPE_MAX_ARGS, nullptr);
+   for (size_t i = 0; i < command.size(); i++)
+      com[i] = newArg(command[i]);
+   waitsOn[0] = waitsOn[1] = nullptr;
+}
+
+
+/* function: command
+ * -----------------
+ */
+vector<string> EditStep::command(const string& op, const string& src,
+                                 const string& dst) {
+   if (op == "mkdir") // An existing folder is not an error.
+      return {"mkdir", "-p", dst};
+   // Copies keep their mtime, which --incremental judges them by, as
+   // CopyEngine does.
+   if (op == "cp")
+      return {"cp", "--backup=numbered", "--preserve=mode,timestamps", src, dst};
+   if (op == "tree")
+      return {"cp", "-RL", "-p", "--backup=numbered", src, dst};
+   if (op == "link")
+      return {"ln", "--backup=numbered", src, dst};
+   if (op == "reflink")
+      return {"cp", "--backup=numbered", "--reflink=auto", "--preserve=mode,timestamps",
+              src, dst};
+   if (op == "pool")
+      return {"cp", "-n", src, dst};
+   if (op == "mv")
+      return {"mv", "--backup=numbered", src, dst};
+   throw invalid_argument("EditStep: Unknown op " + op + ".");
+}
+
+
+/* function: src
+ * -------------
+ */
+const char* EditStep::src() const {
+   if (op == "mkdir")
+      return nullptr;
+   int n = 0;
+   while (com[n + 1] != nullptr)
+      n++;
+   return com[n - 1];
+}
+
+
+/* function: dst
+ * -------------
+ */
+const char* EditStep::dst() const {
+   int n = 0;
+   while (com[n + 1] != nullptr)
+      n++;
+   return com[n];
 }
 
 /* // Breaks program when uncommented for some reason.
@@ -1,7 +1,7 @@
 /* file: EditStep.h
  * ----------------
  *  From FsNodes, contains command to generate file on file system
- *  using cp or mkdir in terminal.
+ *  using cp, ln or mkdir in terminal.
  *
  * -----------------------------------------------------------------
  *  MIT License
@@ -29,18 +29,47 @@
 
 #pragma once
 #include <string>
+#include <vector>
 #include "FsNode.h"
 
-#define UNIDUPE_MAX_ARGS 5
+#define UNIDUPE_MAX_ARGS 8
 
+// Ops and their commands:
+//   mkdir    mkdir -p DST
+//   cp       cp --backup=numbered --preserve=mode,timestamps SRC DSTDIR
+//   tree     cp -RL -p --backup=numbered SRC DSTDIR, SRC a folder
+//   link     ln --backup=numbered SRC DST
+//   reflink  cp --backup=numbered --reflink=auto --preserve=mode,timestamps
+//            SRC DST
+//   pool     cp -n SRC DST, keeping a file already at DST
+//   mv       mv --backup=numbered SRC DST
 class EditStep {
   public:
    EditStep() {}
-   EditStep(std::string o, FsNode* s, FsNode* d); // Sets all member vars.
+   // mkdir of d, or cp or tree of s into the folder d. Sets all member
+   // vars.
+   EditStep(std::string o, FsNode* s, FsNode* d);
+   // link, reflink, pool or mv of the file at src to the path dst, creating
+   // a.
+   // Runs once after and, unless null, also have been created.
+   EditStep(std::string o, FsNode* a, const std::string& src,
+            const std::string& dst, FsNode* after, FsNode* also = nullptr);
+   // Step of a saved plan running command, with no nodes to wait on.
+   EditStep(std::string o, const std::vector<std::string>& command);
 //   ~EditStep(); // Breaks program when uncommented for some reason.
+   // Paths within com. src is null for mkdir.
+   const char* src() const;
+   const char* dst() const;
+   // Command of a step of op from src to dst, the folder copied into for
+   // cp and tree. src is ignored for mkdir.
+   static std::vector<std::string> command(const std::string& op,
+                                           const std::string& src,
+                                           const std::string& dst);
 
    std::string op;
    char* com[UNIDUPE_MAX_ARGS]; // Terminal commands used by execvp.
    FsNode* acting; // Acting node (src for copy, dst for mkdir).
+   // Nodes whose steps must be done before this one runs, null if none.
+   FsNode* waitsOn[2];
 };
 
@@ -0,0 +1,847 @@
+/* file: ExternalMerge.cc
+ * ----------------------
+ * Out of core planning: every stage streams sorted records from one
+ * ExternalSort into the next, holding at most a few records of each.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "ExternalMerge.h"
+#include "ExternalSort.h"
+#include "SpillFile.h"
+#include "FileStore.h"
+#include "NodeArena.h"
+#include "Metrics.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const uint32_t kNoStep = UINT32_MAX;
+// Bytes of directory entries read per system call while scanning.
+static const size_t kDentsBufLen = 256 << 10;
+// Files of a folder held while it is read, the rest are spilled.
+static const size_t kFolderHeld = 1 << 16;
+
+
+/* function: comparePaths
+ * ----------------------
+ * Orders paths with '/' before any other byte, so every path under a folder
+ * comes right after it, before paths which only share a prefix with it.
+ */
+static int comparePaths(string_view a, string_view b) {
+   size_t n = min(a.size(), b.size());
+   for (size_t i = 0; i < n; i++) {
+      if (a[i] == b[i])
+         continue;
+      if (a[i] == '/' || b[i] == '/')
+         return (a[i] == '/') ? -1 : 1;
+      return ((unsigned char)a[i] < (unsigned char)b[i]) ? -1 : 1;
+   }
+   return (a.size() < b.size()) ? -1 : (a.size() > b.size());
+}
+
+
+/* function: isUnder
+ * -----------------
+ * Whether path is in the folder dir, at any depth. Every path is under "".
+ */
+static bool isUnder(string_view path, string_view dir) {
+   return dir.empty() || (path.size() > dir.size() && path[dir.size()] == '/' &&
+                          path.compare(0, dir.size(), dir) == 0);
+}
+
+
+/* function: dirName
+ * -----------------
+ */
+static string_view dirName(string_view path) {
+   size_t slash = path.find_last_of('/');
+   return (slash == string_view::npos) ? string_view() : path.substr(0, slash);
+}
+
+
+/* function: baseName
+ * ------------------
+ */
+static string_view baseName(string_view path) {
+   size_t slash = path.find_last_of('/');
+   return (slash == string_view::npos) ? path : path.substr(slash + 1);
+}
+
+
+// A file found by scan, as planning learns more about it.
+struct ExternalMerge::FileRec {
+   // Saved as is.
+   struct Fields {
+      uint64_t id; // In scan order.
+      uint64_t label; // Smallest id of the files joined to it so far.
+      uint64_t size;
+      struct timespec changed;
+      struct timespec modified;
+      uint64_t dev;
+      uint64_t ino;
+      uint32_t parentFiles; // Files in its folder, as FsNode::num_files.
+      uint32_t relAt; // Where the path within its tree starts in path.
+      uint32_t dir; // Step making the folder it is planned in.
+      uint32_t shared; // Non-zero if another file has its key.
+      Digest key;
+   } f;
+   string path;
+
+   string_view rel() const { return string_view(path).substr(f.relAt); }
+   // comparRecent of FsTree, for records.
+   bool olderThan(const FileRec& o) const;
+   void save(SpillFile& out) const {
+      out.write(&f, sizeof(f));
+      out.putStr(path);
+   }
+   bool load(SpillFile& in) {
+      if (!in.read(&f, sizeof(f)))
+         return false;
+      if (!in.getStr(path))
+         throw runtime_error("Spill file ends within a record.");
+      return true;
+   }
+   size_t heapBytes() const { return path.capacity(); }
+};
+
+
+/* function: olderThan
+ * -------------------
+ */
+bool ExternalMerge::FileRec::olderThan(const FileRec& o) const {
+   const struct timespec& t1 = f.changed;
+   const struct timespec& t2 = o.f.changed;
+   if (t1.tv_sec != t2.tv_sec)
+      return t1.tv_sec < t2.tv_sec;
+   if (t1.tv_nsec != t2.tv_nsec)
+      return t1.tv_nsec < t2.tv_nsec;
+   if (f.parentFiles != o.f.parentFiles)
+      return f.parentFiles > o.f.parentFiles;
+   return path > o.path;
+}
+
+
+// Orders files by one of the keys planning groups them by.
+struct ExternalMerge::FileOrder {
+   enum By { kSize, kKey, kPath, kLabel } by;
+
+   bool operator()(const FileRec& a, const FileRec& b) const;
+};
+
+struct ExternalMerge::FileSort : ExternalSort<FileRec, FileOrder> {
+   FileSort(const string& dir, size_t budget, FileOrder::By by) :
+      ExternalSort<FileRec, FileOrder>(dir, budget, FileOrder{by}) {}
+};
+
+
+/* function: operator()
+ * --------------------
+ * Within a key or a path, the smallest label comes first, so relabel sees
+ * the label of a group before its other files.
+ */
+bool ExternalMerge::FileOrder::operator()(const FileRec& a, const FileRec& b) const {
+   switch (by) {
+      case kSize:
+         if (a.f.size != b.f.size)
+            return a.f.size < b.f.size;
+         break;
+      case kKey: {
+         int c = memcmp(&a.f.key, &b.f.key, sizeof(Digest));
+         if (c != 0)
+            return c < 0;
+         if (a.f.label != b.f.label)
+            return a.f.label < b.f.label;
+         break;
+      }
+      case kPath: {
+         int c = comparePaths(a.rel(), b.rel());
+         if (c != 0)
+            return c < 0;
+         if (a.f.label != b.f.label)
+            return a.f.label < b.f.label;
+         break;
+      }
+      case kLabel:
+         if (a.f.label != b.f.label)
+            return a.f.label < b.f.label;
+         if (a.olderThan(b) != b.olderThan(a))
+            return b.olderThan(a);
+         break;
+   }
+   return a.f.id < b.f.id;
+}
+
+
+// A folder found by scan, by its path within its tree.
+struct ExternalMerge::DirRec {
+   string rel;
+
+   bool operator<(const DirRec& o) const { return comparePaths(rel, o.rel) < 0; }
+   void save(SpillFile& out) const { out.putStr(rel); }
+   bool load(SpillFile& in) { return in.getStr(rel); }
+   size_t heapBytes() const { return rel.capacity(); }
+};
+
+struct ExternalMerge::DirSort : ExternalSort<DirRec> {
+   using ExternalSort<DirRec>::ExternalSort;
+};
+
+
+// Labels found in one group by a pass of group, joined into sets, each
+// named by its smallest label. Stops joining, and forgets what it held,
+// once it would hold more than maxLabels.
+struct ExternalMerge::LabelSets {
+   explicit LabelSets(size_t max) : maxLabels(max), full(false) {}
+   uint64_t find(uint64_t label) {
+      unordered_map<uint64_t, uint64_t>::iterator it;
+      while ((it = parent.find(label)) != parent.end()) {
+         unordered_map<uint64_t, uint64_t>::iterator up = parent.find(it->second);
+         if (up != parent.end())
+            it->second = up->second; // Halves the path.
+         label = it->second;
+      }
+      return label;
+   }
+   void unite(uint64_t a, uint64_t b) {
+      if (full)
+         return;
+      a = find(a);
+      b = find(b);
+      if (a == b)
+         return;
+      if (parent.size() >= maxLabels) {
+         full = true;
+         parent.clear();
+         return;
+      }
+      parent[max(a, b)] = min(a, b);
+   }
+
+   unordered_map<uint64_t, uint64_t> parent; // Of labels but the smallest.
+   size_t maxLabels;
+   bool full;
+};
+
+
+// An older duplicate to keep in the history folder of its set.
+struct ExternalMerge::HistRec {
+   enum How : uint32_t { kCopy, kLink, kReflink, kPool };
+   // Saved as is.
+   struct Fields {
+      uint64_t label;
+      struct timespec changed; // For the order of files of the same name.
+      uint32_t parentFiles;
+      How how;
+      uint32_t histStep; // Making the history folder.
+      uint32_t keptStep; // Copying the file kept, or the pool copy.
+      Digest key;
+   } f;
+   string src; // Where the file is.
+   string histDir; // History folder it goes to.
+   string from; // File linked to, unless copied.
+
+   string_view name() const { return baseName(src); }
+   void save(SpillFile& out) const {
+      out.write(&f, sizeof(f));
+      out.putStr(src);
+      out.putStr(histDir);
+      out.putStr(from);
+   }
+   bool load(SpillFile& in) {
+      if (!in.read(&f, sizeof(f)))
+         return false;
+      if (!in.getStr(src) || !in.getStr(histDir) || !in.getStr(from))
+         throw runtime_error("Spill file ends within a record.");
+      return true;
+   }
+   size_t heapBytes() const { return src.capacity() + histDir.capacity() + from.capacity(); }
+};
+
+
+// Orders entries by history folder then name, most recent first, as
+// makeFileHist plans them, or first by key to pool their contents.
+struct ExternalMerge::HistOrder {
+   bool byKey;
+
+   bool operator()(const HistRec& a, const HistRec& b) const {
+      if (byKey) {
+         int c = memcmp(&a.f.key, &b.f.key, sizeof(Digest));
+         if (c != 0)
+            return c < 0;
+      }
+      if (a.f.label != b.f.label)
+         return a.f.label < b.f.label;
+      int c = a.name().compare(b.name());
+      if (c != 0)
+         return c < 0;
+      const struct timespec& t1 = a.f.changed;
+      const struct timespec& t2 = b.f.changed;
+      if (t1.tv_sec != t2.tv_sec)
+         return t1.tv_sec > t2.tv_sec;
+      if (t1.tv_nsec != t2.tv_nsec)
+         return t1.tv_nsec > t2.tv_nsec;
+      if (a.f.parentFiles != b.f.parentFiles)
+         return a.f.parentFiles < b.f.parentFiles;
+      return a.src < b.src;
+   }
+};
+
+struct ExternalMerge::HistSort : ExternalSort<HistRec, HistOrder> {
+   HistSort(const string& dir, size_t budget, bool byKey) :
+      ExternalSort<HistRec, HistOrder>(dir, budget, HistOrder{byKey}) {}
+};
+
+
+/* function: ExternalMerge
+ * -----------------------
+ */
+ExternalMerge::ExternalMerge(const Options& o, HashPipeline& h) :
+      opts(o), hasher(h), poolDir(kNoStep), dupGroups(0) {
+   if (opts.memoryLimit < kMinMemory)
+      throw invalid_argument("Memory limit must be at least " +
+                             to_string(kMinMemory >> 20) + "M.");
+   struct stat st;
+   if (stat(opts.spillDir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+      throw invalid_argument("Could not locate spill folder " + opts.spillDir);
+}
+
+
+/* function: plan
+ * --------------
+ */
+size_t ExternalMerge::plan(const vector<string>& pathsin, const string& out,
+                           const string& planPath) {
+   pathout = out;
+   poolDir = kNoStep;
+   dupGroups = 0;
+   writer.reset(new PlanWriter(opts.spillDir, share()));
+   optional<Metrics::Phase> phase;
+   unique_ptr<FileSort> bySize(new FileSort(opts.spillDir, share(), FileOrder::kSize));
+   {
+      DirSort dirs(opts.spillDir, share());
+      uint64_t nextId = 0;
+      phase.emplace("scan");
+      for (const string& path : pathsin)
+         scan(path, *bySize, dirs, nextId);
+      cout << "Planning merged tree at " << pathout << " out of core" << endl;
+      phase.emplace("merge");
+      dirs.finish();
+      SpillFile dirList(opts.spillDir);
+      planDirs(dirs, dirList);
+
+      phase.emplace("resolve");
+      unique_ptr<FileSort> byKey(new FileSort(opts.spillDir, share(), FileOrder::kKey));
+      hash(*bySize, *byKey);
+      bySize.reset();
+      phase.emplace("group");
+      bySize = group(move(byKey), dirList);
+   }
+   phase.emplace("hist");
+   planSets(*bySize);
+   bySize.reset();
+   Metrics::get().add(Metrics::kDupGroups, dupGroups);
+   phase.emplace("merge");
+   size_t steps = writer->size();
+   writer->save(planPath);
+   writer.reset();
+   return steps;
+}
+
+
+/* function: scan
+ * --------------
+ *  Folders are walked depth first from a stack, one at a time, so only the
+ *  folders waiting on the stack are held.
+ */
+void ExternalMerge::scan(const string& rootpath, FileSort& files, DirSort& dirs,
+                         uint64_t& nextId) {
+   cout << "Exploring tree at " << rootpath << endl;
+   struct stat st;
+   if (stat(rootpath.c_str(), &st) != 0)
+      throw invalid_argument("Could not locate " + rootpath);
+   if (!S_ISDIR(st.st_mode))
+      throw invalid_argument(rootpath + " is not a directory.");
+
+   vector<char> dents(kDentsBufLen);
+   vector<pair<string, string>> pending{{rootpath, ""}}; // Path, and within tree.
+   vector<FileRec> held;
+   while (!pending.empty()) {
+      string path = move(pending.back().first);
+      string rel = move(pending.back().second);
+      pending.pop_back();
+      int dfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dfd < 0 && errno == ENOENT)
+         throw invalid_argument("Could not locate " + path);
+      if (dfd < 0 && errno == ENOTDIR)
+         throw invalid_argument(path + " is not a directory.");
+      if (dfd < 0)
+         throw invalid_argument("Need permission to access " + path);
+
+      // Files wait until the folder is read, for its count of files.
+      held.clear();
+      unique_ptr<SpillFile> spilled;
+      uint32_t fileCount = 0;
+      uint64_t entries = 0;
+      try {
+         FsTree::readEntries(dfd, path, dents, [&](const char* name,
+                                                   unsigned char dtype) {
+            entries++;
+            string within = rel.empty() ? string(name) : rel + "/" + name;
+            struct stat fst;
+            bool isDir = (dtype == DT_DIR);
+            if (!isDir) {
+               // Follows links like stat, as FsTree::explore.
+               if (fstatat(dfd, name, &fst, 0) != 0)
+                  throw system_error(errno, system_category(), path + "/" + name);
+               isDir = S_ISDIR(fst.st_mode);
+            }
+            if (isDir) {
+               pending.push_back(make_pair(path + "/" + name, within));
+               dirs.push(DirRec{move(within)});
+               return;
+            }
+            FileRec rec;
+            rec.f = FileRec::Fields();
+            rec.f.id = rec.f.label = nextId++;
+            rec.f.size = fst.st_size;
+            rec.f.changed = fst.st_ctim;
+            rec.f.modified = fst.st_mtim;
+            rec.f.dev = fst.st_dev;
+            rec.f.ino = fst.st_ino;
+            rec.path = path + "/" + name;
+            rec.f.relAt = rec.path.size() - within.size();
+            fileCount++;
+            if (held.size() == kFolderHeld) {
+               if (!spilled)
+                  spilled.reset(new SpillFile(opts.spillDir));
+               for (const FileRec& r : held)
+                  r.save(*spilled);
+               held.clear();
+            }
+            held.push_back(move(rec));
+         });
+      } catch (...) {
+         close(dfd);
+         throw;
+      }
+      if (close(dfd) < 0)
+         throw system_error(errno, system_category(), path);
+      if (spilled) {
+         spilled->rewind();
+         FileRec rec;
+         while (rec.load(*spilled)) {
+            rec.f.parentFiles = fileCount;
+            files.push(move(rec));
+         }
+      }
+      for (FileRec& rec : held) {
+         rec.f.parentFiles = fileCount;
+         files.push(move(rec));
+      }
+      Metrics::get().add(Metrics::kEntriesScanned, entries);
+      Metrics::get().add(Metrics::kDirsScanned);
+   }
+}
+
+
+/* function: planDirs
+ * ------------------
+ *  Folders come in path order, so the folders above the next one are on a
+ *  stack, and its parent on top once the others are popped.
+ */
+void ExternalMerge::planDirs(DirSort& dirs, SpillFile& dirList) {
+   vector<pair<string, uint32_t>> above{{"", writer->add("mkdir", "", pathout)}};
+   DirRec dir;
+   while (dirs.next(dir)) {
+      if (above.size() > 1 && dir.rel == above.back().first)
+         continue; // Found in another tree too.
+      while (!isUnder(dir.rel, above.back().first))
+         above.pop_back();
+      uint32_t step = writer->add("mkdir", "", pathout + "/" + dir.rel);
+      writer->depend(above.back().second, step);
+      dirList.putStr(dir.rel);
+      dirList.putU32(step);
+      above.push_back(make_pair(move(dir.rel), step));
+   }
+   dirList.rewind();
+}
+
+
+/* function: hash
+ * --------------
+ *  A batch is hashed by HashPipeline as if its files were all there was,
+ *  which splits them the same since files sharing a size stay together.
+ *  A size shared by more files than a batch holds is hashed a batch at a
+ *  time by whole contents instead, which agree between batches, unless
+ *  files are verified byte by byte.
+ */
+void ExternalMerge::hash(FileSort& bySize, FileSort& byKey) {
+   bySize.finish();
+   vector<FileRec> batch;
+   size_t batchBytes = 0;
+   auto hashBatch = [&](bool whole) {
+      NodeArena nodes;
+      FileStore store;
+      for (const FileRec& rec : batch) {
+         FsNode nd;
+         nd.name = nodes.intern(rec.path); // A root, so its path is its name.
+         nd.kind = FsNode::kFile;
+         nd.size = rec.f.size;
+         nd.date_changed = rec.f.changed;
+         nd.date_modified = rec.f.modified;
+         nd.dev = rec.f.dev;
+         nd.ino = rec.f.ino;
+         store.add(nodes.make(nd), Digest::bySize(rec.f.size));
+      }
+      if (whole)
+         hasher.rekeyAll(store);
+      else
+         hasher.resolve(store);
+      for (FileStore::Id id = 0; id < batch.size(); id++) {
+         batch[id].f.key = store.key(id);
+         byKey.push(move(batch[id]));
+      }
+      batch.clear();
+      batchBytes = 0;
+   };
+   auto recBytes = [](const FileRec& rec) {
+      return sizeof(FileRec) + sizeof(FsNode) + 2 * rec.path.size();
+   };
+
+   vector<FileRec> same; // Files of one size.
+   size_t sameBytes = 0;
+   bool chunked = false; // Files of this size are hashed by whole contents.
+   auto toBatch = [&]() {
+      for (FileRec& rec : same) {
+         batchBytes += recBytes(rec);
+         batch.push_back(move(rec));
+      }
+      same.clear();
+      sameBytes = 0;
+   };
+   auto endSize = [&]() {
+      if (chunked) {
+         toBatch();
+         hashBatch(true);
+         chunked = false;
+      } else if (same.size() == 1) { // Cannot have a duplicate.
+         same[0].f.key = Digest::bySize(same[0].f.size);
+         byKey.push(move(same[0]));
+         same.clear();
+         sameBytes = 0;
+      } else {
+         toBatch();
+         if (batchBytes >= share())
+            hashBatch(false);
+      }
+   };
+   FileRec rec;
+   while (bySize.next(rec)) {
+      if (!same.empty() && rec.f.size != same[0].f.size)
+         endSize();
+      sameBytes += recBytes(rec);
+      same.push_back(move(rec));
+      if (sameBytes >= share() && !hasher.verifies()) {
+         if (!chunked && !batch.empty())
+            hashBatch(false);
+         chunked = true;
+         toBatch();
+         hashBatch(true);
+      }
+   }
+   if (!same.empty())
+      endSize();
+   if (!batch.empty())
+      hashBatch(false);
+}
+
+
+/* function: group
+ * ---------------
+ *  Labels spread along shared keys then shared paths, back and forth,
+ *  until a pass changes none: each set of duplicates then has one label,
+ *  the smallest id in it. That takes as many passes as the longest chain
+ *  of sets joined by a key then a path, each sorting every record. A pass
+ *  by key leaves one label per key, so the labels a pass by path finds in
+ *  the same path, joined in memory, complete the sets, and grouping ends
+ *  there when they fit in a share. Otherwise it goes on spreading labels.
+ */
+unique_ptr<ExternalMerge::FileSort> ExternalMerge::group(unique_ptr<FileSort> byKey,
+                                                         SpillFile& dirList) {
+   unique_ptr<FileSort> in = move(byKey);
+   unique_ptr<LabelSets> sets;
+   bool keyPass = true;
+   for (unsigned passes = 1; ; passes++) {
+      FileOrder::By next = keyPass ? FileOrder::kPath : FileOrder::kKey;
+      unique_ptr<FileSort> out(new FileSort(opts.spillDir, share(), next));
+      if (!keyPass)
+         sets.reset(new LabelSets(share() / kLabelBytes));
+      uint64_t changed = relabel(*in, *out, keyPass, passes <= 2,
+                                 passes == 2 ? &dirList : nullptr, sets.get());
+      in = move(out);
+      keyPass = !keyPass;
+      if (sets != nullptr && !sets->full)
+         break;
+      sets.reset();
+      if (changed == 0 && passes >= 2)
+         break;
+   }
+   unique_ptr<FileSort> byLabel(new FileSort(opts.spillDir, share(), FileOrder::kLabel));
+   in->finish();
+   FileRec rec;
+   while (in->next(rec)) {
+      if (sets != nullptr)
+         rec.f.label = sets->find(rec.f.label);
+      byLabel->push(move(rec));
+   }
+   return byLabel;
+}
+
+
+/* function: relabel
+ * -----------------
+ *  Files of a group come smallest label first, so each file is relabeled
+ *  as it passes. The first pass by key also counts groups and marks shared
+ *  keys, and the first by path finds the step making each file's folder,
+ *  as planDirs listed them.
+ */
+uint64_t ExternalMerge::relabel(FileSort& in, FileSort& out, bool byKey,
+                                bool first, SpillFile* dirList, LabelSets* sets) {
+   in.finish();
+   uint64_t changed = 0;
+   vector<pair<string, uint32_t>> above{{"", 0}};
+   string nextDir;
+   uint32_t nextStep = 0;
+   bool moreDirs = (dirList != nullptr) && dirList->getStr(nextDir) &&
+                   dirList->getU32(nextStep);
+
+   FileRec prev, rec;
+   bool havePrev = false;
+   uint64_t label = 0;
+   bool prevShared = false; // prev shares its key with the file before it.
+   auto same = [&](const FileRec& a, const FileRec& b) {
+      return byKey ? a.f.key == b.f.key : a.rel() == b.rel();
+   };
+   auto emit = [&](FileRec& r, bool sharedNext) {
+      if (byKey && first) {
+         r.f.shared = prevShared || sharedNext;
+         if (sharedNext && !prevShared)
+            dupGroups++;
+      }
+      out.push(move(r));
+   };
+   while (in.next(rec)) {
+      if (dirList != nullptr) {
+         string_view dir = dirName(rec.rel());
+         while (moreDirs && comparePaths(nextDir, rec.rel()) < 0) {
+            while (!isUnder(nextDir, above.back().first))
+               above.pop_back();
+            above.push_back(make_pair(nextDir, nextStep));
+            moreDirs = dirList->getStr(nextDir) && dirList->getU32(nextStep);
+         }
+         while (above.size() > 1 && above.back().first != dir)
+            above.pop_back();
+         rec.f.dir = above.back().second;
+      }
+      bool joined = havePrev && same(prev, rec);
+      if (joined) {
+         if (rec.f.label != label) {
+            if (sets != nullptr)
+               sets->unite(label, rec.f.label);
+            rec.f.label = label;
+            changed++;
+         }
+      } else {
+         label = rec.f.label;
+      }
+      if (havePrev) {
+         emit(prev, joined);
+         prevShared = joined;
+      }
+      prev = move(rec);
+      havePrev = true;
+   }
+   if (havePrev)
+      emit(prev, false);
+   return changed;
+}
+
+
+/* function: dstDir
+ * ----------------
+ */
+string ExternalMerge::dstDir(const FileRec& rec) const {
+   string_view dir = dirName(rec.rel());
+   return dir.empty() ? pathout : pathout + "/" + string(dir);
+}
+
+
+/* function: planSets
+ * ------------------
+ *  The first file of a label is its most recent. The others are gathered to
+ *  be planned by planHist in the order makeFileHist plans them, since files
+ *  of the same name in a history folder must be copied in order.
+ */
+void ExternalMerge::planSets(FileSort& byLabel) {
+   bool pool = (opts.history == FsTree::kHistPool);
+   HistSort hist(opts.spillDir, share(), pool);
+   byLabel.finish();
+   FileRec kept, rec;
+   bool haveKept = false;
+   string keptDir, keptPath;
+   uint32_t histStep = kNoStep, keptStep = kNoStep;
+   Metrics& metrics = Metrics::get();
+   // Plans kept, alone in its label or with a history folder.
+   auto planKept = [&](bool alone) {
+      keptDir = dstDir(kept);
+      keptPath = keptDir + "/" + string(baseName(kept.rel()));
+      if (!alone) {
+         histStep = writer->add("mkdir", "", keptDir + "/." +
+                                string(baseName(kept.rel())) + "_hist");
+         writer->depend(kept.f.dir, histStep);
+         metrics.add(Metrics::kHistFolders);
+      }
+      keptStep = writer->add("cp", kept.path, keptDir);
+      writer->depend(kept.f.dir, keptStep);
+   };
+   bool planned = false;
+   while (byLabel.next(rec)) {
+      if (haveKept && rec.f.label == kept.f.label) {
+         if (!planned) {
+            planKept(false);
+            planned = true;
+         }
+         HistRec entry;
+         entry.f = HistRec::Fields();
+         entry.f.label = rec.f.label;
+         entry.f.changed = rec.f.changed;
+         entry.f.parentFiles = rec.f.parentFiles;
+         entry.f.key = rec.f.key;
+         entry.f.histStep = histStep;
+         entry.f.how = HistRec::kCopy;
+         bool sameKey = rec.f.shared && rec.f.key == kept.f.key;
+         if (opts.history == FsTree::kHistPool && rec.f.shared && rec.f.key.split == 0) {
+            entry.f.how = HistRec::kPool;
+         } else if (sameKey && opts.history != FsTree::kHistCopy &&
+                    opts.history != FsTree::kHistPool) {
+            entry.f.how = (opts.history == FsTree::kHistHardlink) ? HistRec::kLink
+                                                                   : HistRec::kReflink;
+            entry.f.keptStep = keptStep;
+            entry.from = keptPath;
+         }
+         entry.src = move(rec.path);
+         entry.histDir = keptDir + "/." + string(baseName(kept.rel())) + "_hist";
+         hist.push(move(entry));
+         continue;
+      }
+      if (haveKept && !planned)
+         planKept(true);
+      kept = move(rec);
+      haveKept = true;
+      planned = false;
+   }
+   if (haveKept && !planned)
+      planKept(true);
+   planHist(hist);
+}
+
+
+/* function: planHist
+ * ------------------
+ *  With kHistPool, entries first come by key, and the first entry of a key
+ *  plans its pool copy, named by digest as FsTree::poolObject names it.
+ */
+void ExternalMerge::planHist(HistSort& hist) {
+   hist.finish();
+   HistRec entry;
+   unique_ptr<HistSort> byName;
+   if (opts.history == FsTree::kHistPool) {
+      byName.reset(new HistSort(opts.spillDir, share(), false));
+      static const char digits[] = "0123456789abcdef";
+      size_t keyLen = Hasher::digestLen(hasher.algo());
+      Digest pooled;
+      uint32_t poolStep = kNoStep;
+      string object;
+      while (hist.next(entry)) {
+         if (entry.f.how == HistRec::kPool) {
+            if (poolStep == kNoStep || entry.f.key != pooled) {
+               if (poolDir == kNoStep) {
+                  poolDir = writer->add("mkdir", "", pathout + "/.unidupe_pool");
+                  writer->depend(0, poolDir);
+               }
+               object = pathout + "/.unidupe_pool/";
+               for (size_t i = 0; i < keyLen; i++) {
+                  object += digits[entry.f.key.bytes[i] >> 4];
+                  object += digits[entry.f.key.bytes[i] & 0xf];
+               }
+               object += "-" + to_string(entry.f.key.size);
+               poolStep = writer->add("pool", entry.src, object);
+               writer->depend(poolDir, poolStep);
+               pooled = entry.f.key;
+            }
+            entry.f.keptStep = poolStep;
+            entry.from = object;
+         }
+         byName->push(move(entry));
+      }
+      byName->finish();
+   }
+   HistSort& in = byName ? *byName : hist;
+
+   HistRec prev;
+   uint32_t prevStep = kNoStep;
+   while (in.next(entry)) {
+      string dst = entry.histDir + "/" + string(entry.name());
+      uint32_t step;
+      if (entry.f.how == HistRec::kCopy) {
+         step = writer->add("cp", entry.src, entry.histDir);
+      } else {
+         const char* op = (entry.f.how == HistRec::kReflink) ? "reflink" : "link";
+         step = writer->add(op, entry.from, dst);
+         writer->depend(entry.f.keptStep, step);
+      }
+      writer->depend(entry.f.histStep, step);
+      // Copied over the one before, which gets a numbered backup name.
+      if (prevStep != kNoStep && prev.f.label == entry.f.label &&
+          prev.name() == entry.name())
+         writer->depend(prevStep, step);
+      prev = move(entry);
+      prevStep = step;
+   }
+}
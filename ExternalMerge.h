@@ -0,0 +1,119 @@
+/* file: ExternalMerge.h
+ * ---------------------
+ * Plans the merge of input trees as FsTree does, for trees too large to
+ * hold in memory. Files are scanned to records on disk, duplicates by
+ * contents and by path are grouped by sorting the records externally, and
+ * the plan is written to a file as it is made, so memory stays under a
+ * limit whatever the number of files.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FsTree.h"
+#include "HashPipeline.h"
+#include "Plan.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+class ExternalMerge {
+  public:
+   struct Options {
+      // Bytes held by records, buffers and hashed batches at once.
+      size_t memoryLimit = 256 << 20;
+      // Folder for the spilled records, on disk rather than in memory.
+      std::string spillDir = "/var/tmp";
+      FsTree::History history = FsTree::kHistCopy;
+   };
+
+   ExternalMerge(const Options& opts, HashPipeline& hasher);
+   // Plans merging the trees at pathsin into pathout, as the merge
+   // constructor of FsTree would, and writes the plan to planPath for
+   // Plan to run. Returns the number of steps. Runs the scan, merge,
+   // resolve, group and hist phases of Metrics.
+   size_t plan(const std::vector<std::string>& pathsin,
+               const std::string& pathout, const std::string& planPath);
+   // Bytes of the read buffers of all hashers which fit with memoryLimit.
+   static size_t readBudget(size_t memoryLimit) { return memoryLimit / kShares; }
+
+   static const size_t kMinMemory = 8 << 20;
+
+  private:
+   struct FileRec;
+   struct DirRec;
+   struct HistRec;
+   struct FileOrder;
+   struct HistOrder;
+   struct FileSort;
+   struct DirSort;
+   struct HistSort;
+   struct LabelSets;
+
+   // Adds a record for every file under rootpath to files and for every
+   // folder to dirs, numbering files from nextId.
+   void scan(const std::string& rootpath, FileSort& files, DirSort& dirs,
+             uint64_t& nextId);
+   // Plans the root and every folder found, each after its parent, and
+   // lists them in order with their step in dirList.
+   void planDirs(DirSort& dirs, SpillFile& dirList);
+   // Keys the files of bySize by contents, hashing the files sharing a size
+   // a batch at a time, into byKey.
+   void hash(FileSort& bySize, FileSort& byKey);
+   // Labels every file with the smallest id of the set of files joined to
+   // it by contents or by path, and sets where it is planned from dirList.
+   // Returns the files by label, most recent first within a label.
+   std::unique_ptr<FileSort> group(std::unique_ptr<FileSort> byKey,
+                                   SpillFile& dirList);
+   // One pass of group over in, sorted by key or path, into out, the first
+   // of its kind if first. Joins the labels of each group in sets, unless
+   // null. Returns how many labels changed.
+   uint64_t relabel(FileSort& in, FileSort& out, bool byKey, bool first,
+                    SpillFile* dirList, LabelSets* sets);
+   // Plans the files of each label as makeFileHist does: the most recent
+   // is copied, the others kept in a history folder next to it.
+   void planSets(FileSort& byLabel);
+   // Plans the entries of history folders gathered by planSets, pooling
+   // contents first with kHistPool.
+   void planHist(HistSort& hist);
+   // Size of the shares of memoryLimit held at once.
+   size_t share() const { return opts.memoryLimit / kShares; }
+   // Folder the file is planned in.
+   std::string dstDir(const FileRec& rec) const;
+
+   Options opts;
+   HashPipeline& hasher;
+   std::string pathout;
+   std::unique_ptr<PlanWriter> writer;
+   uint32_t poolDir; // Step making the pool folder, kNoStep until needed.
+   uint64_t dupGroups;
+
+   // Sorts, batches and read buffers hold a share each, at most four at
+   // once, the rest is left to the rest of the process.
+   static const size_t kShares = 6;
+   // Memory taken by a label joined in LabelSets.
+   static const size_t kLabelBytes = 64;
+};
@@ -0,0 +1,215 @@
+/* file: ExternalSort.h
+ * --------------------
+ * Sorts more records than fit in memory. Records are gathered up to a
+ * budget of bytes, sorted and spilled to a run file, and the runs are
+ * merged as the records are read back, in several passes if there are too
+ * many runs to buffer at once. Records which all fit are never written.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "SpillFile.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// T records are written by void save(SpillFile&) const, read back by
+// bool load(SpillFile&), false at the end of the file, and tell the bytes
+// they hold outside of themselves with size_t heapBytes() const.
+template <typename T, typename Less = std::less<T>>
+class ExternalSort {
+  public:
+   // Runs are spilled to files in dir. budget bounds the bytes of records
+   // held at once, and of the buffers of the runs merged at once.
+   ExternalSort(const std::string& dir, size_t budget, Less less = Less());
+   ExternalSort(const ExternalSort&) = delete;
+   ExternalSort& operator=(const ExternalSort&) = delete;
+   // Adds rec. Only before finish.
+   void push(T rec);
+   // Ends pushing. Records then come out of next in order.
+   void finish();
+   // Moves the next record in order to rec. False once all are out.
+   bool next(T& rec);
+   // Records pushed.
+   uint64_t size() const { return count; }
+
+  private:
+   // Sorts held records and writes them as a new run.
+   void spill();
+   // Replaces runs [first, last) by one run merging them, at the end.
+   void merge(size_t first, size_t last);
+   // Whether run b has a head which comes before the head of run a, for a
+   // heap with the first head on top.
+   bool after(size_t a, size_t b) const { return less(heads[b], heads[a]); }
+
+   std::string dir;
+   size_t budget;
+   Less less;
+   std::vector<T> held; // Sorted once finished, if no run was spilled.
+   size_t heldBytes; // Outside of held's own storage.
+   size_t nextHeld;
+   std::vector<SpillFile> runs;
+   std::vector<T> heads; // Next record of each run, while merging.
+   std::vector<size_t> heap; // Runs with a head.
+   uint64_t count;
+   bool finished;
+};
+
+
+template <typename T, typename Less>
+ExternalSort<T, Less>::ExternalSort(const std::string& d, size_t b, Less l) :
+      dir(d), budget(b), less(l), heldBytes(0), nextHeld(0), count(0),
+      finished(false) {
+   if (budget < 2 * SpillFile::kBufLen)
+      throw std::invalid_argument("ExternalSort needs a budget of at least " +
+                                  std::to_string(2 * SpillFile::kBufLen) + " bytes.");
+}
+
+
+template <typename T, typename Less>
+void ExternalSort<T, Less>::push(T rec) {
+   if (finished)
+      throw std::logic_error("ExternalSort::push(): sort is finished.");
+   // held grows by doubling, so what it would reserve is checked first.
+   size_t slots = held.size() < held.capacity() ? held.capacity()
+                                                : std::max<size_t>(1, 2 * held.size());
+   if (!held.empty() && slots * sizeof(T) + heldBytes + rec.heapBytes() > budget)
+      spill();
+   heldBytes += rec.heapBytes();
+   held.push_back(std::move(rec));
+   count++;
+}
+
+
+/* function: spill
+ * ---------------
+ *  held keeps its capacity, so later runs fill all of it.
+ */
+template <typename T, typename Less>
+void ExternalSort<T, Less>::spill() {
+   std::sort(held.begin(), held.end(), less);
+   runs.push_back(SpillFile(dir));
+   for (const T& rec : held)
+      rec.save(runs.back());
+   runs.back().rewind();
+   held.clear();
+   heldBytes = 0;
+}
+
+
+/* function: merge
+ * ---------------
+ */
+template <typename T, typename Less>
+void ExternalSort<T, Less>::merge(size_t first, size_t last) {
+   heads.clear();
+   heap.clear();
+   for (size_t i = first; i < last; i++) {
+      heads.push_back(T());
+      if (heads.back().load(runs[i]))
+         heap.push_back(i - first);
+   }
+   SpillFile out(dir);
+   auto later = [this](size_t a, size_t b) { return after(a, b); };
+   std::make_heap(heap.begin(), heap.end(), later);
+   while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), later);
+      size_t i = heap.back();
+      heads[i].save(out);
+      if (heads[i].load(runs[first + i]))
+         std::push_heap(heap.begin(), heap.end(), later);
+      else
+         heap.pop_back();
+   }
+   out.rewind();
+   runs.erase(runs.begin() + first, runs.begin() + last);
+   runs.push_back(std::move(out));
+   heads.clear();
+}
+
+
+/* function: finish
+ * ----------------
+ *  Runs are merged oldest first until the rest can be merged at once, each
+ *  with a buffer.
+ */
+template <typename T, typename Less>
+void ExternalSort<T, Less>::finish() {
+   if (finished)
+      return;
+   finished = true;
+   if (runs.empty()) {
+      std::sort(held.begin(), held.end(), less);
+      return;
+   }
+   if (!held.empty())
+      spill();
+   held = std::vector<T>();
+   size_t fanIn = std::max<size_t>(2, budget / SpillFile::kBufLen - 1);
+   while (runs.size() > fanIn)
+      merge(0, fanIn);
+   for (size_t i = 0; i < runs.size(); i++) {
+      heads.push_back(T());
+      if (heads.back().load(runs[i]))
+         heap.push_back(i);
+   }
+   std::make_heap(heap.begin(), heap.end(),
+                  [this](size_t a, size_t b) { return after(a, b); });
+}
+
+
+template <typename T, typename Less>
+bool ExternalSort<T, Less>::next(T& rec) {
+   if (!finished)
+      throw std::logic_error("ExternalSort::next(): sort is not finished.");
+   if (runs.empty()) {
+      if (nextHeld == held.size()) {
+         held = std::vector<T>();
+         nextHeld = 0;
+         return false;
+      }
+      rec = std::move(held[nextHeld++]);
+      return true;
+   }
+   if (heap.empty()) {
+      runs.clear();
+      heads.clear();
+      return false;
+   }
+   auto later = [this](size_t a, size_t b) { return after(a, b); };
+   std::pop_heap(heap.begin(), heap.end(), later);
+   size_t i = heap.back();
+   rec = std::move(heads[i]);
+   if (heads[i].load(runs[i]))
+      std::push_heap(heap.begin(), heap.end(), later);
+   else
+      heap.pop_back();
+   return true;
+}
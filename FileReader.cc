@@ -0,0 +1,105 @@
+/* file: FileReader.cc
+ * --------------------
+ * Reads byte ranges of files in chunks of bounded size and hands them to a
+ * consumer, typically a digest. Ranges are read through a buffer owned by
+ * the reader, at most maxBuffer bytes at a time, so memory use does not
+ * depend on the size of the files read.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "FileReader.h"
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+const size_t FileReader::kDefaultMaxBuffer;
+
+
+/* function: FileReader
+ * --------------------
+ */
+FileReader::FileReader(size_t maxBuf) {
+   size_t page = sysconf(_SC_PAGESIZE);
+   maxBuffer = maxBuf - maxBuf % page;
+   if (maxBuffer == 0)
+      throw invalid_argument("Read buffer must be at least " +
+                             to_string(page) + " bytes.");
+}
+
+
+/* function: read
+ * --------------
+ */
+void FileReader::read(const string& path, off_t off, size_t len,
+                      const Sink& sink) {
+   int fd;
+   if ( (fd = open(path.c_str(), O_RDONLY)) < 0 )
+      throw system_error(errno, system_category(), path);
+   try {
+      stream(fd, path, off, len, sink);
+   } catch (...) {
+      close(fd);
+      throw;
+   }
+   if (close(fd) < 0)
+      throw system_error(errno, system_category(), path);
+}
+
+
+/* function: stream
+ * ----------------
+ * Loops on short reads so a chunk is only handed to sink once full. Large
+ * ranges are read too rather than mapped: a file truncated while mapped
+ * raises SIGBUS, where read() just comes up short.
+ */
+void FileReader::stream(int fd, const string& path, off_t off, size_t len,
+                        const Sink& sink) {
+   posix_fadvise(fd, off, len, POSIX_FADV_SEQUENTIAL);
+   buf.resize(min(max(buf.size(), len), maxBuffer));
+   while (len > 0) {
+      size_t chunk = min(len, buf.size());
+      size_t got = 0;
+      while (got < chunk) {
+         ssize_t n = pread(fd, buf.data() + got, chunk - got, off + got);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n < 0)
+            throw system_error(errno, system_category(), path);
+         if (n == 0)
+            throw runtime_error(path + " is shorter than expected.");
+         got += n;
+      }
+      sink(buf.data(), chunk);
+      off += chunk;
+      len -= chunk;
+   }
+}
+
@@ -0,0 +1,60 @@
+/* file: FileReader.h
+ * -------------------
+ * Reads byte ranges of files in chunks of bounded size and hands them to a
+ * consumer, typically a digest. Ranges are read through a buffer owned by
+ * the reader, at most maxBuffer bytes at a time, so memory use does not
+ * depend on the size of the files read.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <sys/types.h>
+
+class FileReader {
+  public:
+   // Consumer of the chunks read, called in file order.
+   typedef std::function<void(const unsigned char*, size_t)> Sink;
+
+   // maxBuffer bounds the bytes held in memory at once, rounded down to a
+   // multiple of the page size.
+   explicit FileReader(size_t maxBuffer = kDefaultMaxBuffer);
+   // Feeds bytes [off, off+len) of the file at path to sink. Throws if the
+   // file ends before off+len.
+   void read(const std::string& path, off_t off, size_t len, const Sink& sink);
+   size_t getMaxBuffer() const { return maxBuffer; }
+
+   static const size_t kDefaultMaxBuffer = 64 << 20;
+
+  private:
+   // Reads the range with pread() into buf, one window at a time.
+   void stream(int fd, const std::string& path, off_t off, size_t len,
+               const Sink& sink);
+
+   size_t maxBuffer;
+   std::vector<unsigned char> buf; // Grown on demand up to maxBuffer.
+};
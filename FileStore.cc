@@ -0,0 +1,135 @@
+/* file: FileStore.cc
+ * -------------------
+ * Implementation of FileStore.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "FileStore.h"
+#include <stdexcept>
+
+using namespace std;
+
+
+/* function: add
+ * -------------
+ */
+void FileStore::add(FsNode* nd, const Digest& key) {
+   if (nodes.size() == UINT32_MAX)
+      throw length_error("Too many files to fit a FileStore.");
+   nodes.push_back(nd);
+   keys.push_back(key);
+   grouped = false;
+}
+
+
+/* function: merge
+ * ---------------
+ */
+void FileStore::merge(FileStore& other) {
+   if (nodes.size() + other.nodes.size() > UINT32_MAX)
+      throw length_error("Too many files to fit a FileStore.");
+   nodes.insert(nodes.end(), other.nodes.begin(), other.nodes.end());
+   keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+   other.nodes.clear();
+   other.keys.clear();
+   other.regroup();
+   grouped = false;
+}
+
+
+/* function: groups
+ * ----------------
+ */
+const vector<FileStore::Group>& FileStore::groups() {
+   if (!grouped)
+      regroup();
+   return groupList;
+}
+
+
+/* function: find
+ * --------------
+ */
+const FileStore::Group* FileStore::find(const Digest& key) {
+   if (!grouped)
+      regroup();
+   if (slots.empty())
+      return nullptr;
+   Id slot = slots[probe(key, slots.size() - 1)];
+   return (slot == 0) ? nullptr : &(groupList[slot - 1]);
+}
+
+
+/* function: probe
+ * ---------------
+ * Linear probing. The table is at most half full, so runs stay short.
+ */
+size_t FileStore::probe(const Digest& key, size_t mask) const {
+   size_t i = key.hash() & mask;
+   while (slots[i] != 0 && keys[order[groupList[slots[i] - 1].begin]] != key)
+      i = (i + 1) & mask;
+   return i;
+}
+
+
+/* function: regroup
+ * -----------------
+ * One pass hashes each key to find its group, counting members. Offsets of
+ * groups in order follow from the counts, and a second pass places ids.
+ * While grouping, order holds the first id of each group, so probe can
+ * compare keys with it.
+ */
+void FileStore::regroup() {
+   size_t cap = 1;
+   while (cap < 2 * keys.size())
+      cap <<= 1;
+   slots.assign(keys.empty() ? 0 : cap, 0);
+   groupList.clear();
+   order.clear();
+   vector<Id> groupOf(keys.size());
+   for (Id id = 0; id < keys.size(); id++) {
+      size_t i = probe(keys[id], cap - 1);
+      if (slots[i] == 0) {
+         groupList.push_back(Group{(Id)order.size(), 0});
+         order.push_back(id);
+         slots[i] = groupList.size();
+      }
+      groupOf[id] = slots[i] - 1;
+      groupList[groupOf[id]].count++;
+   }
+
+   Id begin = 0;
+   for (Group& group : groupList) {
+      group.begin = begin;
+      begin += group.count;
+      group.count = 0;
+   }
+   order.assign(keys.size(), 0);
+   for (Id id = 0; id < keys.size(); id++) {
+      Group& group = groupList[groupOf[id]];
+      order[group.begin + group.count++] = id;
+   }
+   grouped = true;
+}
@@ -0,0 +1,77 @@
+/* file: FileStore.h
+ * ------------------
+ * Indexes the file nodes of the trees being merged and groups them by
+ * Digest.
+ * Nodes are numbered in the order they were added. Grouping hashes every
+ * key once into a flat open-addressing table, then lays out the ids of
+ * each group next to each other, so finding duplicates is a linear scan.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FsNode.h"
+#include "Digest.h"
+#include <vector>
+#include <cstdint>
+
+class FileStore {
+  public:
+   typedef uint32_t Id;
+   // Files sharing a key, at members(group).
+   struct Group {
+      Id begin; // Into order.
+      Id count;
+   };
+
+   FileStore() : grouped(true) {}
+   // Adds nd keyed by key. nd must outlive the store, see NodeArena.
+   void add(FsNode* nd, const Digest& key);
+   // Moves every node of other to the end of this store.
+   void merge(FileStore& other);
+   size_t size() const { return nodes.size(); }
+   FsNode& node(Id id) { return *nodes[id]; }
+   const Digest& key(Id id) const { return keys[id]; }
+   void setKey(Id id, const Digest& key) { keys[id] = key; grouped = false; }
+   // Groups of files sharing a key, regrouped if a key changed since.
+   const std::vector<Group>& groups();
+   const Id* members(const Group& group) const { return order.data() + group.begin; }
+   // Group of files keyed by key, or null if there are none.
+   const Group* find(const Digest& key);
+
+  private:
+   // Rebuilds groups, order and slots from keys.
+   void regroup();
+   // Slot of slots where key is or would be, given mask.
+   size_t probe(const Digest& key, size_t mask) const;
+
+   std::vector<FsNode*> nodes; // By id.
+   std::vector<Digest> keys; // By id.
+   std::vector<Group> groupList;
+   std::vector<Id> order; // Ids by group, in id order within a group.
+   // Index of a group in groupList plus one, zero when empty. Twice as many
+   // as there are keys, rounded up to a power of two.
+   std::vector<Id> slots;
+   bool grouped;
+};
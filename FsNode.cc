@@ -29,35 +29,45 @@
  */
 
 #include "FsNode.h"
-#include <ostream>
-#include <sstream>
 #include <string>
+#include <cstring>
 
 using namespace std;
 
-FsNode::FsNode(std::string n, FsNode* p, std::string t) :
-   num_files(0), type(t), name(n), parent(p), isSub(false), topSup(nullptr),
-   dstParent(nullptr), is_created(false) {
-      setParent(p);
+FsNode::FsNode(const char* n, FsNode* p, Kind k) : FsNode() {
+   name = n;
+   kind = k;
+   parent = dstParent = p;
 }
 
-void FsNode::setParent(FsNode* p) {
-   parent = p;
-   if (p != nullptr) path = p->path + "/" + name;
+// Joins the names of nd and its ancestors along link.
+static string joinPath(const FsNode* nd, FsNode* FsNode::*link) {
+   vector<const FsNode*> chain;
+   size_t len = 0;
+   for (; nd != nullptr; nd = nd->*link) {
+      chain.push_back(nd);
+      len += strlen(nd->name) + 1;
+   }
+   string p;
+   p.reserve(len);
+   for (size_t i = chain.size(); i-- > 0; ) {
+      p += chain[i]->name;
+      if (i > 0) p += '/';
+   }
+   return p;
 }
 
-string FsNode::toString(string prefix) {
-   stringstream ss;
-   ss << prefix + name + "\n";
-   for (pair<string, FsNode*> n : children) {
-      ss << n.second->toString(prefix + "  ");
-   }
-   return ss.str();
+string FsNode::path() const {
+   return joinPath(this, &FsNode::parent);
 }
 
-void FsNode::makeSub(FsNode* sup) {
-   sup->subordinates.push_back(this);
-   isSub = true;
-   topSup = (sup->isSub) ? sup->topSup : sup;
+string FsNode::dstPath() const {
+   if (dstParent == nullptr)
+      return path();
+   return dstParent->dstPath() + "/" + name;
 }
 
+string_view FsNode::ext() const {
+   const char* dot = strrchr(name, '.');
+   return (kind == kDir || dot == nullptr) ? string_view() : string_view(dot);
+}
@@ -30,39 +30,56 @@
 
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
-#include <ostream>
+#include <cstdint>
 #include <time.h>
+#include <sys/types.h>
 
+// Nodes are allocated by a NodeArena, which also holds their names. Paths
+// are not stored but built from parent links when needed.
 class FsNode {
   public:
-   FsNode() : num_files(0), parent(nullptr), isSub(false), is_created(false) {}
-   // Init list + calls setParent
-   FsNode(std::string n, FsNode* p, std::string t);
-   // Sets parent and path
-   void setParent(FsNode* p);
+   enum Kind : uint8_t { kDir, kFile, kLink, kOther };
+
+   FsNode() : size(0), date_changed{0, 0}, date_modified{0, 0}, dev(0),
+              ino(0), name(""), parent(nullptr), dstParent(nullptr),
+              dupSet(0), num_files(0), kind(kOther), isSub(false),
+              inBase(false) {}
+   // Planned node. n must outlive the node, see NodeArena::intern.
+   FsNode(const char* n, FsNode* p, Kind k);
+   // Sets the parent the node was found in.
+   void setParent(FsNode* p) { parent = p; }
+   // Sets the parent the node is planned in.
    void setDstParent(FsNode* p) { if (p != nullptr) dstParent = p; }
-   // Recursively print self and children nodes with offset.
-   std::string toString(std::string prefix);
-   // Makes node subordinate to sup.
-   void makeSub(FsNode* sup);
+   // Where the node is, from parent links.
+   std::string path() const;
+   // Where the node is planned to be, from dstParent links, or where it is
+   // for nodes which are not planned anywhere.
+   std::string dstPath() const;
+   // Extension of a file name, dot included, or empty.
+   std::string_view ext() const;
+   bool isDir() const { return kind == kDir; }
 
    // Present for possible improvement which treats large files differently.
-   size_t size; 
-   size_t num_files; // for folders.
+   uint64_t size;
    struct timespec date_changed;
-   std::string type;
-   std::string name;
-   std::string path; // Used by EditStep to prepare shell commands.
+   struct timespec date_modified;
+   dev_t dev; // With ino, identifies a file for DigestCache.
+   ino_t ino;
+   const char* name; // Interned, a path for roots.
    FsNode* parent;
-   std::unordered_map<std::string, FsNode*> children;
+   // Entries of a folder. Once planned, files moved elsewhere stay listed
+   // but have another dstParent.
+   std::vector<FsNode*> children;
 
    // Used to merge trees.
-   bool isSub;
-   std::vector<FsNode*> subordinates;
-   FsNode* topSup; // Node known to be at the top of subordination hierarchy.
-   FsNode* dstParent; // For files, to get path to copy to.
-   bool is_created;
+   FsNode* dstParent; // Folder to copy a file to, or to create a folder in.
+   // Of a file, its set in the duplicate sets of a merge, numbered as its
+   // id in the merge's FileStore.
+   uint32_t dupSet;
+   uint32_t num_files; // for folders.
+   Kind kind;
+   bool isSub; // An older duplicate, once planned in a history folder.
+   bool inBase; // Found in an earlier output merged into, see FsTree::build.
 };
-
@@ -1,7 +1,7 @@
 /* file: FsTree.cc
  * --------------
  * Tree of FsNodes representing a directory's contents. A representation
- * can be built from a path or from two existing trees. If built from two
+ * can be built from a path or from existing trees. If built from
  * existing trees, the terminal 'cp' and 'mkdir' commands to generate the
  * resulting tree on the file system are queued and can be run with
  * functionality implemented here.
@@ -33,39 +33,49 @@
 #include "FsTree.h"
 #include "FsNode.h"
 #include "EditStep.h"
+#include "HashPipeline.h"
+#include "WorkPool.h"
+#include "NodeArena.h"
+#include "Plan.h"
+#include "Metrics.h"
+#include "TreePrinter.h"
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <ostream>
 #include <iostream>
 #include <stdexcept>
-#include <list>
-#include <unordered_set>
-#include <queue>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <exception>
 
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
-#include <openssl/md5.h>
 #include <time.h>
-#include <sys/wait.h>
-#include <signal.h>
+#include <sys/syscall.h>
 
 using namespace std;
 
-/* Global so signal handler can access these for coordinating
- * multiprocessing.
+// Bytes of directory entries read per system call while exploring.
+static const size_t kDentsBufLen = 256 << 10;
+
+/* function: recency
+ * -----------------
+ * When a file was last changed. Copies in an earlier output kept their
+ * mtime, not their ctime.
  */
-// pid to FsNode*, so signal handler can find entry in editQueue and keep
-// track of running processes.
-static unordered_map<pid_t,FsNode*> editProc;
-// Values are edit steps pending the completion of mkdir of the key. Released
-// to jobs when signal handler finds mkdir of the key is complete.
-static unordered_multimap<FsNode*, EditStep> editQueue;
-// Job queue for pending steps that are now ready to run.
-static queue<EditStep> jobs;
+static inline const struct timespec& recency(const FsNode& nd) {
+   return nd.inBase ? nd.date_modified : nd.date_changed;
+}
 
 
 /* function: comparRecent
@@ -73,221 +83,296 @@ static queue<EditStep> jobs;
  * Used to maintain FsNode ordering by file recency, then folder crowding.
  */
 static inline bool comparRecent(const FsNode& nd1, const FsNode& nd2) {
-   struct timespec t1 = nd1.date_changed;
-   struct timespec t2 = nd2.date_changed;
+   struct timespec t1 = recency(nd1);
+   struct timespec t2 = recency(nd2);
    if (t1.tv_sec != t2.tv_sec) {
       return t1.tv_sec < t2.tv_sec;
    } else {
       if (t1.tv_nsec != t2.tv_nsec) {
          return t1.tv_nsec < t2.tv_nsec;
       } else {
-         if (nd1.parent->num_files == nd2.parent->num_files)
-            return nd1.isSub;
-         else
+         if (nd1.parent->num_files != nd2.parent->num_files)
             return nd1.parent->num_files > nd2.parent->num_files;
+         else // Keeps the order total, so plans do not depend on hashing order.
+            return nd1.path() > nd2.path();
       }
    }
 }
 
 
-/* struct: FsNodePtr
- * -----------------
+/* struct: ScanShard
+ * ------------------
+ * Nodes created by one worker of FsTree::build, so workers never contend on
+ * the stores.
  */
-struct FsTree::FsNodePtr {
-   FsNode* n;
-   FsNodePtr(FsNode* nd) : n(nd) {}
-
-   bool operator< (const FsNodePtr& rhs) const {
-      return comparRecent(*n, *(rhs.n));
-   }
+struct FsTree::ScanShard {
+   NodeArena nodes;
+   FileStore files;
+   vector<char> dents; // Directory entries read in one batch.
 };
 
 
 /* function: FsTree
  * ----------------
- * Constructor with two trees to merge as inputs.
+ * Constructor with trees to merge as inputs.
  */
-FsTree::FsTree(FsTree& ft1, FsTree& ft2, string pathout,
-      unordered_multimap<string,FsNode>& fileStore) : kMaxProc(10) {
+FsTree::FsTree(const vector<FsTree*>& trees, string pathout,
+      FileStore& fileStore, HashPipeline& hasher, History history,
+      FsTree* base, NearDupes* near, bool bulkCopy) :
+      isBase(false), history(history), bulkCopy(bulkCopy), poolNode(nullptr),
+      keyLen(Hasher::digestLen(hasher.algo())) {
    cout << "Planning merged tree at " << pathout <<  endl;
-   // Used to ensure we only visit files with a given hash value once.
-   unordered_set<string> fhash;
-   for (auto it : fileStore) {
-      if (fhash.find(it.first) != fhash.end())
+   optional<Metrics::Phase> phase;
+   phase.emplace("resolve");
+   hasher.resolve(fileStore);
+   phase.emplace("group");
+   // Every file starts in a set of its own, numbered as in fileStore, joined
+   // below to the files it shares contents with and, while merging, to those
+   // it shares a path with.
+   for (FileStore::Id id = 0; id < fileStore.size(); id++) {
+      fileStore.node(id).dupSet = dupSets.add();
+      // digestDir finds the key of a file from its set.
+      if (fileStore.node(id).dupSet != id)
+         throw logic_error("FsTree(): duplicate sets not numbered as files.");
+   }
+   for (const FileStore::Group& group : fileStore.groups()) {
+      if (group.count < 2) // Not a duplicate.
+         continue;
+      const FileStore::Id* ids = fileStore.members(group);
+      // Duplicates within the base are in place already.
+      if (all_of(ids, ids + group.count, [&](FileStore::Id id) {
+             return fileStore.node(id).inBase; }))
          continue;
+      for (FileStore::Id i = 0; i < group.count; i++)
+         dupGroup[&(fileStore.node(ids[i]))] = dupKeys.size();
+      dupKeys.push_back(fileStore.key(ids[0]));
+      for (FileStore::Id i = 1; i < group.count; i++)
+         dupSets.unite(fileStore.node(ids[0]).dupSet, fileStore.node(ids[i]).dupSet);
+   }
+   Metrics::get().add(Metrics::kDupGroups, dupKeys.size());
+   if (near != nullptr) {
+      // Near duplicates join the sets of both files, and are copied into
+      // history since their contents differ.
+      phase.emplace("chunk");
+      vector<NearDupes::Pair> pairs = near->find(fileStore);
+      for (const NearDupes::Pair& p : pairs)
+         dupSets.unite(fileStore.node(p.a).dupSet, fileStore.node(p.b).dupSet);
+      NearDupes::report(cout, fileStore, pairs);
+   }
+   phase.emplace("merge");
+   // Create root node for new tree.
+   root = plannedNode.make(FsNode(plannedNode.intern(pathout), nullptr,
+                                  FsNode::kDir));
+   root->inBase = (base != nullptr);
+   if (!root->inBase)
+      editSteps.push_back(EditStep("mkdir", nullptr, root));
+
+   // Create tree from merging all input trees, the base first.
+   vector<FsNode*> roots;
+   if (base != nullptr)
+      roots.push_back(base->getRoot());
+   for (FsTree* ft : trees)
+      roots.push_back(ft->getRoot());
+   if (bulkCopy) {
+      unique_ptr<Hasher> sha256 = Hasher::create(Hasher::kSha256);
+      for (FsTree* ft : trees)
+         digestDir(ft->getRoot(), fileStore, *sha256);
+      reportIdentical(cout);
+   }
+   mergeDirs(root, roots);
+   phase.emplace("hist");
+   // Lay the files of every set of duplicates out next to each other, by
+   // counting how many files each set holds.
+   vector<DisjointSets::Id> first(dupSets.size() + 1, 0);
+   for (FileStore::Id id = 0; id < fileStore.size(); id++)
+      first[dupSets.find(id) + 1]++;
+   for (size_t i = 1; i < first.size(); i++)
+      first[i] += first[i - 1];
+   vector<FsNode*> members(fileStore.size());
+   vector<DisjointSets::Id> next(first.begin(), first.end() - 1);
+   for (FileStore::Id id = 0; id < fileStore.size(); id++)
+      members[next[dupSets.find(id)]++] = &(fileStore.node(id));
+   // Resolve content and path duplicates found in trees, in path order so
+   // the plan does not depend on where nodes were allocated.
+   vector<pair<string, DisjointSets::Id>> sorted;
+   for (DisjointSets::Id set = 0; set < dupSets.size(); set++) {
+      if (first[set + 1] - first[set] > 1)
+         sorted.push_back(make_pair(members[first[set]]->path(), set));
+   }
+   sort(sorted.begin(), sorted.end());
+   pooled.assign(dupKeys.size(), nullptr);
+   for (pair<string, DisjointSets::Id>& set : sorted)
+      makeFileHist(members.data() + first[set.second],
+                   first[set.second + 1] - first[set.second]);
+   // Files of the base leave their place before anything is written there:
+   // folders are made first, then older duplicates move to history folders,
+   // then the files they made room for move in.
+   if (base != nullptr) {
+      auto phase = [](const EditStep& step) {
+         if (step.op == "mkdir")
+            return 0;
+         if (step.op == "mv")
+            return (step.acting->isSub) ? 1 : 2;
+         return 3;
+      };
+      stable_sort(editSteps.begin(), editSteps.end(),
+                  [&](const EditStep& s1, const EditStep& s2) {
+                     return phase(s1) < phase(s2);
+                  });
+   }
+   dupGroup.clear();
+   dupKeys.clear();
+   pooled.clear();
+   dupSets.clear();
+   dirDigests.clear();
+}
 
-      fhash.insert(it.first);
-      if (fileStore.count(it.first) > 1) { // Identify duplicates
-         // Find most recently created duplicate.
-         pair<unordered_multimap<string,FsNode>::iterator,
-              unordered_multimap<string,FsNode>::iterator> lims = fileStore.equal_range(it.first);
-         unordered_multimap<string,FsNode>::iterator best_file;
-         bool is_first = true;
-         for (unordered_multimap<string,FsNode>::iterator dupe = lims.first;
-              dupe != lims.second; dupe++) {
-            if (is_first || comparRecent((dupe->second), (best_file->second))) {
-               is_first = false;
-               best_file = dupe; // replace with file in best dir.
-            }
-         }
 
-         // Make all duplicates subordinate to the most recent one.
-         for (unordered_multimap<string,FsNode>::iterator dupe = lims.first;
-              dupe != lims.second; dupe++) {
-            if (dupe != best_file)
-               dupe->second.makeSub(&(best_file->second));
-         }
+/* function: parseHistory
+ * ----------------------
+ */
+bool FsTree::parseHistory(const string& name, History& history) {
+   static const pair<const char*, History> names[] = {
+      {"copy", kHistCopy}, {"hardlink", kHistHardlink},
+      {"reflink", kHistReflink}, {"pool", kHistPool}};
+   for (const pair<const char*, History>& entry : names) {
+      if (name == entry.first) {
+         history = entry.second;
+         return true;
       }
    }
-   // Create root node for new tree.
-   plannedNode.push_back(*(ft1.getRoot()));
-   root = &(plannedNode.back());
-   root->name = pathout;
-   root->path = pathout;
-   root->setParent(nullptr);
-   editSteps.push(EditStep("mkdir", nullptr, root));
-
-   // Track files found as superior in a duplicate hierarchy.
-   unordered_set<FsNode*> sups;
-   // Create tree from merging both input trees.
-   mergeDirs(root, ft2.getRoot(), sups);
-   // Resolve content and path duplicates found in trees.
-   for (FsNode* sup : sups)
-      makeFileHist(sup);
+   return false;
 }
 
 
 /* function: build
  * ---------------
  */
-void FsTree::build(string rootpath,
-                     unordered_multimap<string,FsNode>& fileStore,
-                     list<FsNode>& folderStore) {
+void FsTree::build(string rootpath, FileStore& fileStore,
+                     NodeArena& nodeStore, HashPipeline& hasher,
+                     unsigned scanThreads, bool base) {
    cout << "Exploring tree at " << rootpath << endl;
-   // Check path valid
+   Metrics::Phase phase("scan");
+   rootDevice(rootpath);
+   scan(rootpath, fileStore, nodeStore, hasher, scanThreads, base);
+}
+
+
+/* function: buildAll
+ * ------------------
+ * Each device gets a thread, which builds its trees into stores of their
+ * own, merged into fileStore and nodeStore once all are done.
+ */
+void FsTree::buildAll(vector<FsTree>& trees, const vector<string>& paths,
+                      FileStore& fileStore, NodeArena& nodeStore,
+                      HashPipeline& hasher, unsigned scanThreads) {
+   for (const string& path : paths)
+      cout << "Exploring tree at " << path << endl;
+   Metrics::Phase phase("scan");
+   vector<dev_t> devices;
+   vector<vector<size_t>> onDevice;
+   for (size_t i = 0; i < paths.size(); i++) {
+      dev_t dev = rootDevice(paths[i]);
+      size_t d = find(devices.begin(), devices.end(), dev) - devices.begin();
+      if (d == devices.size()) {
+         devices.push_back(dev);
+         onDevice.emplace_back();
+      }
+      onDevice[d].push_back(i);
+   }
+   vector<FileStore> files(paths.size());
+   vector<NodeArena> nodes(paths.size());
+   vector<exception_ptr> errors(devices.size());
+   vector<thread> scanners;
+   for (size_t d = 0; d < devices.size(); d++) {
+      scanners.emplace_back([&, d]() {
+         try {
+            for (size_t i : onDevice[d])
+               trees[i].scan(paths[i], files[i], nodes[i], hasher, scanThreads, false);
+         } catch (...) {
+            errors[d] = current_exception();
+         }
+      });
+   }
+   for (thread& t : scanners)
+      t.join();
+   for (exception_ptr& error : errors) {
+      if (error)
+         rethrow_exception(error);
+   }
+   for (size_t i = 0; i < paths.size(); i++) {
+      nodeStore.merge(nodes[i]);
+      fileStore.merge(files[i]);
+   }
+}
+
+
+/* function: rootDevice
+ * --------------------
+ */
+dev_t FsTree::rootDevice(const string& rootpath) {
    struct stat st;
    if (stat(rootpath.c_str(), &st) != 0)
       throw invalid_argument("Could not locate " + rootpath);
    if (!S_ISDIR(st.st_mode))
       throw invalid_argument(rootpath + " is not a directory.");
+   return st.st_dev;
+}
+
+
+/* function: scan
+ * --------------
+ */
+void FsTree::scan(const string& rootpath, FileStore& fileStore,
+                  NodeArena& nodeStore, HashPipeline& hasher,
+                  unsigned scanThreads, bool base) {
+   isBase = base;
    // Add new node to filestore (initialize and hash file)
    FsNode nd;
-   nd.name = rootpath;
-   nd.path = rootpath;
-   nd.type = "dir";
+   nd.name = nodeStore.intern(rootpath);
+   nd.kind = FsNode::kDir;
+   nd.inBase = isBase;
    // Recurse on dir contents
-   folderStore.push_back(nd);
-   FsNode& curNode = folderStore.back();
-   root = &(curNode);
-
-   explore(rootpath, fileStore, folderStore, root); 
+   root = nodeStore.make(nd);
+
+   WorkPool pool(scanThreads);
+   vector<ScanShard> shards(pool.size());
+   pool.push([this, rootpath, &hasher, &pool, &shards](unsigned w) {
+      explore(rootpath, root, hasher, pool, shards, w);
+   });
+   pool.run();
+   // Blocks of nodes change hands, so pointers to them stay valid.
+   for (ScanShard& shard : shards) {
+      nodeStore.merge(shard.nodes);
+      fileStore.merge(shard.files);
+   }
 }
 
 
-/* function: handleChildProc
- * -------------------------
- *  Signal handler for SIGCHLD installed in FsTree::execTform. Upon child process
- *  termination, moves EditSteps pending its creation into the hob queue.
+/* function: savePlan
+ * --------------------
  */
-static void handleChildProc(int sig) {
-   int status;
-   pid_t pid;
-   while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-      if (!(WIFEXITED(status) || WIFSIGNALED(status)))
-         continue;
-      // Find FsNode* corresponding to process that just exited. Move edit steps
-      // depending and waiting on this process to the job list.
-      unordered_map<pid_t,FsNode*>::iterator it = editProc.find(pid);
-      if (it == editProc.end())
-         continue;
-      FsNode* nd =  it->second;
-      nd->is_created = true;
-
-      if (editQueue.find(nd) != editQueue.end()) {
-         pair<unordered_multimap<FsNode*, EditStep>::iterator,
-                 unordered_multimap<FsNode*, EditStep>::iterator> lims = editQueue.equal_range(nd);
-         for (unordered_multimap<FsNode*,EditStep>::iterator client = lims.first;
-                 client != lims.second; client++) {
-            jobs.push(client->second);
-         }
-         editQueue.erase(nd);
-      }
-      editProc.erase(pid);
-   }
-   if (pid == -1 && errno != ECHILD)
-      throw system_error(errno, system_category());
+void FsTree::savePlan(const string& path) {
+   if (plannedNode.size() == 0)
+      throw domain_error("savePlan() must be called on a tree built from existing trees.");
+   Plan(editSteps).save(path);
 }
 
 
 /* function: execTform
  * -------------------
- *  Has signal handler handleChildProc, uses globals jobs, editQueue, editProc.
+ *  A step which fails is reported and does not stop the others, as when run
+ *  by cp and mkdir.
  */
-void FsTree::execTform() {
-   if (plannedNode.empty())
+void FsTree::execTform(unsigned jobs, bool forkCommands, const string& planPath) {
+   if (plannedNode.size() == 0)
       throw domain_error("execTfrom() must be called on a tree built from existing trees.");
-   struct sigaction action;
-   action.sa_handler = handleChildProc;
-   sigemptyset(&action.sa_mask);
-   action.sa_flags = SA_RESTART;
-   if (sigaction(SIGCHLD, &action, NULL) < 0)
-      throw system_error(errno, system_category());
-
-   cout << "Tform!" << endl;
-   // In general, block SIGCHLD signals since they will modify editQueue,
-   // editSteps and jobs.
-   sigset_t set, oldset;
-   sigemptyset(&set);
-   sigaddset(&set, SIGCHLD);
-   sigprocmask(SIG_BLOCK, &set, &oldset);
-   while (!(editSteps.empty() && editQueue.empty() && jobs.empty())) {
-      // Wait for running process number to go down, or pending jobs to be moved
-      // to the job queue.
-      while ( editProc.size() > kMaxProc || (jobs.empty() && editSteps.empty()) ) {
-         // Let SIGCHLD signals be handled.
-         sigprocmask(SIG_SETMASK, &oldset, NULL);
-         pause();
-         // Proper error handling should involve following three lines, but 
-         // when uncommented, there is a always an error of system call
-         // interrupted. Program seems to function fine without though.
-         //int err = pause();
-         //if (err < 0 && err != EINTR)
-         //   throw system_error(errno, system_category());
-         sigprocmask(SIG_BLOCK, &set, NULL);
-      }
-      
-      EditStep step;
-      if (!getNextStep(step)) // If all steps depend on running jobs, loop and wait.
-         continue;
-      pid_t pid = fork();
-      if (pid == -1)
-         throw system_error(errno, system_category());
-      if (pid == 0) {
-         // Wait for parent process to have created entry in editProc (so waiting
-         // dependent jobs can be notified that the current job is done).
-         kill(getpid(), SIGSTOP);
-         execvp(step.com[0], step.com);
-         throw system_error(errno, system_category());
-      }
-      editProc.insert(pair<pid_t,FsNode*> (pid, step.acting));
-      // Wait for current step's process to have created and halted itself before
-      // continuing.
-      int status;
-      pid_t caughtpid;
-      while ((caughtpid = waitpid(pid, &status, WUNTRACED)) > 0) {
-         if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGSTOP) {
-            kill(pid, SIGCONT);
-            break;
-         } 
-      }
+   if (planPath.empty()) {
+      Plan(editSteps).run(jobs, forkCommands);
+      return;
    }
-   // Now we are waiting for all jobs to finish, and SIGCHLD handling cannot disrupt
-   // the logic.
-   sigprocmask(SIG_SETMASK, &oldset, NULL);
-   
-   // See similar loop above for why error handling is not done with pause.
-   while (editProc.size() > 0)
-      pause();
+   // Run as saved, so the journal matches the plan if it is resumed.
+   Plan(planPath).run(jobs, forkCommands, true);
 }
 
 
@@ -295,260 +380,554 @@ void FsTree::execTform() {
  * --------------------
  */
 ostream& operator<<(ostream& os, const FsTree& ft) {
-   if (ft.root == nullptr)
-      os << "Empty FsTree\n";
-   else
-      os << ft.root->toString("");
+   ft.print(os, TreePrinter::Options());
    return os;
 }
 
 
+/* function: print
+ * ---------------
+ */
+void FsTree::print(ostream& os, const TreePrinter::Options& opts) const {
+   if (root == nullptr) {
+      os << "Empty FsTree\n";
+      return;
+   }
+   TreePrinter(os, opts).print(*root);
+}
+
+
+/* function: readEntries
+ * ----------------------
+ * Calls onEntry with the name and d_type of every entry of the directory
+ * open at dfd, "." and ".." excluded. d_type may be DT_UNKNOWN. On Linux,
+ * entries are read straight from getdents64 in batches the size of buf.
+ */
+void FsTree::readEntries(int dfd, const string& path, vector<char>& buf,
+                         const function<void(const char*, unsigned char)>& onEntry) {
+#ifdef __linux__
+   // Layout of the records returned by getdents64, glibc does not declare it.
+   struct linux_dirent64 {
+      ino64_t d_ino;
+      off64_t d_off;
+      unsigned short d_reclen;
+      unsigned char d_type;
+      char d_name[256]; // Really d_reclen - 19 bytes, null terminated.
+   };
+   while (true) {
+      long n = syscall(SYS_getdents64, dfd, buf.data(), buf.size());
+      if (n < 0)
+         throw system_error(errno, system_category(), path);
+      if (n == 0)
+         break;
+      for (long pos = 0; pos < n; ) {
+         linux_dirent64* ent = (linux_dirent64*)(buf.data() + pos);
+         pos += ent->d_reclen;
+         if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+            onEntry(ent->d_name, ent->d_type);
+      }
+   }
+#else
+   int fd = dup(dfd); // closedir closes the fd it is given.
+   DIR* dir = (fd < 0) ? nullptr : fdopendir(fd);
+   if (dir == nullptr)
+      throw system_error(errno, system_category(), path);
+   struct dirent* entry;
+   while ((entry = readdir(dir)) != nullptr) {
+      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+         onEntry(entry->d_name, entry->d_type);
+   }
+   if (closedir(dir) < 0)
+      throw system_error(errno, system_category(), path);
+#endif
+}
+
+
 /* function: explore
  * -----------------
+ *  Entries are stat'ed relative to the directory's fd so the kernel does not
+ *  resolve the whole path again, and not at all for directories whose
+ *  d_type is known.
  */
-void FsTree::explore(string rootpath,
-                     unordered_multimap<string,FsNode>& fileStore,
-                     list<FsNode>& folderStore,
-                     FsNode* parent) {
-   // Check path valid
-   struct stat st;
-   if (stat(rootpath.c_str(), &st) != 0)
+void FsTree::explore(string rootpath, FsNode* parent, HashPipeline& hasher,
+                     WorkPool& pool, vector<ScanShard>& shards,
+                     unsigned worker) {
+   int dfd = open(rootpath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (dfd < 0 && errno == ENOENT)
       throw invalid_argument("Could not locate " + rootpath);
-   if (!S_ISDIR(st.st_mode))
+   if (dfd < 0 && errno == ENOTDIR)
       throw invalid_argument(rootpath + " is not a directory.");
-   DIR* dir = opendir(rootpath.c_str());
-   if (dir == nullptr)
+   if (dfd < 0)
       throw invalid_argument("Need permission to access " + rootpath);
 
-   struct dirent* entry;
-   struct stat fst;
-   
-   while (true) {
-      // Get stat for next dir entry
-      entry = readdir(dir);
-      if (entry == nullptr) break;
-      if (! (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) )
-            continue;
-      string path = rootpath + "/" + entry->d_name;
-      if (stat(path.c_str(), &fst) != 0)
-         throw system_error(errno, system_category());
-      // Add new node to filestore (initialize and hash file)
-      FsNode nd;
-      nd.size = fst.st_size;
-      nd.name = entry->d_name;
-      nd.setParent(parent);
-      nd.date_changed = fst.st_ctim;
-      nd.path = parent->path + "/" + nd.name;
-      if (S_ISDIR(fst.st_mode)) {
-         nd.type = "dir";
-      } else if (S_ISREG(fst.st_mode)) {
-         size_t pos = nd.name.find_last_of('.');
-         nd.type = (pos == string::npos) ? "other" : nd.name.substr(pos);
-      } else if (S_ISLNK(fst.st_mode)) {
-         nd.type = "link";
-      } else {
-         nd.type = "other";
-      }
-      if (nd.type == "dir") {
-         // Recurse on dir contents
-         folderStore.push_back(nd);
-         FsNode& curNode = folderStore.back();
-         parent->children.insert(pair<string, FsNode*> (nd.name, &curNode));
-         explore(path, fileStore, folderStore, &curNode); 
-      } else {
-         // Add file to map with its contents' MD5 hash value as its key.
-         parent->num_files++;
-         int fd;
-         if ( (fd = open(path.c_str(), O_RDONLY)) < 0 )
-            throw system_error(errno, system_category());
+   ScanShard& shard = shards[worker];
+   shard.dents.resize(kDentsBufLen);
+   uint64_t entries = 0;
+   try {
+      readEntries(dfd, rootpath, shard.dents, [&](const char* name,
+                                                  unsigned char dtype) {
+         entries++;
+         // The pool of a base is only added to, by name.
+         if (isBase && parent == root && strcmp(name, ".unidupe_pool") == 0)
+            return;
+         FsNode nd;
+         nd.name = shard.nodes.intern(name);
+         nd.setParent(parent);
+         nd.inBase = isBase;
+         if (dtype == DT_DIR) {
+            nd.kind = FsNode::kDir;
+         } else {
+            // Follows links like stat, so a link to a folder is explored.
+            struct stat fst;
+            if (fstatat(dfd, name, &fst, 0) != 0)
+               throw system_error(errno, system_category(), rootpath + "/" + name);
+            nd.size = fst.st_size;
+            nd.date_changed = fst.st_ctim;
+            nd.date_modified = fst.st_mtim;
+            nd.dev = fst.st_dev;
+            nd.ino = fst.st_ino;
+            if (S_ISDIR(fst.st_mode))
+               nd.kind = FsNode::kDir;
+            else if (S_ISREG(fst.st_mode))
+               nd.kind = FsNode::kFile;
+            else if (S_ISLNK(fst.st_mode))
+               nd.kind = FsNode::kLink;
+            else
+               nd.kind = FsNode::kOther;
+         }
+         if (nd.isDir()) {
+            // Queue dir contents for any worker to explore.
+            string path = rootpath + "/" + name;
+            FsNode* curNode = shard.nodes.make(nd);
+            parent->children.push_back(curNode);
+            pool.push([this, path, curNode, &hasher, &pool, &shards](unsigned w) {
+               explore(path, curNode, hasher, pool, shards, w);
+            }, worker);
+         } else {
+            // Add file to map keyed by its size for now. Only files whose size
+            // collides with another file get hashed, see HashPipeline.
+            parent->num_files++;
+            FsNode* fileNode = shard.nodes.make(nd);
+            shard.files.add(fileNode, Digest::bySize(nd.size));
+            parent->children.push_back(fileNode);
+            if (!isBase)
+               hasher.offer(fileNode);
+         }
+      });
+   } catch (...) {
+      close(dfd);
+      throw;
+   }
+   if (close(dfd) < 0)
+      throw system_error(errno, system_category());
+   // Once per folder, to keep workers off the counters' cache line.
+   Metrics::get().add(Metrics::kEntriesScanned, entries);
+   Metrics::get().add(Metrics::kDirsScanned);
+}
 
-         unsigned char* fdata = new unsigned char[nd.size];
-         if (fdata == nullptr)
-            throw system_error(errno, system_category());
 
-         // TODO Add different hash scheme for large files (so faster)?
-         unsigned char res[MD5_DIGEST_LENGTH];
-         if (read(fd, (void*)fdata, nd.size) < 0)
-            throw system_error(errno, system_category());
+/* function: makeFileHist
+ * ----------------------
+ *  Helper for constructor with trees as inputs.
+ */
+void FsTree::makeFileHist(FsNode** group, size_t count) {
+   // Keep the most recent duplicate. Files of the base found where no
+   // merged folder is planned, such as in a folder within a history folder,
+   // are not kept in place.
+   FsNode** kept = nullptr;
+   bool added = false;
+   for (size_t i = 0; i < count; i++) {
+      if (group[i]->dstParent != nullptr &&
+          (kept == nullptr || comparRecent(**kept, *group[i])))
+         kept = &group[i];
+      added = added || !group[i]->inBase;
+   }
+   if (kept == nullptr)
+      return;
+   FsNode* sup = *kept;
+   if (!added) { // All in place from an earlier merge.
+      sup->dstParent->children.push_back(sup);
+      return;
+   }
+   // Older duplicates, most recent first, so plans do not depend on the
+   // order the files were found in.
+   swap(*kept, group[0]);
+   vector<FsNode*> subs(group + 1, group + count);
+   sort(subs.begin(), subs.end(), [](const FsNode* nd1, const FsNode* nd2) {
+      return comparRecent(*nd2, *nd1);
+   });
+   for (FsNode* sub_nd : subs)
+      sub_nd->isSub = true;
+
+   // Create edit steps for a history directory where most recent duplicate
+   // is.
+
+   string hist_name = string(".") + sup->name + "_hist";
+   FsNode* hist_nd = plannedNode.make(FsNode(plannedNode.intern(hist_name),
+                                             sup->dstParent, FsNode::kDir));
+   editSteps.push_back(EditStep("mkdir", nullptr, hist_nd));
+   sup->dstParent->children.push_back(hist_nd);
+   Metrics::get().add(Metrics::kHistFolders);
+
+   for (FsNode* sub_nd : subs) {
+      if (sub_nd->inBase)
+         planMove(sub_nd, hist_nd);
+   }
+   // The kept copy comes next, so older duplicates can be linked to it.
+   if (sup->inBase)
+      planMove(sup, sup->dstParent);
+   else
+      editSteps.push_back(EditStep("cp", sup, sup->dstParent));
+   sup->isSub = false;
 
-         MD5(fdata, nd.size, res);
+   // Create edit steps to keep every older duplicate in the history folder.
+   for (FsNode* sub_nd : subs) {
+      // Not top, so moving it to the history folder takes it out of the
+      // listing of its original destination folder.
+      sub_nd->setDstParent(hist_nd);
+      if (!sub_nd->inBase)
+         planHistEntry(sub_nd, sup, hist_nd);
+      hist_nd->children.push_back(sub_nd);
+   }
+   sup->dstParent->children.push_back(sup);
+}
 
-         if (close(fd) < 0)
-            throw system_error(errno, system_category());
 
-         delete[] fdata;
+/* function: planMove
+ * ------------------
+ *  Helper for makeFileHist. History entries of the base stay where they are
+ *  as long as the file they are kept for is still the most recent.
+ */
+void FsTree::planMove(FsNode* nd, FsNode* dstDir) {
+   string from = nd->path();
+   string to = dstDir->dstPath() + "/" + nd->name;
+   if (from != to)
+      editSteps.push_back(EditStep("mv", nd, from, to, dstDir));
+}
 
-         string v;
-         for (int i = 0; i < MD5_DIGEST_LENGTH; i++) v += to_string(res[i]);
-         unordered_multimap<string,FsNode>::iterator ret =
-            fileStore.insert(pair <string,FsNode> (v,nd));
 
-         parent->children.insert(pair<string, FsNode*> (nd.name, &(ret->second)));
-      }
+/* function: planHistEntry
+ * -----------------------
+ *  Helper for makeFileHist. Files which only share a path with sup, or
+ *  whose digest was split by verifying, are copied.
+ */
+void FsTree::planHistEntry(FsNode* sub_nd, FsNode* sup, FsNode* hist_nd) {
+   unordered_map<const FsNode*, size_t>::iterator group = dupGroup.find(sub_nd);
+   if (history == kHistCopy || group == dupGroup.end()) {
+      editSteps.push_back(EditStep("cp", sub_nd, hist_nd));
+      return;
    }
-   if (closedir(dir) < 0)
-      throw system_error(errno, system_category());
+   string dst = hist_nd->dstPath() + "/" + sub_nd->name;
+   if (history == kHistPool && dupKeys[group->second].split == 0) {
+      // Pool copies are named by digest, so one from a previous run into
+      // the same folder is reused. Split digests only name contents within
+      // one run.
+      FsNode* obj = poolObject(group->second, sub_nd);
+      editSteps.push_back(EditStep("link", sub_nd, obj->dstPath(), dst, hist_nd, obj));
+      return;
+   }
+   unordered_map<const FsNode*, size_t>::iterator supGroup = dupGroup.find(sup);
+   if (history != kHistPool && supGroup != dupGroup.end() &&
+       supGroup->second == group->second) {
+      const char* op = (history == kHistHardlink) ? "link" : "reflink";
+      editSteps.push_back(EditStep(op, sub_nd, sup->dstPath(), dst, hist_nd, sup));
+      return;
+   }
+   editSteps.push_back(EditStep("cp", sub_nd, hist_nd));
 }
 
 
-/* function: traverseSubs
- * ----------------------
- *  Helper for makeFilsHist.
+/* function: poolObject
+ * --------------------
+ *  Helper for planHistEntry. The pool folder is planned in the root with
+ *  its first copy.
  */
-void FsTree::traverseSubs(FsNode* nd, priority_queue<FsNodePtr>& pq) {
-   pq.push(FsNodePtr(nd));
-   for (FsNode* sub : nd->subordinates)
-      traverseSubs(sub, pq);
+FsNode* FsTree::poolObject(size_t group, FsNode* nd) {
+   if (pooled[group] != nullptr)
+      return pooled[group];
+   if (poolNode == nullptr) {
+      poolNode = plannedNode.make(FsNode(plannedNode.intern(".unidupe_pool"),
+                                         root, FsNode::kDir));
+      editSteps.push_back(EditStep("mkdir", nullptr, poolNode));
+      root->children.push_back(poolNode);
+   }
+   const Digest& key = dupKeys[group];
+   static const char digits[] = "0123456789abcdef";
+   string name;
+   for (size_t i = 0; i < keyLen; i++) {
+      name += digits[key.bytes[i] >> 4];
+      name += digits[key.bytes[i] & 0xf];
+   }
+   name += "-" + to_string(key.size);
+   FsNode* obj = plannedNode.make(FsNode(plannedNode.intern(name), poolNode,
+                                         FsNode::kFile));
+   obj->size = key.size;
+   editSteps.push_back(EditStep("pool", obj, nd->path(), obj->dstPath(), poolNode));
+   poolNode->children.push_back(obj);
+   pooled[group] = obj;
+   return obj;
 }
 
 
-/* function: makeFileHist
- * ----------------------
- *  Helper for constructor with two trees as inputs.
+/* function: histOf
+ * ----------------
+ * Name of the file a folder named name keeps the history of, as named by
+ * makeFileHist, or empty.
  */
-void FsTree::makeFileHist(FsNode* src) {
-   // Gather and sort duplicate nodes by recency.
-   priority_queue<FsNodePtr> pq;
-   traverseSubs(src, pq);
-
-   // Create edit steps for a history directory where most recent duplicate is.
-   FsNode* sup = pq.top().n;
-   pq.pop();
-
-   plannedNode.push_back(FsNode("." + sup->name + "_hist", sup->dstParent, "dir"));
-   FsNode* hist_nd = &(plannedNode.back());
-   editSteps.push(EditStep("mkdir", nullptr, hist_nd));
-   sup->dstParent->children.insert(pair<string, FsNode*> (hist_nd->name, hist_nd));
-
-   // Create edit steps to copy every older duplicate in the history folder.
-   while (!pq.empty()) {
-      FsNode* sub_nd = pq.top().n;
-      // Not top, so ensure node is removed from children list of original
-      // desitnation node.
-      sub_nd->dstParent->children.erase(sub_nd->name);
-      sub_nd->setDstParent(hist_nd);
-      editSteps.push(EditStep("cp", sub_nd, hist_nd));
-      hist_nd->children.insert(pair<string, FsNode*> (sub_nd->name, sub_nd));
-      pq.pop();
-   }
-   editSteps.push(EditStep("cp", sup, sup->dstParent));
-   sup->dstParent->children.insert(pair<string, FsNode*> (sup->name, sup));
-   sup->isSub = false;
+static string_view histOf(string_view name) {
+   const string_view suffix = "_hist";
+   if (name.size() <= suffix.size() + 1 || name[0] != '.' ||
+       name.substr(name.size() - suffix.size()) != suffix)
+      return string_view();
+   return name.substr(1, name.size() - suffix.size() - 1);
 }
 
 
 /* function: mergeDirs
  * -------------------
- * Recursive function which does most of the work of the constuctor with two trees
- * as inputs to merge two directories.
+ * Recursive function which does most of the work of the constuctor with trees
+ * as inputs to merge directories. Children are planned in the order they are
+ * first found in srcs. In a base, history folders next to the file they are
+ * named after are not merged as folders: their files join that file's
+ * duplicate hierarchy.
  */
-void FsTree::mergeDirs(FsNode* nd1, FsNode* nd2, unordered_set<FsNode*>& sups) {
+void FsTree::mergeDirs(FsNode* dst, const vector<FsNode*>& srcs) {
    // TODO add in different logic to organize too many files (>44) into separate dirs.
    //      by creation date first, then by file type.
-   // TODO add special case for dirs when ".[...]_hist" => a tree resulting from unidupe.
-   unordered_map<string, FsNode*> step_children;
-   unordered_set<string> visited;
-   // Check children of nd1
-   for (unordered_map<string, FsNode*>::iterator ch1 = nd1->children.begin();
-        ch1 != nd1->children.end(); ch1++) {
-      FsNode* ch1nd = ch1->second;
-      // If present in both nodes
-      unordered_map<string, FsNode*>::iterator ch2 = nd2->children.find(ch1->first);
-      FsNode* ch2nd = nullptr;
-      if (ch2 != nd2->children.end()) {
-         ch2nd = ch2->second;
-         visited.insert(ch1->first);
+   // TODO add special case for input dirs when ".[...]_hist" => an input resulting
+   //      from unidupe, as done for a base.
+   vector<FsNode*> step_children;
+   // Children of every src, gathered by name.
+   unordered_map<string_view, size_t> byName;
+   vector<vector<FsNode*>> named;
+   for (FsNode* src : srcs) {
+      for (FsNode* ch : src->children) {
+         pair<unordered_map<string_view, size_t>::iterator, bool> entry =
+            byName.insert(pair<string_view, size_t> (ch->name, named.size()));
+         if (entry.second)
+            named.push_back(vector<FsNode*>());
+         named[entry.first->second].push_back(ch);
       }
+   }
 
-      // If directory
-      if (ch1nd->type == "dir") {
-         // Add edit step to create dir.
-         if (ch2nd == nullptr) {
-            // Create container for nd1 contents. Will recurse on container and
-            // nd1.
-            ch2nd = ch1nd;
-            plannedNode.push_back(FsNode(ch1nd->name, nd1, "dir"));
-            ch1nd = &(plannedNode.back());
-         }
-         ch1nd->setParent(nd1);
-         ch2nd->setParent(nd1);
-         editSteps.push(EditStep("mkdir", nullptr, ch1nd));
-         step_children.insert(pair<string, FsNode*> (ch1nd->name, ch1nd));
-         // Recurse
-         mergeDirs(ch1nd, ch2nd, sups);
-      } else { // If file
-            ch1nd->setDstParent(nd1); // Destination folder for file
-         if (ch2nd != nullptr){ // Filename exists in both nodes
-            // Either ch2nd or ch1nd could be most recent of duplicates
-            ch2nd->setDstParent(nd1);
-            if (!(ch1nd->isSub || ch2nd->isSub))
-               ch1nd->makeSub(ch2nd); // Subordinate one duplicate to the other
-            // Add either's topSup to sups and their duplicate tree will be processed
-            FsNode* sub = (ch1nd->isSub) ? ch1nd : ch2nd;
-            FsNode* not_sub = (sub == ch1nd) ? ch2nd : ch1nd;
-            sups.insert(sub->topSup);
-            if (sub->topSup != not_sub) // Ensure no subordinate loops form
-               not_sub->makeSub(sub);
-         } else if (!ch1nd->isSub && ch1nd->subordinates.empty()) { // Not a duplicate
-           editSteps.push(EditStep("cp", ch1nd, nd1)); 
-           step_children.insert(pair<string, FsNode*> (ch1nd->name, ch1nd));
-         } else if (ch1nd->isSub) {
-            sups.insert(ch1nd->topSup);
+   // Join the history kept in a base to its file before files are planned.
+   for (vector<FsNode*>& same : named) {
+      for (FsNode*& ch : same) {
+         if (!ch->isDir() || !ch->inBase)
+            continue;
+         unordered_map<string_view, size_t>::iterator kept = byName.find(histOf(ch->name));
+         if (kept == byName.end())
+            continue;
+         for (FsNode* file : named[kept->second]) {
+            if (file->isDir() || file->parent != ch->parent)
+               continue;
+            for (FsNode* entry : ch->children) {
+               if (entry->isDir())
+                  continue;
+               // Judged older than file when it was kept.
+               entry->date_modified = {0, 0};
+               entry->setDstParent(dst);
+               dupSets.unite(file->dupSet, entry->dupSet);
+            }
+            ch = nullptr;
+            break;
          }
       }
    }
-   
-   for (unordered_map<string, FsNode*>::iterator ch2 = nd2->children.begin();
-        ch2 != nd2->children.end(); ch2++) {
-      if (visited.find(ch2->first) == visited.end()) {
-         if (ch2->second->type == "dir") { // If dir, similar to above
-            FsNode* ch2nd = ch2->second;
-            ch2nd->setParent(nd1);
-            plannedNode.push_back(FsNode(ch2nd->name, nd1, "dir"));
-            FsNode* ch1nd = &(plannedNode.back());
-            editSteps.push(EditStep("mkdir", nullptr, ch1nd));
-            step_children.insert(pair<string, FsNode*> (ch1nd->name, ch1nd));
-            // Recurse
-            mergeDirs(ch1nd, ch2nd, sups);
-         } else { // If file, similar to subcases above (without collision case)
-            ch2->second->setDstParent(nd1);
-            if (!ch2->second->isSub && ch2->second->subordinates.empty()) {
-               step_children.insert(pair<string, FsNode*> (ch2->first, ch2->second));
-               editSteps.push(EditStep("cp", ch2->second, nd1)); 
-            } else if (ch2->second->isSub) {
-               sups.insert(ch2->second->topSup);
-            }
+
+   vector<FsNode*> dirs, files;
+   for (vector<FsNode*>& same : named) {
+      dirs.clear();
+      files.clear();
+      for (FsNode* ch : same) {
+         if (ch == nullptr)
+            continue;
+         ch->setDstParent(dst); // Destination folder for file
+         (ch->isDir() ? dirs : files).push_back(ch);
+      }
+      // Copies of one folder with nothing else by their name are copied as
+      // one, their files left unplanned so they get no history.
+      FsNode* whole = (bulkCopy && files.empty()) ? identicalCopy(dirs) : nullptr;
+      if (whole != nullptr) {
+         editSteps.push_back(EditStep("tree", whole, dst));
+         step_children.push_back(whole);
+         continue;
+      }
+      // If directory, create container for contents of all and recurse.
+      if (!dirs.empty()) {
+         FsNode* dir = plannedNode.make(FsNode(dirs[0]->name, dst, FsNode::kDir));
+         dir->inBase = dirs[0]->inBase; // The base comes first.
+         if (!dir->inBase)
+            editSteps.push_back(EditStep("mkdir", nullptr, dir));
+         step_children.push_back(dir);
+         mergeDirs(dir, dirs);
+      }
+      if (files.size() == 1) { // Name not taken by another file
+         FsNode* ch = files[0];
+         if (dupSets.setSize(ch->dupSet) == 1) { // Not a duplicate
+            if (!ch->inBase)
+               editSteps.push_back(EditStep("cp", ch, dst));
+            step_children.push_back(ch);
          }
       }
+      // Filename exists in several folders, joins each to the next.
+      for (size_t i = 1; i < files.size(); i++)
+         dupSets.unite(files[i - 1]->dupSet, files[i]->dupSet);
    }
-   nd1->children = step_children;
+   dst->children = step_children;
 }
 
 
-/* function: getNextStep
- * ---------------------
- * Helper for execTform.
+/* function: digestDir
+ * -------------------
+ *  Helper for constructor with trees as inputs. Entries are hashed by name
+ *  with their name and kind, and the resolved key of a file or the digest
+ *  of a folder, so folders holding the same names with the same contents
+ *  share a digest wherever they are. Only content keys tell a file apart,
+ *  and a false match would leave files out, so digests are SHA-256.
+ *  Folders under dir are digested first, since the walk shares sha256.
  */
-bool FsTree::getNextStep(EditStep& step) {
-   // If there are no jobs in the queue, fetch a new one from the editSteps queue.
-   if (jobs.empty()) {
-      while (!editSteps.empty()) {
-         step = editSteps.front();
-         editSteps.pop();
-         if (step.acting->parent != nullptr) { // Only root has null parent.
-            FsNode* ascendantNode = (step.op == "mkdir") ?
-               step.acting->parent : step.acting->dstParent;
-            if (!ascendantNode->is_created) { // Queue step and draw another.
-               editQueue.insert(pair<FsNode*, EditStep> (ascendantNode, step));
-               continue;
-            }
+const FsTree::DirDigest& FsTree::digestDir(const FsNode* dir, FileStore& fileStore,
+                                           Hasher& sha256) {
+   DirDigest sum;
+   sum.newest = {0, 0};
+   sum.files = 0;
+   sum.minSet = UINT32_MAX;
+   sum.maxSet = 0;
+   sum.valid = true;
+   vector<const FsNode*> entries(dir->children.begin(), dir->children.end());
+   sort(entries.begin(), entries.end(), [](const FsNode* nd1, const FsNode* nd2) {
+      return strcmp(nd1->name, nd2->name) < 0;
+   });
+   vector<const DirDigest*> subs;
+   for (const FsNode* nd : entries) {
+      if (nd->isDir())
+         subs.push_back(&digestDir(nd, fileStore, sha256));
+   }
+   sha256.reset();
+   vector<const DirDigest*>::iterator nextSub = subs.begin();
+   for (const FsNode* nd : entries) {
+      sha256.update((const unsigned char*)nd->name, strlen(nd->name) + 1);
+      sha256.update((const unsigned char*)&nd->kind, sizeof(nd->kind));
+      if (nd->isDir()) {
+         const DirDigest& sub = **(nextSub++);
+         sha256.update((const unsigned char*)&sub.digest, sizeof(sub.digest));
+         if (sub.files > 0) {
+            sum.files += sub.files;
+            sum.minSet = min(sum.minSet, sub.minSet);
+            sum.maxSet = max(sum.maxSet, sub.maxSet);
+            if (make_pair(sum.newest.tv_sec, sum.newest.tv_nsec) <
+                make_pair(sub.newest.tv_sec, sub.newest.tv_nsec))
+               sum.newest = sub.newest;
          }
-         return true;
+         sum.valid = sum.valid && sub.valid;
+         continue;
       }
-   } else {
-      step = jobs.front();
-      jobs.pop();
-      return true;
+      // The id of a file in fileStore is its duplicate set, as the
+      // constructor checks.
+      const Digest& key = fileStore.key(nd->dupSet);
+      sum.valid = sum.valid && nd->kind == FsNode::kFile &&
+                  key.kind == Digest::kContent;
+      sha256.update((const unsigned char*)&key, sizeof(key));
+      uint32_t set = dupSets.setSize(nd->dupSet);
+      sum.files++;
+      sum.minSet = min(sum.minSet, set);
+      sum.maxSet = max(sum.maxSet, set);
+      if (make_pair(sum.newest.tv_sec, sum.newest.tv_nsec) <
+          make_pair(recency(*nd).tv_sec, recency(*nd).tv_nsec))
+         sum.newest = recency(*nd);
    }
-   return false;
+   unsigned char res[Hasher::kMaxDigestLen];
+   sha256.final(res);
+   sum.digest = Digest::of(Digest::kContent, sum.files, res,
+                           Hasher::digestLen(Hasher::kSha256));
+   return dirDigests[dir] = sum;
+}
+
+
+/* function: reportIdentical
+ * -------------------------
+ *  Helper for constructor with trees as inputs. Folders are listed by path
+ *  within each group, groups by their first path.
+ */
+void FsTree::reportIdentical(ostream& os) const {
+   // Path of a folder within its tree.
+   auto rel = [](const FsNode* nd) {
+      const FsNode* top = nd;
+      while (top->parent != nullptr)
+         top = top->parent;
+      return nd->path().substr(strlen(top->name));
+   };
+   vector<pair<const DirDigest*, const FsNode*>> dirs;
+   for (const pair<const FsNode* const, DirDigest>& d : dirDigests) {
+      if (d.second.valid && d.second.files > 0)
+         dirs.push_back(make_pair(&d.second, d.first));
+   }
+   sort(dirs.begin(), dirs.end(), [](const pair<const DirDigest*, const FsNode*>& d1,
+                                     const pair<const DirDigest*, const FsNode*>& d2) {
+      int c = memcmp(&d1.first->digest, &d2.first->digest, sizeof(Digest));
+      return c < 0 || (c == 0 && d1.second->path() < d2.second->path());
+   });
+   vector<vector<const FsNode*>> groups;
+   for (size_t b = 0, e; b < dirs.size(); b = e) {
+      bool apart = false; // At different paths in their trees.
+      bool covered = true; // Parents share a digest too.
+      unordered_map<const FsNode*, DirDigest>::const_iterator first =
+         dirDigests.find(dirs[b].second->parent);
+      for (e = b; e < dirs.size() && dirs[e].first->digest == dirs[b].first->digest; e++) {
+         apart = apart || rel(dirs[e].second) != rel(dirs[b].second);
+         unordered_map<const FsNode*, DirDigest>::const_iterator parent =
+            dirDigests.find(dirs[e].second->parent);
+         covered = covered && first != dirDigests.end() && parent != dirDigests.end() &&
+                   parent->second.valid && parent->second.digest == first->second.digest;
+      }
+      if (e - b < 2 || !apart || covered)
+         continue;
+      groups.push_back(vector<const FsNode*>());
+      for (size_t i = b; i < e; i++)
+         groups.back().push_back(dirs[i].second);
+   }
+   if (groups.empty())
+      return;
+   sort(groups.begin(), groups.end(), [](const vector<const FsNode*>& g1,
+                                         const vector<const FsNode*>& g2) {
+      return g1[0]->path() < g2[0]->path();
+   });
+   os << "=== Identical folders ===" << endl;
+   for (const vector<const FsNode*>& group : groups) {
+      for (size_t i = 0; i < group.size(); i++)
+         os << (i == 0 ? "" : " == ") << group[i]->path();
+      os << " (" << dirDigests.at(group[0]).files << " files)" << endl;
+   }
+   os << endl;
+}
+
+
+/* function: identicalCopy
+ * -----------------------
+ *  Helper for mergeDirs. Each file then has one copy in each of dirs, and
+ *  no other duplicate or near duplicate, so none of them needs history.
+ */
+FsNode* FsTree::identicalCopy(const vector<FsNode*>& dirs) const {
+   if (dirs.size() < 2)
+      return nullptr;
+   FsNode* kept = nullptr;
+   const DirDigest* keptSum = nullptr;
+   for (FsNode* dir : dirs) {
+      unordered_map<const FsNode*, DirDigest>::const_iterator d = dirDigests.find(dir);
+      if (dir->inBase || d == dirDigests.end() || !d->second.valid)
+         return nullptr;
+      const DirDigest& sum = d->second;
+      if (keptSum != nullptr && sum.digest != keptSum->digest)
+         return nullptr;
+      if (sum.files > 0 && (sum.minSet != dirs.size() || sum.maxSet != dirs.size()))
+         return nullptr;
+      if (keptSum == nullptr ||
+          make_pair(keptSum->newest.tv_sec, keptSum->newest.tv_nsec) <
+          make_pair(sum.newest.tv_sec, sum.newest.tv_nsec)) {
+         kept = dir;
+         keptSum = &sum;
+      }
+   }
+   return kept;
 }
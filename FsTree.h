@@ -1,7 +1,7 @@
 /* file: FsTree.h
  * --------------
  * Tree of FsNodes representing a directory's contents. A representation
- * can be built from a path or from two existing trees. If built from two
+ * can be built from a path or from existing trees. If built from
  * existing trees, the terminal 'cp' and 'mkdir' commands to generate the
  * resulting tree on the file system are queued and can be run with
  * functionality implemented here.
@@ -33,59 +33,167 @@
 #pragma once
 #include "EditStep.h"
 #include "FsNode.h"
+#include "HashPipeline.h"
+#include "NearDupes.h"
+#include "FileStore.h"
+#include "NodeArena.h"
+#include "Digest.h"
+#include "DisjointSets.h"
+#include "TreePrinter.h"
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
-#include <queue>
 #include <ostream>
-#include <list>
+#include <functional>
+#include <vector>
+
+class WorkPool;
 
 class FsTree {
   public:
-   FsTree() : root(nullptr), kMaxProc(10) {}
-   // Builds a representation of the two input trees merged. Will modify
-   // nodes in the two existing trees.
-   FsTree(FsTree& ft1, FsTree& ft2, std::string pathout,
-         std::unordered_multimap<std::string, FsNode>& fileStore);
-   // Builds a representation of folder at rootpath.
-   void build(std::string rootpath,
-                std::unordered_multimap<std::string, FsNode>& fileStore,
-                std::list<FsNode>& folderStore);
-   // Executes cp and mkdir commands in sqeuence to build the tree
-   // built as a result of the constructor which takes two trees as
-   // inputs.
-   void execTform();
+   // What older duplicates kept in history folders are made of. Only files
+   // with the same contents as another are linked, others are copied.
+   enum History {
+      kHistCopy,     // A copy of each.
+      kHistHardlink, // Hard links to the kept copy where they match it.
+      kHistReflink,  // Clones of the kept copy where they match it.
+      kHistPool      // Hard links to one copy per contents in a pool folder.
+   };
+   // Parses copy, hardlink, reflink or pool into history.
+   static bool parseHistory(const std::string& name, History& history);
+
+   FsTree() : root(nullptr), isBase(false), history(kHistCopy),
+              bulkCopy(false), poolNode(nullptr), keyLen(0) {}
+   // Builds a representation of the input trees merged, in one pass
+   // whatever their number. Will modify nodes in the existing trees.
+   // Duplicates are found by hasher, which every tree must have been built
+   // with. With a base, the output of an earlier merge built from pathout,
+   // the trees are folded into it: only new files are copied, and files of
+   // the base are only moved when a newer duplicate takes their place.
+   // With near, files it finds to share most of their contents are kept
+   // in history like duplicates, and listed to stdout. With bulkCopy, a
+   // folder found in several inputs with the same contents everywhere,
+   // and no file duplicated outside of it, is copied by one tree step
+   // without history, and folders with the same contents at different
+   // paths are listed to stdout.
+   // Its stages are the resolve, group, chunk, merge and hist phases of
+   // Metrics.
+   FsTree(const std::vector<FsTree*>& trees, std::string pathout,
+         FileStore& fileStore, HashPipeline& hasher,
+         History history = kHistCopy, FsTree* base = nullptr,
+         NearDupes* near = nullptr, bool bulkCopy = false);
+   // Builds a representation of folder at rootpath. Files are added to
+   // fileStore keyed by size and offered to hasher, the merge constructor
+   // resolves their contents. Directories are explored in parallel on
+   // scanThreads threads. With base, rootpath holds an earlier output to
+   // merge into: its nodes are marked inBase and its files are not offered,
+   // so they are only hashed when their size is shared with a new file.
+   // Timed as the scan phase of Metrics.
+   void build(std::string rootpath, FileStore& fileStore,
+                NodeArena& nodeStore, HashPipeline& hasher,
+                unsigned scanThreads = 1, bool base = false);
+   // Builds trees[i] from paths[i] as build does, one tree after another
+   // for each device, while the trees on other devices are explored at the
+   // same time. Files and nodes are added in the order of paths.
+   static void buildAll(std::vector<FsTree>& trees, const std::vector<std::string>& paths,
+                        FileStore& fileStore, NodeArena& nodeStore,
+                        HashPipeline& hasher, unsigned scanThreads = 1);
+   // Writes the plan of the tree built by the constructor which takes
+   // trees as inputs to path, to be run later by execTform or by Plan.
+   void savePlan(const std::string& path);
+   // Executes cp and mkdir steps on jobs threads to build the tree
+   // built as a result of the constructor which takes trees as
+   // inputs, each step once those it depends on are done. With
+   // forkCommands, steps are run by cp and mkdir processes rather than
+   // within this process. With planPath, runs the plan savePlan wrote
+   // there, journaling its progress so an interrupted run can be resumed.
+   void execTform(unsigned jobs = 1, bool forkCommands = false,
+                  const std::string& planPath = "");
    FsNode* getRoot() { return root; }
+   // Lists the tree, or the planned tree, to os as opts ask. operator<<
+   // lists all of it.
+   void print(std::ostream& os, const TreePrinter::Options& opts) const;
+   // Calls onEntry with the name and d_type of every entry of the folder at
+   // path, open at dfd, "." and ".." excluded, reading them in batches the
+   // size of buf. d_type may be DT_UNKNOWN.
+   static void readEntries(int dfd, const std::string& path, std::vector<char>& buf,
+                           const std::function<void(const char*, unsigned char)>& onEntry);
    friend std::ostream& operator<<(std::ostream& os, const FsTree& ft);
 
   private:
-   // Encapsulates FsNode* and adds a compare function so a priority queue
-   // is sorted with the most recently changed files at the front.
-   struct FsNodePtr;
-   // Helper for FsTree::build that explores rootpath and recurses on
-   // its folders, creating nodes in folderStore and filStore.
-   void explore(std::string rootpath,
-                std::unordered_multimap<std::string, FsNode>& fileStore,
-                std::list<FsNode>& folderStore, FsNode* parent);
-   // Given a node at the top of a hierarchy (start of path), adds every
-   // subordinate node to a priority queue which orders by file recency.
-   void traverseSubs(FsNode* nd, std::priority_queue<FsNodePtr>& pq);
-   // Given a node in a duplicate subordination hierarchy, selects the most
-   // recent duplicate, subordinates others to it, and creates EditSteps to
-   // copy every duplicate in a hidden folder in the same directory as the
-   // most recent duplicate.
-   void makeFileHist(FsNode* src);
-   // Helper for constructor taking two trees as inputs. Folds contents of nd2
-   // into nd1. After it returns, nd1 should have all the contents of nd1 and
-   // nd2.
-   void mergeDirs(FsNode* nd1, FsNode* nd2, std::unordered_set<FsNode*>& sups);
-   // Helper for execTform, stores the next EditStep to execute in step.
-   bool getNextStep(EditStep& step);
+   // Nodes created by one worker while exploring.
+   struct ScanShard;
+   // Merkle digest of a folder, from the names and contents of everything
+   // under it.
+   struct DirDigest {
+      Digest digest;
+      struct timespec newest; // Most recent change to its files.
+      uint32_t files;
+      // Fewest and most files in the duplicate set of one of its files.
+      uint32_t minSet;
+      uint32_t maxSet;
+      bool valid; // False if a file's contents were not told apart.
+   };
+   // Device of the folder at rootpath, checking that it is one.
+   static dev_t rootDevice(const std::string& rootpath);
+   // Builds the tree at rootpath, for build and buildAll.
+   void scan(const std::string& rootpath, FileStore& fileStore,
+             NodeArena& nodeStore, HashPipeline& hasher,
+             unsigned scanThreads, bool base);
+   // Helper for FsTree::build that explores rootpath, creating nodes in the
+   // shard of worker, and queues its folders on pool to be explored.
+   void explore(std::string rootpath, FsNode* parent, HashPipeline& hasher,
+                WorkPool& pool, std::vector<ScanShard>& shards,
+                unsigned worker);
+   // Given the count files of a set of duplicates, selects the most recent
+   // duplicate, marks the others isSub, and creates EditSteps to copy every
+   // duplicate in a hidden folder in the same directory as the most recent
+   // duplicate. Reorders group.
+   void makeFileHist(FsNode** group, size_t count);
+   // Helper for makeFileHist, plans moving nd of the base into dstDir
+   // unless it is there already.
+   void planMove(FsNode* nd, FsNode* dstDir);
+   // Helper for makeFileHist, plans sub_nd in hist_nd as history asks.
+   void planHistEntry(FsNode* sub_nd, FsNode* sup, FsNode* hist_nd);
+   // Node of the pool copy of the contents of group, planned from nd the
+   // first time.
+   FsNode* poolObject(size_t group, FsNode* nd);
+   // Helper for constructor taking trees as inputs. Plans the contents of
+   // every folder of srcs into the planned folder dst, walking the children
+   // of all of them together.
+   void mergeDirs(FsNode* dst, const std::vector<FsNode*>& srcs);
+   // Helper for constructor taking trees as inputs. Digests dir and every
+   // folder under it into dirDigests with sha256, a SHA-256 hasher reset
+   // for each folder, files by their key in fileStore.
+   const DirDigest& digestDir(const FsNode* dir, FileStore& fileStore,
+                              Hasher& sha256);
+   // Helper for constructor taking trees as inputs. Lists to os the
+   // folders sharing a digest at different paths within their trees,
+   // leaving out those whose parents share one too.
+   void reportIdentical(std::ostream& os) const;
+   // Helper for mergeDirs. Copy of the same folder in each input to plan
+   // as a whole, the one with the most recent file, or null unless every
+   // one of dirs holds the same contents and their files have no other
+   // duplicates.
+   FsNode* identicalCopy(const std::vector<FsNode*>& dirs) const;
 
    FsNode* root;
-   // Where new nodes resulting from merging two trees are stored.
-   std::list<FsNode> plannedNode;
-   std::queue<EditStep> editSteps;
-   const unsigned int kMaxProc; // Max child processes to run in execTform.
+   bool isBase; // Built as the base of an incremental merge.
+   // Where new nodes resulting from merging trees are stored.
+   NodeArena plannedNode;
+   std::vector<EditStep> editSteps; // In plan order.
+   History history;
+   // Set while planning: content group of every file with a duplicate, as
+   // an index in dupKeys, and the pool copy of each group.
+   std::unordered_map<const FsNode*, size_t> dupGroup;
+   std::vector<Digest> dupKeys;
+   std::vector<FsNode*> pooled;
+   // Files sharing contents or a planned path, by FsNode::dupSet. Several
+   // files joined one after another end up in a single set.
+   DisjointSets dupSets;
+   // Set while planning with bulkCopy, for every folder of the inputs.
+   std::unordered_map<const FsNode*, DirDigest> dirDigests;
+   bool bulkCopy;
+   FsNode* poolNode;
+   size_t keyLen; // Bytes of dupKeys digests.
 };
 
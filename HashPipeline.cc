@@ -0,0 +1,542 @@
+/* file: HashPipeline.cc
+ * ----------------------
+ * Hashes file contents to group duplicate files in fileStore. Files are
+ * offered as they are explored, and a file is queued for hashing as soon
+ * as another file of the same size shows up, so hasher threads read files
+ * while directories are still being explored. Hashers fingerprint queued
+ * files, and hash the full contents of files whose fingerprints collide.
+ * Once exploring is done, resolve rekeys fileStore in stages: size, then
+ * head and tail fingerprint, then full contents, reusing what the hashers
+ * computed.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "HashPipeline.h"
+#include "WorkPool.h"
+#include "Metrics.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iterator>
+#include <functional>
+#include <stdexcept>
+#include <deque>
+#include <algorithm>
+#include <iostream>
+
+#include <cstring>
+#include <system_error>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+
+using namespace std;
+
+// Bytes read at each end of a file to fingerprint it.
+static const size_t kFingerprintLen = 4096;
+
+const size_t HashPipeline::kQueueLen;
+const unsigned HashPipeline::kUringDepth;
+const size_t HashPipeline::kVerifyChunkLen;
+const size_t HashPipeline::kUringChunkLen;
+const size_t HashPipeline::kUringBatch;
+
+
+/* struct: KeySpec
+ * ---------------
+ * What a FileStore key is made of: the digest of some byte ranges of the
+ * file.
+ */
+struct KeySpec {
+   Digest::Kind kind;
+   vector<pair<off_t, size_t>> ranges;
+   // Whether the digest covers only part of the file.
+   bool partial() const { return kind == Digest::kFingerprint; }
+   size_t bytes() const {
+      size_t n = 0;
+      for (const pair<off_t, size_t>& range : ranges)
+         n += range.second;
+      return n;
+   }
+};
+
+
+/* function: keySpec
+ * -----------------
+ * Content keys hash the whole file. Fingerprint keys hash the first and last
+ * kFingerprintLen bytes of the file, a cheap way to split same size files
+ * before hashing all of their contents. Files short enough to be covered
+ * entirely get their content key right away.
+ */
+static KeySpec keySpec(const FsNode& nd, bool fingerprint) {
+   KeySpec spec;
+   spec.kind = Digest::kContent;
+   if (fingerprint && nd.size > 2*kFingerprintLen) {
+      spec.kind = Digest::kFingerprint;
+      spec.ranges.push_back(make_pair(0, kFingerprintLen));
+      spec.ranges.push_back(make_pair(nd.size - kFingerprintLen, kFingerprintLen));
+   } else if (nd.size > 0) {
+      spec.ranges.push_back(make_pair(0, nd.size));
+   }
+   return spec;
+}
+
+
+/* function: HashPipeline
+ * ----------------------
+ */
+HashPipeline::HashPipeline(const Options& o, DigestCache* c) :
+      opts(o), cache(c), queue(kQueueLen), exploring(true), fullWaiters(0),
+      emptyWaiters(0) {
+   if (opts.threads == 0)
+      throw invalid_argument("HashPipeline needs at least one thread.");
+   for (unsigned i = 0; i < opts.threads; i++)
+      readers.push_back(FileReader(opts.maxReadBuffer));
+   if (opts.useUring) {
+      size_t chunk = min(readers[0].getMaxBuffer() / kUringDepth, kUringChunkLen);
+      chunk = max(chunk, (size_t)sysconf(_SC_PAGESIZE));
+      uring = UringReader::create(kUringDepth, chunk);
+      if (uring == nullptr)
+         cout << "io_uring unavailable, reading files one at a time." << endl;
+   }
+   prefetched.resize(opts.threads);
+   for (unsigned i = 0; i < opts.threads; i++)
+      hashers.push_back(thread(&HashPipeline::hashQueued, this, i));
+}
+
+
+/* function: ~HashPipeline
+ * -----------------------
+ */
+HashPipeline::~HashPipeline() {
+   finish();
+}
+
+
+/* function: offer
+ * ---------------
+ */
+void HashPipeline::offer(FsNode* nd) {
+   FsNode* first;
+   {
+      lock_guard<mutex> lk(sizeMtx);
+      pair<unordered_map<size_t,FsNode*>::iterator, bool> ret =
+         firstOfSize.insert(pair<size_t,FsNode*> (nd->size, nd));
+      if (ret.second) // Alone with its size so far.
+         return;
+      first = ret.first->second;
+      ret.first->second = nullptr;
+   }
+   if (first != nullptr)
+      enqueue(first);
+   enqueue(nd);
+}
+
+
+/* function: enqueue
+ * -----------------
+ * Blocking the explorer when the queue is full keeps memory flat. It only
+ * sleeps once the queue is full, and pushes again under waitMtx after being
+ * counted, so a pop freeing a cell either lets that push through or sees it
+ * waiting.
+ */
+void HashPipeline::enqueue(FsNode* nd) {
+   Metrics::get().add(Metrics::kBytesToHash, keySpec(*nd, true).bytes());
+   if (!queue.push(nd)) {
+      unique_lock<mutex> lk(waitMtx);
+      fullWaiters++;
+      atomic_thread_fence(memory_order_seq_cst);
+      notFull.wait(lk, [&] { return queue.push(nd); });
+      fullWaiters--;
+   }
+   wakeOne(emptyWaiters, notEmpty);
+}
+
+
+/* function: wakeOne
+ * -----------------
+ */
+void HashPipeline::wakeOne(atomic<unsigned>& waiters, condition_variable& cond) {
+   atomic_thread_fence(memory_order_seq_cst);
+   if (waiters > 0) {
+      lock_guard<mutex> lk(waitMtx);
+      cond.notify_one();
+   }
+}
+
+
+/* function: hashQueued
+ * --------------------
+ * Waits on the queue as enqueue does, until exploring is over with the
+ * queue empty. As in offer, the second file found with a fingerprint gets
+ * the contents of both files hashed, and later ones their own.
+ */
+void HashPipeline::hashQueued(unsigned id) {
+   FsNode* nd;
+   while (true) {
+      if (!queue.pop(nd)) {
+         unique_lock<mutex> lk(waitMtx);
+         emptyWaiters++;
+         atomic_thread_fence(memory_order_seq_cst);
+         bool popped = false;
+         notEmpty.wait(lk, [&] { return (popped = queue.pop(nd)) || !exploring; });
+         emptyWaiters--;
+         if (!popped)
+            return;
+      }
+      wakeOne(fullWaiters, notFull);
+      Digest print;
+      if (!prefetch(id, nd, true, print) || print.kind != Digest::kFingerprint)
+         continue;
+      FsNode* first;
+      {
+         lock_guard<mutex> lk(printMtx);
+         pair<unordered_map<Digest,FsNode*,DigestHash>::iterator, bool> ret =
+            firstOfPrint.insert(pair<Digest,FsNode*> (print, nd));
+         if (ret.second) // Alone with its fingerprint so far.
+            continue;
+         first = ret.first->second;
+         ret.first->second = nullptr;
+      }
+      Digest contents;
+      if (first != nullptr)
+         prefetch(id, first, false, contents);
+      prefetch(id, nd, false, contents);
+   }
+}
+
+
+/* function: prefetch
+ * ------------------
+ * Errors are kept for resolve to throw, should it need the key.
+ */
+bool HashPipeline::prefetch(unsigned id, FsNode* nd, bool fingerprint,
+                            Digest& key) {
+   if (!fingerprint)
+      Metrics::get().add(Metrics::kBytesToHash, keySpec(*nd, false).bytes());
+   Prefetched done{nd, fingerprint, Digest(), nullptr};
+   try {
+      done.key = key = readKey(readers[id], *nd, fingerprint);
+   } catch (...) {
+      done.error = current_exception();
+   }
+   prefetched[id].push_back(done);
+   return done.error == nullptr;
+}
+
+
+/* function: finish
+ * ----------------
+ * Hashers only return once the queue is empty and exploring is over.
+ */
+void HashPipeline::finish() {
+   {
+      lock_guard<mutex> lk(waitMtx);
+      exploring = false;
+      notEmpty.notify_all();
+   }
+   for (thread& t : hashers)
+      t.join();
+   hashers.clear();
+}
+
+
+/* function: resolve
+ * -----------------
+ * Files are keyed by size after exploring, so a file alone in its key cannot
+ * have a duplicate and is never read. Files sharing a size are split by
+ * fingerprint, and only those still sharing a fingerprint have all their
+ * contents hashed. Keys only depend on file contents, so the grouping does
+ * not depend on which hasher finished first.
+ */
+void HashPipeline::resolve(FileStore& fileStore) {
+   finish();
+   rekeyShared(fileStore, Digest::kSize, true);
+   rekeyShared(fileStore, Digest::kFingerprint, false);
+   // Nodes may be freed and their addresses reused once resolved.
+   prefetched.clear();
+   firstOfPrint.clear();
+   if (opts.verify)
+      verifyShared(fileStore);
+   if (cache != nullptr)
+      cache->flush();
+}
+
+
+/* function: rekeyAll
+ * ------------------
+ */
+void HashPipeline::rekeyAll(FileStore& fileStore) {
+   finish();
+   vector<FileStore::Id> ids(fileStore.size());
+   for (FileStore::Id id = 0; id < ids.size(); id++)
+      ids[id] = id;
+   rekey(fileStore, ids, false);
+   prefetched.clear();
+   firstOfPrint.clear();
+   if (cache != nullptr)
+      cache->flush();
+}
+
+
+/* function: rekeyShared
+ * ---------------------
+ */
+void HashPipeline::rekeyShared(FileStore& fileStore, Digest::Kind kind,
+                               bool fingerprint) {
+   vector<FileStore::Id> cands;
+   for (const FileStore::Group& group : fileStore.groups()) {
+      if (group.count < 2 || fileStore.key(fileStore.members(group)[0]).kind != kind)
+         continue;
+      // Files of an earlier output were told apart when it was merged.
+      const FileStore::Id* ids = fileStore.members(group);
+      if (all_of(ids, ids + group.count, [&](FileStore::Id id) {
+             return fileStore.node(id).inBase; }))
+         continue;
+      cands.insert(cands.end(), fileStore.members(group),
+                   fileStore.members(group) + group.count);
+   }
+   rekey(fileStore, cands, fingerprint);
+}
+
+
+/* function: rekey
+ * ---------------
+ * Keys computed while exploring are reused when they cover the same bytes,
+ * and the error computing one is thrown, as it would be reading it again.
+ */
+void HashPipeline::rekey(FileStore& fileStore, const vector<FileStore::Id>& ids,
+                         bool fingerprint) {
+   unordered_map<const FsNode*, const Prefetched*> known;
+   for (const vector<Prefetched>& keys : prefetched) {
+      for (const Prefetched& done : keys) {
+         if (keySpec(*done.nd, done.fingerprint).kind ==
+             keySpec(*done.nd, fingerprint).kind)
+            known[done.nd] = &done;
+      }
+   }
+   vector<const FsNode*> nds;
+   vector<FileStore::Id> toHash;
+   for (FileStore::Id id : ids) {
+      const FsNode& nd = fileStore.node(id);
+      unordered_map<const FsNode*, const Prefetched*>::iterator it = known.find(&nd);
+      if (it != known.end()) {
+         if (it->second->error != nullptr)
+            rethrow_exception(it->second->error);
+         fileStore.setKey(id, it->second->key);
+      } else {
+         nds.push_back(&nd);
+         toHash.push_back(id);
+      }
+   }
+   vector<Digest> keys;
+   computeKeys(nds, fingerprint, keys);
+   for (size_t i = 0; i < toHash.size(); i++)
+      fileStore.setKey(toHash[i], keys[i]);
+}
+
+
+/* function: readKey
+ * -----------------
+ * Digests recorded in the cache for the file as it is now are trusted.
+ */
+Digest HashPipeline::readKey(FileReader& reader, const FsNode& nd,
+                             bool fingerprint) {
+   KeySpec spec = keySpec(nd, fingerprint);
+   size_t len = Hasher::digestLen(opts.algo);
+   unsigned char res[Hasher::kMaxDigestLen];
+   Metrics& metrics = Metrics::get();
+   if (cache != nullptr && cache->find(nd, spec.partial(), res)) {
+      metrics.add(Metrics::kCacheHits);
+      return Digest::of(spec.kind, nd.size, res, len);
+   }
+   unique_ptr<Hasher> hasher = Hasher::create(opts.algo);
+   for (const pair<off_t, size_t>& range : spec.ranges)
+      reader.read(nd.path(), range.first, range.second, ref(*hasher));
+   hasher->final(res);
+   metrics.add(Metrics::kDigestsComputed);
+   metrics.add(Metrics::kBytesHashed, spec.bytes());
+   if (cache != nullptr)
+      cache->record(nd, spec.partial(), res);
+   return Digest::of(spec.kind, nd.size, res, len);
+}
+
+
+/* function: computeKeys
+ * ---------------------
+ * With io_uring, many files are read at once from this thread, a batch at a
+ * time so memory stays flat. Otherwise files are read one at a time on each
+ * thread of a pool.
+ */
+void HashPipeline::computeKeys(const vector<const FsNode*>& nds,
+                               bool fingerprint, vector<Digest>& keys) {
+   keys.resize(nds.size());
+   size_t len = Hasher::digestLen(opts.algo);
+   Metrics& metrics = Metrics::get();
+   uint64_t toHash = 0;
+   for (const FsNode* nd : nds)
+      toHash += keySpec(*nd, fingerprint).bytes();
+   metrics.add(Metrics::kBytesToHash, toHash);
+   if (uring != nullptr) {
+      for (size_t b = 0; b < nds.size(); b += kUringBatch) {
+         size_t e = min(nds.size(), b + kUringBatch);
+         vector<unique_ptr<Hasher>> hashers;
+         vector<KeySpec> specs;
+         vector<size_t> toRead;
+         vector<UringReader::Job> jobs;
+         unsigned char res[Hasher::kMaxDigestLen];
+         for (size_t i = b; i < e; i++) {
+            specs.push_back(keySpec(*nds[i], fingerprint));
+            if (cache != nullptr && cache->find(*nds[i], specs.back().partial(), res)) {
+               keys[i] = Digest::of(specs.back().kind, nds[i]->size, res, len);
+               metrics.add(Metrics::kCacheHits);
+               continue;
+            }
+            hashers.push_back(Hasher::create(opts.algo));
+            toRead.push_back(i);
+            jobs.push_back(UringReader::Job{nds[i]->path(), specs.back().ranges,
+                                            ref(*hashers.back())});
+         }
+         uring->run(jobs);
+         for (size_t j = 0; j < toRead.size(); j++) {
+            size_t i = toRead[j];
+            hashers[j]->final(res);
+            metrics.add(Metrics::kDigestsComputed);
+            metrics.add(Metrics::kBytesHashed, specs[i - b].bytes());
+            if (cache != nullptr)
+               cache->record(*nds[i], specs[i - b].partial(), res);
+            keys[i] = Digest::of(specs[i - b].kind, nds[i]->size, res, len);
+         }
+      }
+      return;
+   }
+
+   WorkPool pool(readers.size());
+   for (size_t i = 0; i < nds.size(); i++) {
+      pool.push([this, &nds, &keys, fingerprint, i](unsigned w) {
+         keys[i] = readKey(readers[w], *nds[i], fingerprint);
+      }, i);
+   }
+   pool.run();
+}
+
+
+/* function: sameContents
+ * ----------------------
+ * Compares two files of the same size a chunk at a time.
+ */
+static bool sameContents(const FsNode& a, const FsNode& b,
+                         vector<unsigned char>& bufA,
+                         vector<unsigned char>& bufB) {
+   vector<unsigned char>* bufs[2] = {&bufA, &bufB};
+   string paths[2] = {a.path(), b.path()};
+   int fds[2] = {-1, -1};
+   bool same = true;
+   try {
+      for (int i = 0; i < 2; i++) {
+         if ((fds[i] = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+            throw system_error(errno, system_category(), paths[i]);
+      }
+      for (size_t off = 0; same && off < a.size; off += bufA.size()) {
+         size_t len = min(bufA.size(), a.size - off);
+         for (int i = 0; i < 2; i++) {
+            size_t got = 0;
+            while (got < len) {
+               ssize_t n = pread(fds[i], bufs[i]->data() + got, len - got, off + got);
+               if (n < 0 && errno == EINTR)
+                  continue;
+               if (n < 0)
+                  throw system_error(errno, system_category(), paths[i]);
+               if (n == 0)
+                  throw runtime_error(paths[i] + " is shorter than expected.");
+               got += n;
+            }
+         }
+         same = memcmp(bufA.data(), bufB.data(), len) == 0;
+      }
+   } catch (...) {
+      for (int fd : fds) if (fd >= 0) close(fd);
+      throw;
+   }
+   for (int fd : fds) close(fd);
+   return same;
+}
+
+
+/* function: verifyShared
+ * ----------------------
+ * Members of a group which differ from its first member are split off under
+ * the same digest with the next split number, until every group only holds
+ * identical files. Keys are only set once every group is checked, since
+ * setting them regroups fileStore.
+ */
+void HashPipeline::verifyShared(FileStore& fileStore) {
+   vector<vector<FileStore::Id>> groups;
+   for (const FileStore::Group& group : fileStore.groups()) {
+      const FileStore::Id* ids = fileStore.members(group);
+      if (group.count < 2 || fileStore.key(ids[0]).kind != Digest::kContent)
+         continue;
+      groups.push_back(vector<FileStore::Id>(ids, ids + group.count));
+   }
+
+   size_t bufLen = min(readers[0].getMaxBuffer() / 2, kVerifyChunkLen);
+   vector<vector<unsigned char>> bufs(2 * readers.size(),
+                                      vector<unsigned char>(bufLen));
+   // Split number of each member of each group.
+   vector<vector<uint32_t>> splits(groups.size());
+   WorkPool pool(readers.size());
+   for (size_t g = 0; g < groups.size(); g++) {
+      pool.push([&fileStore, &groups, &splits, &bufs, g](unsigned w) {
+         vector<FileStore::Id>& group = groups[g];
+         vector<uint32_t>& split = splits[g];
+         split.assign(group.size(), 0);
+         // [begin, group.size()) are members not yet matched with a first.
+         for (size_t begin = 0; begin < group.size(); ) {
+            size_t end = begin + 1;
+            uint32_t n = (begin == 0) ? 0 : split[begin - 1] + 1;
+            split[begin] = n;
+            for (size_t i = begin + 1; i < group.size(); i++) {
+               if (sameContents(fileStore.node(group[begin]), fileStore.node(group[i]),
+                                bufs[2*w], bufs[2*w + 1])) {
+                  swap(group[i], group[end]);
+                  split[end++] = n;
+               }
+            }
+            begin = end;
+         }
+      }, g);
+   }
+   pool.run();
+   for (size_t g = 0; g < groups.size(); g++) {
+      for (size_t i = 0; i < groups[g].size(); i++) {
+         if (splits[g][i] == 0)
+            continue;
+         Digest key = fileStore.key(groups[g][i]);
+         key.split = splits[g][i];
+         fileStore.setKey(groups[g][i], key);
+      }
+   }
+}
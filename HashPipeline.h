@@ -0,0 +1,156 @@
+/* file: HashPipeline.h
+ * ---------------------
+ * Hashes file contents to group duplicate files in a FileStore. Files are
+ * offered as they are explored, and a file is queued for hashing as soon
+ * as another file of the same size shows up, so hasher threads read files
+ * while directories are still being explored. Hashers fingerprint queued
+ * files, and hash the full contents of files whose fingerprints collide.
+ * Once exploring is done, resolve rekeys fileStore in stages: size, then
+ * head and tail fingerprint, then full contents, reusing what the hashers
+ * computed.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FsNode.h"
+#include "FileReader.h"
+#include "UringReader.h"
+#include "DigestCache.h"
+#include "Hasher.h"
+#include "FileStore.h"
+#include "Digest.h"
+#include "BoundedQueue.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <exception>
+
+class HashPipeline {
+  public:
+   struct Options {
+      size_t maxReadBuffer = FileReader::kDefaultMaxBuffer;
+      unsigned threads = 1; // Hasher threads, each with its own FileReader.
+      // Read files hashed once exploring is done through io_uring, if the
+      // system allows it.
+      bool useUring = false;
+      Hasher::Algo algo = Hasher::kMd5;
+      // Compare files sharing a digest byte by byte before calling them
+      // duplicates. Needed with a non-cryptographic algo.
+      bool verify = false;
+   };
+
+   // Starts opts.threads hasher threads. Digests are looked up in and
+   // recorded to cache, unless it is null.
+   HashPipeline(const Options& opts, DigestCache* cache = nullptr);
+   ~HashPipeline();
+   // Called by explorers for every file added to fileStore. Thread safe.
+   void offer(FsNode* nd);
+   // Waits for queued files, then rekeys every file of fileStore sharing its
+   // key with another file until only files with identical contents share
+   // a key, and flushes the cache. Only call once all trees are built.
+   void resolve(FileStore& fileStore);
+   // Keys every file of fileStore by its contents, alone in its key or not,
+   // so identical files get equal keys across calls on separate stores.
+   // Files are not compared byte by byte.
+   void rekeyAll(FileStore& fileStore);
+   Hasher::Algo algo() const { return opts.algo; }
+   bool verifies() const { return opts.verify; }
+
+  private:
+   // Key of a file computed by a hasher thread while exploring, or the
+   // error computing it threw.
+   struct Prefetched {
+      FsNode* nd;
+      bool fingerprint; // Whether key was asked for as a fingerprint.
+      Digest key;
+      std::exception_ptr error;
+   };
+   struct DigestHash {
+      size_t operator()(const Digest& key) const { return key.hash(); }
+   };
+
+   // Loop run by each hasher thread, fingerprinting queued files and
+   // hashing the contents of files whose fingerprints collide.
+   void hashQueued(unsigned id);
+   // Computes on hasher id the fingerprint or content key of nd into key,
+   // and records it, or the error. Returns whether it succeeded.
+   bool prefetch(unsigned id, FsNode* nd, bool fingerprint, Digest& key);
+   // Pushes nd to the queue, waiting for room when hashers fall behind.
+   void enqueue(FsNode* nd);
+   // Wakes a thread waiting on cond, if waiters says one may be.
+   void wakeOne(std::atomic<unsigned>& waiters, std::condition_variable& cond);
+   // Waits for the queue to drain and joins hasher threads.
+   void finish();
+   // Rekeys by fingerprint or by contents every file of fileStore whose key
+   // is of kind and is shared with another file, unless all files sharing
+   // it are inBase.
+   void rekeyShared(FileStore& fileStore, Digest::Kind kind, bool fingerprint);
+   // Rekeys the files ids of fileStore by fingerprint or by contents.
+   void rekey(FileStore& fileStore, const std::vector<FileStore::Id>& ids,
+              bool fingerprint);
+   // Splits groups of files sharing a content key in fileStore until each
+   // only holds files with identical bytes.
+   void verifyShared(FileStore& fileStore);
+   // Fingerprint or content key of nd, read through reader unless cached.
+   Digest readKey(FileReader& reader, const FsNode& nd, bool fingerprint);
+   // Stores in keys the fingerprint or content key of each of nds, reading
+   // many files at once.
+   void computeKeys(const std::vector<const FsNode*>& nds, bool fingerprint,
+                    std::vector<Digest>& keys);
+
+   Options opts;
+   DigestCache* cache;
+   std::vector<FileReader> readers; // One per hasher thread.
+   std::unique_ptr<UringReader> uring; // Null unless usable and asked for.
+   std::vector<std::thread> hashers;
+   BoundedQueue<FsNode*> queue;
+   std::atomic<bool> exploring; // False once no more files will be offered.
+   // Explorers wait on notFull while the queue is full, hashers on notEmpty
+   // while it is empty, each counted in the matching waiters so the other
+   // side only takes waitMtx when someone waits.
+   std::mutex waitMtx;
+   std::condition_variable notFull, notEmpty;
+   std::atomic<unsigned> fullWaiters, emptyWaiters;
+   std::mutex sizeMtx;
+   // First file offered with a given size, null once it has been queued.
+   std::unordered_map<size_t, FsNode*> firstOfSize;
+   std::mutex printMtx;
+   // First file queued with a given fingerprint, null once its contents
+   // have been hashed.
+   std::unordered_map<Digest, FsNode*, DigestHash> firstOfPrint;
+   // Keys computed by each hasher thread while exploring.
+   std::vector<std::vector<Prefetched>> prefetched;
+
+   static const size_t kQueueLen = 4096;
+   static const unsigned kUringDepth = 64; // Reads in flight.
+   static const size_t kUringChunkLen = 128 << 10;
+   static const size_t kUringBatch = 4096; // Files per UringReader::run.
+   static const size_t kVerifyChunkLen = 1 << 20;
+};
@@ -0,0 +1,175 @@
+/* file: Hasher.cc
+ * ----------------
+ * Incremental content hashes used to find duplicate files, selectable at
+ * runtime: MD5, SHA-256 through OpenSSL (which uses the SHA extensions of
+ * the CPU when present), and xxh128, the non-cryptographic XXH3-128 of
+ * xxHash, vendored under third_party, several times faster than either.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Hasher.h"
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+#define XXH_INLINE_ALL
+#include "third_party/xxhash/xxhash.h"
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+const size_t Hasher::kMaxDigestLen;
+
+
+/* class: EvpHasher
+ * ----------------
+ * MD5 or SHA-256 through OpenSSL's EVP interface.
+ */
+class EvpHasher : public Hasher {
+  public:
+   explicit EvpHasher(const EVP_MD* md) : md(md), ctx(EVP_MD_CTX_new()) {
+      if (ctx == nullptr)
+         throw runtime_error("Could not initialize digest context.");
+      reset();
+   }
+   ~EvpHasher() { EVP_MD_CTX_free(ctx); }
+   void update(const unsigned char* data, size_t len) {
+      EVP_DigestUpdate(ctx, data, len);
+   }
+   void final(unsigned char* res) { EVP_DigestFinal_ex(ctx, res, nullptr); }
+   void reset() {
+      if (EVP_DigestInit_ex(ctx, md, nullptr) != 1)
+         throw runtime_error("Could not initialize digest context.");
+   }
+
+  private:
+   const EVP_MD* md;
+   EVP_MD_CTX* ctx;
+};
+
+
+/* class: Xxh128
+ * -------------
+ * XXH3-128 of the vendored xxHash. Its state is large and aligned, so it
+ * lives on the heap, and the digest is stored in its canonical big endian
+ * form, the same on every host.
+ */
+class Xxh128 : public Hasher {
+  public:
+   Xxh128() : state(XXH3_createState()) {
+      if (state == nullptr)
+         throw runtime_error("Could not initialize digest state.");
+      reset();
+   }
+   ~Xxh128() { XXH3_freeState(state); }
+   void update(const unsigned char* data, size_t len) {
+      XXH3_128bits_update(state, data, len);
+   }
+   void final(unsigned char* res) {
+      XXH128_canonical_t canon;
+      XXH128_canonicalFromHash(&canon, XXH3_128bits_digest(state));
+      memcpy(res, canon.digest, sizeof(canon.digest));
+   }
+   void reset() {
+      if (XXH3_128bits_reset(state) != XXH_OK)
+         throw runtime_error("Could not initialize digest state.");
+   }
+
+  private:
+   XXH3_state_t* state;
+};
+
+
+/* function: create
+ * ----------------
+ */
+unique_ptr<Hasher> Hasher::create(Algo algo) {
+   switch (algo) {
+      case kMd5: return unique_ptr<Hasher>(new EvpHasher(EVP_md5()));
+      case kSha256: return unique_ptr<Hasher>(new EvpHasher(EVP_sha256()));
+      case kXxh128: return unique_ptr<Hasher>(new Xxh128());
+   }
+   throw invalid_argument("Unknown hash algorithm.");
+}
+
+
+/* function: parse
+ * ---------------
+ */
+bool Hasher::parse(const string& n, Algo& algo) {
+   for (Algo a : {kMd5, kSha256, kXxh128}) {
+      if (n == name(a)) {
+         algo = a;
+         return true;
+      }
+   }
+   // Name of the fast hash before xxHash replaced it.
+   if (n == "fast128") {
+      algo = kXxh128;
+      return true;
+   }
+   return false;
+}
+
+
+/* function: name
+ * --------------
+ */
+const char* Hasher::name(Algo algo) {
+   switch (algo) {
+      case kMd5: return "md5";
+      case kSha256: return "sha256";
+      case kXxh128: return "xxh128";
+   }
+   return "unknown";
+}
+
+
+/* function: digestLen
+ * -------------------
+ */
+size_t Hasher::digestLen(Algo algo) {
+   return (algo == kSha256) ? 32 : 16;
+}
+
+
+/* function: hasShaNi
+ * ------------------
+ * CPUID leaf 7, EBX bit 29.
+ */
+bool Hasher::hasShaNi() {
+#ifdef __x86_64__
+   unsigned eax, ebx, ecx, edx;
+   if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      return false;
+   return (ebx >> 29) & 1;
+#else
+   return false;
+#endif
+}
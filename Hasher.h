@@ -0,0 +1,64 @@
+/* file: Hasher.h
+ * ---------------
+ * Incremental content hashes used to find duplicate files, selectable at
+ * runtime: MD5, SHA-256 through OpenSSL (which uses the SHA extensions of
+ * the CPU when present), and xxh128, the non-cryptographic XXH3-128 of
+ * xxHash, vendored under third_party, several times faster than either.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+class Hasher {
+  public:
+   // Values are stored in digest caches. 2 was a homegrown fast hash, so
+   // digests cached with it never match those of xxh128.
+   enum Algo { kMd5 = 0, kSha256 = 1, kXxh128 = 3 };
+   static const size_t kMaxDigestLen = 32;
+
+   static std::unique_ptr<Hasher> create(Algo algo);
+   // Parses "md5", "sha256" or "xxh128", also known as "fast128", into algo.
+   static bool parse(const std::string& name, Algo& algo);
+   static const char* name(Algo algo);
+   static size_t digestLen(Algo algo);
+   // Whether a digest match can be trusted without comparing contents.
+   static bool isCryptographic(Algo algo) { return algo != kXxh128; }
+   // Whether the CPU has SHA extensions, which OpenSSL picks up on its own.
+   static bool hasShaNi();
+
+   virtual ~Hasher() {}
+   virtual void update(const unsigned char* data, size_t len) = 0;
+   // Writes digestLen(algo) bytes to res. The hasher cannot be updated
+   // again until reset.
+   virtual void final(unsigned char* res) = 0;
+   // Starts a new digest, as if the hasher was just created.
+   virtual void reset() = 0;
+   // So a Hasher can be handed to readers as a sink.
+   void operator()(const unsigned char* data, size_t len) { update(data, len); }
+};
@@ -0,0 +1,247 @@
+/* file: IoScheduler.cc
+ * -------------------
+ * Queues work by device, with a number of slots for each tuned at runtime.
+ * An item holds a slot of the device it reads from and of the one it
+ * writes to.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "IoScheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+const uint64_t IoScheduler::kItemBytes;
+const uint32_t IoScheduler::kWindowItems;
+constexpr double IoScheduler::kWindowSecs;
+
+
+/* function: IoScheduler
+ * ---------------------
+ */
+IoScheduler::IoScheduler(unsigned m, bool a, unsigned s) :
+      maxSlots(m), adaptive(a), startSlots(min(max(s, 1u), m)), next(0),
+      pending(0), closed(false), aborted(false) {
+   if (maxSlots == 0)
+      throw invalid_argument("IoScheduler needs at least one slot.");
+}
+
+
+/* function: device
+ * ----------------
+ */
+IoScheduler::Device& IoScheduler::device(dev_t dev) {
+   unordered_map<dev_t, Device>::iterator it = devices.find(dev);
+   if (it == devices.end()) {
+      Device d;
+      d.slots = adaptive ? startSlots : maxSlots;
+      d.running = 0;
+      d.winBytes = 0;
+      d.winItems = 0;
+      d.winLatency = 0;
+      d.lastRate = 0;
+      d.lastLatency = 0;
+      d.direction = 1;
+      d.stats = DeviceStats{dev, 0, 0, 0, d.slots, 0};
+      it = devices.insert(make_pair(dev, d)).first;
+      order.push_back(dev);
+   }
+   return it->second;
+}
+
+
+/* function: push
+ * --------------
+ */
+void IoScheduler::push(uint32_t item, dev_t from, dev_t to) {
+   lock_guard<mutex> lk(mtx);
+   device(to);
+   device(from).queue.push_back(Queued{item, to});
+   pending++;
+   wake.notify_one();
+}
+
+
+/* function: take
+ * --------------
+ *  Devices are tried round robin from the one after the last served, so a
+ *  busy device does not starve the others. One whose next item waits for
+ *  a slot of the device it writes to is passed over meanwhile.
+ */
+bool IoScheduler::take(uint32_t& item, dev_t& from, dev_t& to) {
+   unique_lock<mutex> lk(mtx);
+   while (true) {
+      if (aborted || (closed && pending == 0))
+         return false;
+      for (size_t k = 0; k < order.size(); k++) {
+         size_t i = (next + k) % order.size();
+         Device& d = devices.at(order[i]);
+         if (d.queue.empty() || d.running >= d.slots)
+            continue;
+         Device* w = (d.queue.front().to == order[i]) ? nullptr :
+                     &devices.at(d.queue.front().to);
+         if (w != nullptr && w->running >= w->slots)
+            continue;
+         item = d.queue.front().item;
+         from = order[i];
+         to = d.queue.front().to;
+         d.queue.pop_front();
+         Clock::time_point now = Clock::now();
+         start(d, now);
+         if (w != nullptr)
+            start(*w, now);
+         next = i + 1;
+         return true;
+      }
+      wake.wait(lk);
+   }
+}
+
+
+/* function: start
+ * ---------------
+ */
+void IoScheduler::start(Device& d, Clock::time_point now) {
+   if (d.stats.items == 0 && d.running == 0 && d.winItems == 0)
+      d.first = d.winStart = now;
+   d.started.push_back(now);
+   d.running++;
+   d.stats.peak = max(d.stats.peak, d.running);
+}
+
+
+/* function: done
+ * --------------
+ */
+void IoScheduler::done(dev_t from, dev_t to, uint64_t bytes) {
+   lock_guard<mutex> lk(mtx);
+   Clock::time_point now = Clock::now();
+   finish(devices.at(from), now, bytes);
+   if (to != from)
+      finish(devices.at(to), now, bytes);
+   pending--;
+   wake.notify_all();
+   if (pending == 0)
+      idle.notify_all();
+}
+
+
+/* function: finish
+ * ----------------
+ *  Items of a device take about as long as each other, so the oldest
+ *  start stands for the item done.
+ */
+void IoScheduler::finish(Device& d, Clock::time_point now, uint64_t bytes) {
+   chrono::duration<double> latency = now - d.started.front();
+   d.started.pop_front();
+   d.running--;
+   d.winBytes += bytes;
+   d.winItems++;
+   d.winLatency += latency.count();
+   d.stats.items++;
+   d.stats.bytes += bytes;
+   d.stats.secs = chrono::duration<double>(now - d.first).count();
+   if (adaptive)
+      tune(d, now);
+   d.stats.slots = d.slots;
+}
+
+
+/* function: tune
+ * --------------
+ *  A window in which the device ran dry says nothing of its slots, so it
+ *  is dropped. Otherwise a faster window keeps slots moving the same way,
+ *  and a slower one, or one answering much later for no gain, turns them
+ *  around. A window as fast as the last gains nothing from more slots, so
+ *  slots go down, until that costs throughput.
+ */
+void IoScheduler::tune(Device& d, Clock::time_point now) {
+   double secs = chrono::duration<double>(now - d.winStart).count();
+   if (d.winItems < max(kWindowItems, 2 * d.slots) || secs < kWindowSecs)
+      return;
+   double rate = (d.winBytes + d.winItems * kItemBytes) / secs;
+   double latency = d.winLatency / d.winItems;
+   bool saturated = !d.queue.empty();
+   if (saturated) {
+      if (d.lastRate > 0) {
+         if (rate < d.lastRate * 0.95 ||
+             (rate < d.lastRate * 1.05 && latency > d.lastLatency * 1.5))
+            d.direction = -d.direction;
+         else if (rate < d.lastRate * 1.05)
+            d.direction = -1;
+      }
+      int slots = (int)d.slots + d.direction;
+      d.slots = min<int>(max(slots, 1), maxSlots);
+      d.lastRate = rate;
+      d.lastLatency = latency;
+   }
+   d.winStart = now;
+   d.winBytes = 0;
+   d.winItems = 0;
+   d.winLatency = 0;
+}
+
+
+/* function: wait
+ * --------------
+ */
+void IoScheduler::wait() {
+   unique_lock<mutex> lk(mtx);
+   idle.wait(lk, [this] { return pending == 0 || aborted; });
+}
+
+
+/* function: close
+ * ---------------
+ */
+void IoScheduler::close() {
+   lock_guard<mutex> lk(mtx);
+   closed = true;
+   wake.notify_all();
+}
+
+
+/* function: abort
+ * ---------------
+ */
+void IoScheduler::abort() {
+   lock_guard<mutex> lk(mtx);
+   aborted = true;
+   wake.notify_all();
+   idle.notify_all();
+}
+
+
+/* function: stats
+ * ---------------
+ */
+vector<IoScheduler::DeviceStats> IoScheduler::stats() const {
+   lock_guard<mutex> lk(mtx);
+   vector<DeviceStats> all;
+   for (dev_t dev : order)
+      all.push_back(devices.at(dev).stats);
+   return all;
+}
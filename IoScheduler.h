@@ -0,0 +1,131 @@
+/* file: IoScheduler.h
+ * ------------------
+ * Queues work by the device it reads from, and runs as many items of each
+ * device at once as that device serves best. An item also holds a slot of
+ * the device it writes to, when that is another one, so writes are bounded
+ * and tuned too, while reads from one device overlap writes to another.
+ * Each device starts with few slots and climbs or backs off one slot at a
+ * time, as the throughput and latency measured over its last window of
+ * items rise or fall, so a spinning disk settles low while an SSD is kept
+ * busy.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
+
+class IoScheduler {
+  public:
+   // What became of a device's items.
+   struct DeviceStats {
+      dev_t dev;
+      uint64_t items;
+      uint64_t bytes;
+      double secs; // From its first item taken to its last done.
+      unsigned slots; // When the last item was done.
+      unsigned peak; // Most items run at once.
+   };
+
+   // Runs up to maxSlots items of a device at once. With adaptive, slots
+   // start at startSlots and are tuned, otherwise they stay at maxSlots.
+   IoScheduler(unsigned maxSlots, bool adaptive = true, unsigned startSlots = 2);
+   // Queues item, reading from from and writing to to. Thread safe, as are
+   // all members.
+   void push(uint32_t item, dev_t from, dev_t to);
+   // Waits for a queued item whose devices both have a free slot, takes
+   // the slots and sets item, from and to. Items of a device are taken in
+   // the order they were pushed. False once closed with nothing queued nor
+   // running, or after abort.
+   bool take(uint32_t& item, dev_t& from, dev_t& to);
+   // Frees the slots taken for an item, which moved bytes.
+   void done(dev_t from, dev_t to, uint64_t bytes);
+   // Waits until nothing is queued nor running, or abort.
+   void wait();
+   // Tells take no more items will be pushed.
+   void close();
+   // Makes take return false from now on, once running items are done.
+   void abort();
+   // Devices in the order they were first pushed to.
+   std::vector<DeviceStats> stats() const;
+
+  private:
+   typedef std::chrono::steady_clock Clock;
+   struct Queued {
+      uint32_t item;
+      dev_t to;
+   };
+   struct Device {
+      std::deque<Queued> queue; // Of items reading from it.
+      std::deque<Clock::time_point> started; // Of running items, in order.
+      unsigned slots;
+      unsigned running;
+      // Window of items done since the slots last changed.
+      Clock::time_point winStart;
+      uint64_t winBytes;
+      uint32_t winItems;
+      double winLatency; // Seconds, summed.
+      double lastRate; // Weighted bytes a second of the last window.
+      double lastLatency;
+      int direction; // Of the next change of slots.
+      DeviceStats stats;
+      Clock::time_point first;
+   };
+   // Device dev, added with fresh slots if new. mtx must be held.
+   Device& device(dev_t dev);
+   // Counts an item in or out of a slot of d. mtx must be held.
+   void start(Device& d, Clock::time_point now);
+   void finish(Device& d, Clock::time_point now, uint64_t bytes);
+   // Moves slots of d one step if its window is full, up while more
+   // slots pay off, down while they do not.
+   void tune(Device& d, Clock::time_point now);
+
+   unsigned maxSlots;
+   bool adaptive;
+   unsigned startSlots;
+   mutable std::mutex mtx;
+   std::condition_variable wake; // Of takers.
+   std::condition_variable idle; // Of wait, once nothing is pending.
+   std::unordered_map<dev_t, Device> devices;
+   std::vector<dev_t> order; // Of devices, scanned round robin by take.
+   size_t next;
+   size_t pending; // Items queued or running.
+   bool closed;
+   bool aborted;
+
+   // An item counts as this many bytes on top of those it moves, so items
+   // which move none, such as making folders, still weigh.
+   static const uint64_t kItemBytes = 64 << 10;
+   // A window ends once it holds this many items, or twice the slots,
+   // and lasts this long.
+   static const uint32_t kWindowItems = 16;
+   static constexpr double kWindowSecs = 0.25;
+};
@@ -0,0 +1,282 @@
+/* file: Metrics.cc
+ * ----------------
+ * Counters, phase timers, the progress line and the JSON report.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Metrics.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <system_error>
+#include <ctime>
+#include <cerrno>
+
+using namespace std;
+
+// Progress line redraws.
+static const chrono::milliseconds kRedrawEvery(1000);
+
+
+/* function: cpuSeconds
+ * --------------------
+ * CPU time of every thread of the process.
+ */
+static double cpuSeconds() {
+   struct timespec ts;
+   if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) < 0)
+      return 0;
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* function: human
+ * ---------------
+ * Byte count with a binary suffix.
+ */
+static string human(double bytes) {
+   static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+   int u = 0;
+   while (bytes >= 1024 && u < 4) {
+      bytes /= 1024;
+      u++;
+   }
+   ostringstream os;
+   os << fixed << setprecision(u == 0 ? 0 : 1) << bytes << " " << units[u];
+   return os.str();
+}
+
+
+/* function: eta
+ * -------------
+ * Time left to reach total at the rate done took secs, as H:MM:SS.
+ */
+static string eta(uint64_t done, uint64_t total, double secs) {
+   if (done == 0 || total <= done)
+      return "";
+   long left = (long)(secs * (total - done) / done);
+   ostringstream os;
+   os << ", ETA " << left / 3600 << ":" << setfill('0') << setw(2)
+      << left / 60 % 60 << ":" << setw(2) << left % 60;
+   return os.str();
+}
+
+
+/* function: Metrics
+ * -----------------
+ */
+Metrics::Metrics() : started(chrono::steady_clock::now()), current(nullptr),
+                     stopping(false) {
+   for (atomic<uint64_t>& counter : counters)
+      counter = 0;
+}
+
+
+/* function: get
+ * -------------
+ */
+Metrics& Metrics::get() {
+   static Metrics metrics;
+   return metrics;
+}
+
+
+/* function: name
+ * --------------
+ */
+const char* Metrics::name(Counter counter) {
+   static const char* names[kCounters] = {
+      "entries_scanned", "dirs_scanned", "digests_computed", "bytes_hashed",
+      "bytes_to_hash", "cache_hits", "dup_groups", "hist_folders",
+      "bytes_chunked", "near_dupes", "steps_queued", "steps_done", "steps_failed", "bytes_copied"};
+   return names[counter];
+}
+
+
+/* function: Phase
+ * ---------------
+ */
+Metrics::Phase::Phase(const char* n) : name(n), wall(chrono::steady_clock::now()),
+                                       cpu(cpuSeconds()) {
+   Metrics& m = get();
+   lock_guard<mutex> lk(m.mtx);
+   m.current = name;
+   m.currentStart = wall;
+   m.currentBase.resize(kCounters);
+   for (int c = 0; c < kCounters; c++)
+      m.currentBase[c] = m.value((Counter)c);
+}
+
+
+/* function: ~Phase
+ * ----------------
+ */
+Metrics::Phase::~Phase() {
+   chrono::duration<double> secs = chrono::steady_clock::now() - wall;
+   Metrics& m = get();
+   lock_guard<mutex> lk(m.mtx);
+   m.phases.push_back(PhaseTimes{name, secs.count(), cpuSeconds() - cpu});
+   if (m.current == name)
+      m.current = nullptr;
+}
+
+
+/* function: wallSeconds
+ * ---------------------
+ */
+double Metrics::wallSeconds(const string& n) {
+   lock_guard<mutex> lk(mtx);
+   double secs = 0;
+   for (const PhaseTimes& phase : phases) {
+      if (phase.name == n)
+         secs += phase.wall;
+   }
+   return secs;
+}
+
+
+/* function: reset
+ * ---------------
+ */
+void Metrics::reset() {
+   lock_guard<mutex> lk(mtx);
+   for (atomic<uint64_t>& counter : counters)
+      counter = 0;
+   phases.clear();
+   started = chrono::steady_clock::now();
+}
+
+
+/* function: startProgress
+ * -----------------------
+ */
+void Metrics::startProgress() {
+   lock_guard<mutex> lk(mtx);
+   if (progress.joinable())
+      return;
+   stopping = false;
+   progress = thread(&Metrics::drawProgress, this);
+}
+
+
+/* function: stopProgress
+ * ----------------------
+ */
+void Metrics::stopProgress() {
+   {
+      lock_guard<mutex> lk(mtx);
+      stopping = true;
+   }
+   wake.notify_all();
+   if (progress.joinable())
+      progress.join();
+}
+
+
+/* function: drawProgress
+ * ----------------------
+ * The line is cleared when its phase ends, so it never sits in the middle
+ * of what the phases print, or of the question asked before running.
+ */
+void Metrics::drawProgress() {
+   unique_lock<mutex> lk(mtx);
+   bool shown = false;
+   while (!stopping) {
+      wake.wait_for(lk, kRedrawEvery);
+      if (current != nullptr && !stopping) {
+         chrono::duration<double> secs = chrono::steady_clock::now() - currentStart;
+         cerr << "\r" << progressLine(currentBase, secs.count()) << "\033[K" << flush;
+         shown = true;
+      } else if (shown) {
+         cerr << "\r\033[K" << flush;
+         shown = false;
+      }
+   }
+   if (shown)
+      cerr << "\r\033[K" << flush;
+}
+
+
+/* function: progressLine
+ * ----------------------
+ */
+string Metrics::progressLine(const vector<uint64_t>& base, double secs) {
+   auto since = [&](Counter c) { return value(c) - base[c]; };
+   double rate = max(secs, 1e-3);
+   ostringstream os;
+   os << "[" << current << " " << fixed << setprecision(0) << secs << "s] ";
+   string phase = current;
+   if (phase == "scan") {
+      os << since(kEntriesScanned) << " entries in " << since(kDirsScanned)
+         << " folders, " << (uint64_t)(since(kEntriesScanned) / rate)
+         << " entries/s, " << human(since(kBytesHashed)) << " hashed";
+   } else if (phase == "resolve") {
+      uint64_t done = since(kBytesHashed);
+      os << human(done) << " of " << human(since(kBytesToHash)) << " hashed, "
+         << human(done / rate) << "/s, " << since(kDigestsComputed)
+         << " digests" << eta(done, since(kBytesToHash), secs);
+   } else if (phase == "chunk") {
+      os << human(since(kBytesChunked)) << " chunked, "
+         << human(since(kBytesChunked) / rate) << "/s";
+   } else if (phase == "exec") {
+      uint64_t done = since(kStepsDone) + since(kStepsFailed);
+      os << done << " of " << since(kStepsQueued) << " steps, "
+         << human(since(kBytesCopied)) << " copied, "
+         << human(since(kBytesCopied) / rate) << "/s"
+         << eta(done, since(kStepsQueued), secs);
+   }
+   return os.str();
+}
+
+
+/* function: writeJson
+ * -------------------
+ */
+void Metrics::writeJson(const string& path) {
+   ofstream out(path);
+   if (!out)
+      throw system_error(errno, system_category(), path);
+   lock_guard<mutex> lk(mtx);
+   chrono::duration<double> total = chrono::steady_clock::now() - started;
+   out << fixed << setprecision(6);
+   out << "{\n  \"wall_seconds\": " << total.count() << ",\n  \"cpu_seconds\": "
+       << cpuSeconds() << ",\n  \"counters\": {";
+   for (int c = 0; c < kCounters; c++) {
+      out << (c == 0 ? "\n" : ",\n") << "    \"" << name((Counter)c) << "\": "
+          << value((Counter)c);
+   }
+   out << "\n  },\n  \"phases\": [";
+   for (size_t i = 0; i < phases.size(); i++) {
+      out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << phases[i].name
+          << "\", \"wall_seconds\": " << phases[i].wall
+          << ", \"cpu_seconds\": " << phases[i].cpu << "}";
+   }
+   out << "\n  ]\n}" << endl;
+   if (!out)
+      throw system_error(errno, system_category(), path);
+}
@@ -0,0 +1,120 @@
+/* file: Metrics.h
+ * ---------------
+ * Counters and phase timers of a run, shared by every stage. Counters are
+ * relaxed atomics bumped once per file or folder, so keeping them costs
+ * next to nothing. A progress line on stderr shows the current phase with
+ * its rates and, where the work ahead is known, an ETA, and a JSON report
+ * of all of it can be written at exit.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+class Metrics {
+  public:
+   enum Counter {
+      kEntriesScanned, // Folder entries read while exploring.
+      kDirsScanned,
+      kDigestsComputed, // Fingerprints and content digests read from files.
+      kBytesHashed,
+      kBytesToHash, // Queued to be hashed, while exploring or after.
+      kCacheHits, // Digests found in the digest cache instead.
+      kDupGroups, // Groups of files with the same contents.
+      kHistFolders, // History folders planned.
+      kBytesChunked, // Read to find near duplicates.
+      kNearDupes, // Pairs of files sharing most of their chunks.
+      kStepsQueued,
+      kStepsDone,
+      kStepsFailed,
+      kBytesCopied,
+      kCounters
+   };
+
+   // Wall and CPU time from construction to destruction, added to the
+   // phase of the same name. Shown by the progress line meanwhile.
+   class Phase {
+     public:
+      explicit Phase(const char* name);
+      ~Phase();
+      Phase(const Phase&) = delete;
+      Phase& operator=(const Phase&) = delete;
+     private:
+      const char* name;
+      std::chrono::steady_clock::time_point wall;
+      double cpu;
+   };
+
+   // The metrics of this process.
+   static Metrics& get();
+   ~Metrics() { stopProgress(); }
+   void add(Counter counter, uint64_t n = 1) {
+      counters[counter].fetch_add(n, std::memory_order_relaxed);
+   }
+   uint64_t value(Counter counter) const {
+      return counters[counter].load(std::memory_order_relaxed);
+   }
+   static const char* name(Counter counter);
+   // Wall seconds of every phase named name so far.
+   double wallSeconds(const std::string& name);
+   // Clears counters and phases, between runs in one process.
+   void reset();
+   // Redraws the progress line on stderr every second, until stopped.
+   void startProgress();
+   void stopProgress();
+   // Writes counters and phases to path as JSON. Throws system_error if the
+   // file cannot be written.
+   void writeJson(const std::string& path);
+
+  private:
+   struct PhaseTimes {
+      std::string name;
+      double wall;
+      double cpu;
+   };
+   Metrics();
+   // The progress line of the current phase, started when counters held
+   // base, secs ago.
+   std::string progressLine(const std::vector<uint64_t>& base, double secs);
+   void drawProgress();
+
+   std::atomic<uint64_t> counters[kCounters];
+   std::chrono::steady_clock::time_point started;
+   std::mutex mtx; // For every member below.
+   std::vector<PhaseTimes> phases; // In the order they ended.
+   const char* current; // Phase under way, or null.
+   std::chrono::steady_clock::time_point currentStart;
+   std::vector<uint64_t> currentBase; // Counters when it started.
+   std::thread progress;
+   bool stopping;
+   std::condition_variable wake;
+};
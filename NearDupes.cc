@@ -0,0 +1,184 @@
+/* file: NearDupes.cc
+ * -------------------
+ * Finds files which share most of their contents through an index of their
+ * content-defined chunks.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "NearDupes.h"
+#include "WorkPool.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <unordered_map>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+const size_t NearDupes::kMaxFilesPerChunk;
+
+
+/* function: NearDupes
+ * -------------------
+ */
+NearDupes::NearDupes(const Options& o) : opts(o) {
+   if (opts.threads == 0)
+      throw invalid_argument("NearDupes needs at least one thread.");
+   if (opts.percent == 0 || opts.percent > 100)
+      throw invalid_argument("Near duplicates share from 1 to 100 percent.");
+   for (unsigned i = 0; i < opts.threads; i++)
+      readers.push_back(FileReader(opts.maxReadBuffer));
+}
+
+
+/* function: find
+ * --------------
+ *  Files with the same contents are chunked once, through the member of
+ *  their group with the first path. Postings of all files are sorted by
+ *  chunk, so the files holding a chunk come together, and every pair of
+ *  them is credited the bytes of the copies of it they both hold.
+ */
+vector<NearDupes::Pair> NearDupes::find(FileStore& fileStore) {
+   vector<FileStore::Id> files;
+   vector<bool> baseOnly; // By index in files.
+   for (const FileStore::Group& group : fileStore.groups()) {
+      const FileStore::Id* ids = fileStore.members(group);
+      if (fileStore.node(ids[0]).size < opts.minSize)
+         continue;
+      FileStore::Id first = ids[0];
+      bool inBase = true;
+      for (FileStore::Id i = 0; i < group.count; i++) {
+         if (fileStore.node(ids[i]).path() < fileStore.node(first).path())
+            first = ids[i];
+         inBase = inBase && fileStore.node(ids[i]).inBase;
+      }
+      files.push_back(first);
+      baseOnly.push_back(inBase);
+   }
+
+   vector<vector<Posting>> chunked(files.size());
+   WorkPool pool(readers.size());
+   for (size_t i = 0; i < files.size(); i++) {
+      pool.push([this, &fileStore, &files, &chunked, i](unsigned w) {
+         chunkFile(readers[w], fileStore.node(files[i]), i, chunked[i]);
+      }, i);
+   }
+   pool.run();
+   vector<Posting> postings;
+   for (vector<Posting>& p : chunked) {
+      postings.insert(postings.end(), p.begin(), p.end());
+      p = vector<Posting>();
+   }
+   sort(postings.begin(), postings.end(), [](const Posting& p1, const Posting& p2) {
+      return lexicographical_compare(p1.key, p1.key + 2, p2.key, p2.key + 2);
+   });
+
+   // Bytes shared by files a and b, keyed by a << 32 | b with a < b.
+   unordered_map<uint64_t, uint64_t> shared;
+   for (size_t b = 0, e; b < postings.size(); b = e) {
+      for (e = b + 1; e < postings.size() &&
+                      equal(postings[b].key, postings[b].key + 2, postings[e].key); e++)
+         ;
+      if (e - b < 2 || e - b > kMaxFilesPerChunk)
+         continue;
+      for (size_t i = b; i < e; i++) {
+         for (size_t j = i + 1; j < e; j++) {
+            FileStore::Id f1 = min(postings[i].file, postings[j].file);
+            FileStore::Id f2 = max(postings[i].file, postings[j].file);
+            if (baseOnly[f1] && baseOnly[f2])
+               continue;
+            shared[(uint64_t)f1 << 32 | f2] += (uint64_t)postings[b].len *
+               min(postings[i].count, postings[j].count);
+         }
+      }
+   }
+
+   vector<Pair> pairs;
+   for (const pair<const uint64_t, uint64_t>& s : shared) {
+      FileStore::Id a = files[s.first >> 32];
+      FileStore::Id b = files[s.first & UINT32_MAX];
+      uint64_t larger = max(fileStore.node(a).size, fileStore.node(b).size);
+      if (s.second * 100 < larger * opts.percent)
+         continue;
+      if (fileStore.node(b).path() < fileStore.node(a).path())
+         swap(a, b);
+      pairs.push_back(Pair{a, b, s.second});
+   }
+   sort(pairs.begin(), pairs.end(), [&](const Pair& p1, const Pair& p2) {
+      return make_pair(fileStore.node(p1.a).path(), fileStore.node(p1.b).path()) <
+             make_pair(fileStore.node(p2.a).path(), fileStore.node(p2.b).path());
+   });
+   Metrics::get().add(Metrics::kNearDupes, pairs.size());
+   return pairs;
+}
+
+
+/* function: chunkFile
+ * -------------------
+ *  Chunks repeated within the file, such as blocks of zeros, are counted
+ *  in one posting.
+ */
+void NearDupes::chunkFile(FileReader& reader, const FsNode& nd, FileStore::Id file,
+                          vector<Posting>& postings) {
+   struct KeyHash {
+      size_t operator()(const pair<uint64_t, uint64_t>& k) const {
+         return k.first ^ (k.second * 0x9e3779b97f4a7c15ULL);
+      }
+   };
+   unordered_map<pair<uint64_t, uint64_t>, size_t, KeyHash> seen;
+   Chunker chunker(opts.chunking, [&](const Chunker::Chunk& chunk) {
+      pair<unordered_map<pair<uint64_t, uint64_t>, size_t, KeyHash>::iterator, bool> it =
+         seen.insert(make_pair(make_pair(chunk.key[0], chunk.key[1]), postings.size()));
+      if (it.second)
+         postings.push_back(Posting{{chunk.key[0], chunk.key[1]}, chunk.len, 1, file});
+      else
+         postings[it.first->second].count++;
+   });
+   reader.read(nd.path(), 0, nd.size, ref(chunker));
+   chunker.final();
+   Metrics::get().add(Metrics::kBytesChunked, nd.size);
+}
+
+
+/* function: report
+ * ----------------
+ */
+void NearDupes::report(ostream& os, FileStore& fileStore, const vector<Pair>& pairs) {
+   if (pairs.empty())
+      return;
+   os << "=== Near duplicates ===" << endl;
+   for (const Pair& p : pairs) {
+      const FsNode& a = fileStore.node(p.a);
+      const FsNode& b = fileStore.node(p.b);
+      os << a.path() << " ~ " << b.path() << ": " << p.shared << " bytes shared ("
+         << fixed << setprecision(1) << 100.0 * p.shared / max<uint64_t>(a.size, 1)
+         << "% of " << a.size << ", "
+         << 100.0 * p.shared / max<uint64_t>(b.size, 1) << "% of " << b.size << ")"
+         << defaultfloat << endl;
+   }
+   os << endl;
+}
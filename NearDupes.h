@@ -0,0 +1,86 @@
+/* file: NearDupes.h
+ * ------------------
+ * Finds files which share most of their contents without being identical,
+ * such as disk images or mailboxes a few writes apart. Files are cut into
+ * content-defined chunks by Chunker, and an index of the chunks across all
+ * input trees tells how many bytes each pair of files has in common.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "Chunker.h"
+#include "FileStore.h"
+#include "FileReader.h"
+#include <ostream>
+#include <vector>
+#include <cstdint>
+
+class NearDupes {
+  public:
+   struct Options {
+      // Part of the larger file of a pair found in the other, in percent,
+      // for the pair to be near duplicates.
+      unsigned percent = 90;
+      size_t minSize = 64 << 10; // Smaller files are not chunked.
+      Chunker::Options chunking;
+      unsigned threads = 1; // Each with its own FileReader.
+      size_t maxReadBuffer = FileReader::kDefaultMaxBuffer;
+   };
+   // Two files and the bytes of chunks they have in common.
+   struct Pair {
+      FileStore::Id a;
+      FileStore::Id b;
+      uint64_t shared;
+   };
+
+   explicit NearDupes(const Options& opts);
+   // Chunks one file of each group of the resolved fileStore at least
+   // minSize long, and returns the pairs of them sharing percent of the
+   // larger file, by path. Groups only holding files of a base are not
+   // paired with each other.
+   std::vector<Pair> find(FileStore& fileStore);
+   // Lists pairs to os, with how much of each file the other holds.
+   static void report(std::ostream& os, FileStore& fileStore,
+                      const std::vector<Pair>& pairs);
+
+  private:
+   // A chunk found count times in a file, by its index among those chunked.
+   struct Posting {
+      uint64_t key[2];
+      uint32_t len;
+      uint32_t count;
+      FileStore::Id file;
+   };
+   // Cuts nd into postings for file, one per distinct chunk.
+   void chunkFile(FileReader& reader, const FsNode& nd, FileStore::Id file,
+                  std::vector<Posting>& postings);
+
+   Options opts;
+   std::vector<FileReader> readers; // One per thread.
+
+   // Chunks found in more files than this, such as runs of zeros, are left
+   // out of the index, so they do not pair every file with every other.
+   static const size_t kMaxFilesPerChunk = 64;
+};
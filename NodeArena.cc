@@ -0,0 +1,162 @@
+/* file: NodeArena.cc
+ * -------------------
+ * Implementation of NodeArena.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "NodeArena.h"
+#include <new>
+#include <cstring>
+#include <functional>
+
+using namespace std;
+
+const size_t NodeArena::kNodesPerBlock;
+const size_t NodeArena::kNameBlockLen;
+
+
+/* function: NodeArena
+ * -------------------
+ */
+NodeArena::NodeArena(NodeArena&& other) : NodeArena() {
+   merge(other);
+}
+
+
+/* function: ~NodeArena
+ * --------------------
+ */
+NodeArena::~NodeArena() {
+   for (NodeBlock& block : nodeBlocks) {
+      for (size_t i = 0; i < block.used; i++)
+         block.nodes[i].~FsNode();
+      ::operator delete(block.nodes);
+   }
+   for (NameBlock& block : nameBlocks)
+      delete[] block.chars;
+}
+
+
+/* function: make
+ * --------------
+ */
+FsNode* NodeArena::make(const FsNode& nd) {
+   if (nodeBlocks.empty() || nodeBlocks.back().used == kNodesPerBlock) {
+      void* mem = ::operator new(kNodesPerBlock * sizeof(FsNode));
+      nodeBlocks.push_back(NodeBlock{(FsNode*)mem, 0});
+   }
+   NodeBlock& block = nodeBlocks.back();
+   FsNode* node = new (block.nodes + block.used) FsNode(nd);
+   block.used++;
+   count++;
+   return node;
+}
+
+
+/* function: intern
+ * ----------------
+ * Linear probing over a table kept at most half full.
+ */
+const char* NodeArena::intern(string_view name) {
+   if (2 * (interned + 1) > slots.size())
+      growSlots();
+   size_t mask = slots.size() - 1;
+   size_t i = hash<string_view>()(name) & mask;
+   while (slots[i] != nullptr) {
+      if (name == slots[i])
+         return slots[i];
+      i = (i + 1) & mask;
+   }
+   slots[i] = store(name);
+   interned++;
+   return slots[i];
+}
+
+
+/* function: growSlots
+ * -------------------
+ */
+void NodeArena::growSlots() {
+   vector<const char*> old;
+   old.swap(slots);
+   slots.assign(old.empty() ? 1024 : 2 * old.size(), nullptr);
+   size_t mask = slots.size() - 1;
+   for (const char* name : old) {
+      if (name == nullptr)
+         continue;
+      size_t i = hash<string_view>()(name) & mask;
+      while (slots[i] != nullptr)
+         i = (i + 1) & mask;
+      slots[i] = name;
+   }
+}
+
+
+/* function: store
+ * ---------------
+ * Names longer than a block get a block of their own.
+ */
+const char* NodeArena::store(string_view name) {
+   size_t len = name.size() + 1;
+   if (nameBlocks.empty() || nameBlocks.back().len - nameBlocks.back().used < len) {
+      size_t blockLen = max(len, kNameBlockLen);
+      nameBlocks.push_back(NameBlock{new char[blockLen], 0, blockLen});
+   }
+   NameBlock& block = nameBlocks.back();
+   char* copy = block.chars + block.used;
+   memcpy(copy, name.data(), name.size());
+   copy[name.size()] = '\0';
+   block.used += len;
+   return copy;
+}
+
+
+/* function: merge
+ * ---------------
+ * Blocks change hands, so nothing moves. Interning starts over in both
+ * arenas, which is what frees the table once exploring is done.
+ */
+void NodeArena::merge(NodeArena& other) {
+   nodeBlocks.insert(nodeBlocks.end(), other.nodeBlocks.begin(), other.nodeBlocks.end());
+   nameBlocks.insert(nameBlocks.end(), other.nameBlocks.begin(), other.nameBlocks.end());
+   count += other.count;
+   other.nodeBlocks.clear();
+   other.nameBlocks.clear();
+   other.count = 0;
+   vector<const char*>().swap(slots);
+   vector<const char*>().swap(other.slots);
+   interned = other.interned = 0;
+}
+
+
+/* function: capacity
+ * ------------------
+ */
+size_t NodeArena::capacity() const {
+   size_t bytes = nodeBlocks.size() * kNodesPerBlock * sizeof(FsNode);
+   for (const NameBlock& block : nameBlocks)
+      bytes += block.len;
+   return bytes;
+}
@@ -0,0 +1,80 @@
+/* file: NodeArena.h
+ * ------------------
+ * Allocates FsNodes and their names in large blocks, so building a tree
+ * of millions of entries makes a few thousand allocations instead of
+ * several per entry. Nodes and names never move and live as long as the
+ * arena that holds them, even after it is merged into another one.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FsNode.h"
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+class NodeArena {
+  public:
+   NodeArena() : count(0), interned(0) {}
+   NodeArena(NodeArena&& other);
+   NodeArena(const NodeArena&) = delete;
+   NodeArena& operator=(const NodeArena&) = delete;
+   ~NodeArena();
+   // Copy of nd, at an address which never changes.
+   FsNode* make(const FsNode& nd);
+   // Null terminated copy of name. Equal names interned since the arena was
+   // created or last merged share a copy.
+   const char* intern(std::string_view name);
+   // Moves every node and name of other to this arena.
+   void merge(NodeArena& other);
+   size_t size() const { return count; }
+   // Bytes held by the blocks, used or not.
+   size_t capacity() const;
+
+  private:
+   struct NodeBlock {
+      FsNode* nodes; // Room for kNodesPerBlock.
+      size_t used;
+   };
+   struct NameBlock {
+      char* chars;
+      size_t used;
+      size_t len;
+   };
+   // Copies name to the last name block, starting a new one if it is full.
+   const char* store(std::string_view name);
+   // Doubles the slots of the interning table.
+   void growSlots();
+
+   std::vector<NodeBlock> nodeBlocks;
+   std::vector<NameBlock> nameBlocks;
+   size_t count;
+   // Open-addressing table of interned names, null when empty.
+   std::vector<const char*> slots;
+   size_t interned;
+
+   static const size_t kNodesPerBlock = 1024;
+   static const size_t kNameBlockLen = 64 << 10;
+};
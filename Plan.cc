@@ -0,0 +1,967 @@
+/* file: Plan.cc
+ * -------------
+ * Saving, loading and running of plans, with the journal of a saved plan.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Plan.h"
+#include "CopyEngine.h"
+#include "Metrics.h"
+#include "ExternalSort.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+#include <utility>
+#include <stdexcept>
+#include <system_error>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// Files start with a magic then a version, which changes with the layout,
+// in host byte order like everything after them.
+static const char kMagic[8] = {'u', 'n', 'i', 'd', 'u', 'p', 'e', 'P'};
+static const char kJournalMagic[8] = {'u', 'n', 'i', 'd', 'u', 'p', 'e', 'J'};
+static const uint32_t kVersion = 1;
+static const size_t kHeaderLen = sizeof(kMagic) + sizeof(uint32_t);
+// Step index, with kDoneBit once done, and checksum.
+static const size_t kRecordLen = 2 * sizeof(uint32_t);
+static const uint32_t kDoneBit = 0x80000000u;
+// Steps recorded done at once, after one sync of the files they wrote.
+static const size_t kCommitEvery = 1024;
+// Bytes of two files compared at once when checking a step.
+static const size_t kCompareLen = 1 << 20;
+
+
+/* function: checksum
+ * ------------------
+ * FNV-1a, enough to tell a torn or garbled file or record. Continues from h
+ * when the data comes in parts.
+ */
+static uint32_t checksum(const unsigned char* data, size_t len,
+                         uint32_t h = 2166136261u) {
+   for (size_t i = 0; i < len; i++) {
+      h ^= data[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+/* function: writeAll
+ * ------------------
+ */
+static void writeAll(int fd, const unsigned char* data, size_t len, const string& path) {
+   size_t done = 0;
+   while (done < len) {
+      ssize_t n = ::write(fd, data + done, len - done);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         throw system_error(errno, system_category(), path);
+      done += n;
+   }
+}
+
+
+/* function: readAll
+ * -----------------
+ * Reads the rest of fd into buf.
+ */
+static void readAll(int fd, vector<unsigned char>& buf, const string& path) {
+   unsigned char chunk[1 << 16];
+   while (true) {
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         throw system_error(errno, system_category(), path);
+      if (n == 0)
+         return;
+      buf.insert(buf.end(), chunk, chunk + n);
+   }
+}
+
+
+/* function: putU32
+ * ----------------
+ */
+static void putU32(vector<unsigned char>& buf, uint32_t v) {
+   buf.insert(buf.end(), (unsigned char*)&v, (unsigned char*)&v + sizeof(v));
+}
+
+
+/* function: putStr
+ * ----------------
+ */
+static void putStr(vector<unsigned char>& buf, const string& s) {
+   putU32(buf, s.size());
+   buf.insert(buf.end(), s.begin(), s.end());
+}
+
+
+/* function: putStep
+ * -----------------
+ * As SpillFile::putStr lays strings out, for PlanWriter.
+ */
+static void putStep(vector<unsigned char>& buf, const string& op,
+                    const vector<string>& command) {
+   putStr(buf, op);
+   putU32(buf, command.size());
+   for (const string& arg : command)
+      putStr(buf, arg);
+}
+
+
+/* function: install
+ * -----------------
+ * Syncs and closes fd, open on tmp, and renames tmp over the plan file at
+ * path, which is either the old or the new plan after a crash. The old
+ * plan's journal goes with it.
+ */
+static void install(int fd, const string& tmp, const string& path) {
+   if (fsync(fd) < 0) {
+      int err = errno;
+      close(fd);
+      unlink(tmp.c_str());
+      throw system_error(err, system_category(), tmp);
+   }
+   close(fd);
+   if (rename(tmp.c_str(), path.c_str()) < 0)
+      throw system_error(errno, system_category(), path);
+   if (unlink(Plan::journalPath(path).c_str()) < 0 && errno != ENOENT)
+      throw system_error(errno, system_category(), Plan::journalPath(path));
+}
+
+
+// Reads back what putU32 and putStr wrote, throwing past the end.
+struct Reader {
+   const vector<unsigned char>& buf;
+   size_t pos;
+   const string& path;
+
+   uint32_t u32() {
+      uint32_t v;
+      need(sizeof(v));
+      memcpy(&v, buf.data() + pos, sizeof(v));
+      pos += sizeof(v);
+      return v;
+   }
+   string str() {
+      uint32_t len = u32();
+      need(len);
+      string s((const char*)buf.data() + pos, len);
+      pos += len;
+      return s;
+   }
+   void u32s(vector<uint32_t>& v, size_t count) {
+      need(count * sizeof(uint32_t)); // Before allocating a garbled count.
+      v.resize(count);
+      for (uint32_t& x : v)
+         x = u32();
+   }
+   void need(size_t len) {
+      if (len > buf.size() - pos)
+         throw runtime_error(path + " is a truncated plan file.");
+   }
+};
+
+
+// Progress of a saved plan: a header with the checksum of the plan, then a
+// record when a step starts and another once it is done.
+class Journal {
+  public:
+   // Loads the journal at path, or starts it over if it is missing, torn
+   // or from another plan.
+   Journal(const string& path, uint32_t planId, size_t steps);
+   ~Journal();
+   // As loaded, before this run.
+   bool isDone(uint32_t i) const { return state[i] == kDone; }
+   bool wasStarted(uint32_t i) const { return state[i] == kStarted; }
+   size_t doneBefore() const { return done; }
+   // Records step i started, at once.
+   void start(uint32_t i);
+   // Records step i done once the files in folder dir, and all other writes
+   // to its filesystem, are synced, along with others done about then.
+   void finish(uint32_t i, const string& dir);
+   // Records every step finished so far.
+   void commit();
+
+  private:
+   void append(const vector<uint32_t>& words);
+   void sync(const vector<uint32_t>& batch, const string& dir);
+
+   enum State : unsigned char { kNone, kStarted, kDone };
+   string path;
+   int fd;
+   vector<State> state;
+   size_t done;
+   mutex mtx; // For fd, pending and lastDir.
+   mutex syncMtx; // One batch synced at once.
+   vector<uint32_t> pending; // Finished, not yet recorded.
+   string lastDir;
+};
+
+
+/* function: Journal
+ * -----------------
+ */
+Journal::Journal(const string& p, uint32_t planId, size_t steps) :
+      path(p), fd(-1), state(steps, kNone), done(0) {
+   if (steps >= kDoneBit)
+      throw length_error("Too many steps in plan to journal.");
+   fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd < 0)
+      throw system_error(errno, system_category(), path);
+   vector<unsigned char> buf;
+   try {
+      readAll(fd, buf, path);
+   } catch (...) {
+      close(fd);
+      throw;
+   }
+   uint32_t id = 0;
+   if (buf.size() >= kHeaderLen)
+      memcpy(&id, buf.data() + sizeof(kJournalMagic), sizeof(id));
+   size_t pos = 0;
+   if (buf.size() >= kHeaderLen && id == planId &&
+       memcmp(buf.data(), kJournalMagic, sizeof(kJournalMagic)) == 0) {
+      for (pos = kHeaderLen; pos + kRecordLen <= buf.size(); pos += kRecordLen) {
+         uint32_t word, check;
+         memcpy(&word, buf.data() + pos, 4);
+         memcpy(&check, buf.data() + pos + 4, 4);
+         uint32_t i = word & ~kDoneBit;
+         if (check != checksum(buf.data() + pos, 4) || i >= steps)
+            break;
+         if (word & kDoneBit) {
+            if (state[i] != kDone)
+               done++;
+            state[i] = kDone;
+         } else if (state[i] != kDone) {
+            state[i] = kStarted;
+         }
+      }
+   }
+   // Appends go after the last whole record, over a torn one.
+   if (ftruncate(fd, pos) < 0 || lseek(fd, pos, SEEK_SET) < 0) {
+      close(fd);
+      throw system_error(errno, system_category(), path);
+   }
+   if (pos == 0) {
+      vector<unsigned char> header(kJournalMagic, kJournalMagic + sizeof(kJournalMagic));
+      putU32(header, planId);
+      try {
+         writeAll(fd, header.data(), header.size(), path);
+      } catch (...) {
+         close(fd);
+         throw;
+      }
+   }
+}
+
+
+/* function: ~Journal
+ * ------------------
+ */
+Journal::~Journal() {
+   try {
+      commit();
+   } catch (exception& e) {
+      cerr << "Error: " << e.what() << endl;
+   }
+   close(fd);
+}
+
+
+/* function: start
+ * ---------------
+ * Not synced: a start lost with a crash only means the step is run again
+ * without being checked first.
+ */
+void Journal::start(uint32_t i) {
+   append(vector<uint32_t>(1, i));
+}
+
+
+/* function: finish
+ * ----------------
+ */
+void Journal::finish(uint32_t i, const string& dir) {
+   vector<uint32_t> batch;
+   {
+      lock_guard<mutex> lk(mtx);
+      pending.push_back(i | kDoneBit);
+      lastDir = dir;
+      if (pending.size() < kCommitEvery)
+         return;
+      batch.swap(pending);
+   }
+   sync(batch, dir);
+}
+
+
+/* function: commit
+ * ----------------
+ */
+void Journal::commit() {
+   vector<uint32_t> batch;
+   string dir;
+   {
+      lock_guard<mutex> lk(mtx);
+      batch.swap(pending);
+      dir = lastDir;
+   }
+   if (!batch.empty())
+      sync(batch, dir);
+}
+
+
+/* function: sync
+ * --------------
+ * Steps are only recorded done once what they wrote is on disk, so they
+ * are not skipped after a power loss. The files of a plan are all synced
+ * at once by syncing the filesystem of the last folder written to, rather
+ * than each file.
+ */
+void Journal::sync(const vector<uint32_t>& batch, const string& dir) {
+   lock_guard<mutex> lk(syncMtx);
+   int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (dfd < 0 || syncfs(dfd) < 0)
+      ::sync();
+   if (dfd >= 0)
+      close(dfd);
+   append(batch);
+   if (fdatasync(fd) < 0)
+      throw system_error(errno, system_category(), path);
+}
+
+
+/* function: append
+ * ----------------
+ */
+void Journal::append(const vector<uint32_t>& words) {
+   vector<unsigned char> buf;
+   for (uint32_t word : words) {
+      unsigned char r[kRecordLen];
+      memcpy(r, &word, 4);
+      uint32_t check = checksum(r, 4);
+      memcpy(r + 4, &check, 4);
+      buf.insert(buf.end(), r, r + kRecordLen);
+   }
+   lock_guard<mutex> lk(mtx);
+   writeAll(fd, buf.data(), buf.size(), path);
+}
+
+
+/* function: targetOf
+ * ------------------
+ * Path step creates.
+ */
+static string targetOf(const EditStep& step) {
+   string dst = step.dst();
+   if (step.op == "cp" || step.op == "tree") {
+      string src = step.src();
+      size_t slash = src.find_last_of('/');
+      dst += "/" + src.substr(slash == string::npos ? 0 : slash + 1);
+   }
+   return dst;
+}
+
+
+/* function: folderOf
+ * ------------------
+ * Folder step writes in.
+ */
+static string folderOf(const EditStep& step) {
+   if (step.op == "mkdir" || step.op == "cp" || step.op == "tree")
+      return step.dst();
+   string dst = step.dst();
+   size_t slash = dst.find_last_of('/');
+   return (slash == string::npos) ? "." : dst.substr(0, max(slash, (size_t)1));
+}
+
+
+/* function: sameContents
+ * ----------------------
+ */
+static bool sameContents(const string& path1, const string& path2) {
+   int fd1 = open(path1.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd1 < 0)
+      return false;
+   int fd2 = open(path2.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd2 < 0) {
+      close(fd1);
+      return false;
+   }
+   vector<char> buf1(kCompareLen), buf2(kCompareLen);
+   bool same = true;
+   while (same) {
+      ssize_t n1 = read(fd1, buf1.data(), kCompareLen);
+      ssize_t n2 = (n1 < 0) ? -1 : read(fd2, buf2.data(), kCompareLen);
+      if (n1 < 0 || n2 < 0) {
+         same = false; // Checked again by running the step.
+      } else if (n1 == 0 || n2 == 0) {
+         same = (n1 == n2);
+         break;
+      } else {
+         // Short reads of regular files only happen at their end.
+         same = (n1 == n2 && memcmp(buf1.data(), buf2.data(), n1) == 0);
+      }
+   }
+   close(fd1);
+   close(fd2);
+   return same;
+}
+
+
+/* function: sameTree
+ * ------------------
+ * Whether every entry under the folder src, links followed, is under the
+ * folder dst with the same contents.
+ */
+static bool sameTree(const string& src, const string& dst) {
+   DIR* dir = opendir(src.c_str());
+   if (dir == nullptr)
+      return false;
+   vector<string> names;
+   while (struct dirent* ent = readdir(dir)) {
+      if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+         names.push_back(ent->d_name);
+   }
+   closedir(dir);
+   for (const string& name : names) {
+      string from = src + "/" + name, to = dst + "/" + name;
+      struct stat src_st, dst_st;
+      if (stat(from.c_str(), &src_st) < 0 || lstat(to.c_str(), &dst_st) < 0)
+         return false;
+      if (S_ISDIR(src_st.st_mode) ? !S_ISDIR(dst_st.st_mode) || !sameTree(from, to)
+                                  : !S_ISREG(dst_st.st_mode) ||
+                                    dst_st.st_size != src_st.st_size ||
+                                    !sameContents(from, to))
+         return false;
+   }
+   return true;
+}
+
+
+/* function: alreadyDone
+ * ---------------------
+ * Whether a step interrupted in an earlier run got as far as making what it
+ * makes. A step which did not is run again, which moves aside a file it
+ * left half written, as any file in its way.
+ */
+static bool alreadyDone(const EditStep& step) {
+   string dst = targetOf(step);
+   struct stat dst_st, src_st;
+   if (lstat(dst.c_str(), &dst_st) < 0)
+      return false;
+   if (step.op == "mkdir")
+      return S_ISDIR(dst_st.st_mode);
+   if (step.op == "tree")
+      return S_ISDIR(dst_st.st_mode) && sameTree(step.src(), dst);
+   if (lstat(step.src(), &src_st) < 0)
+      return step.op == "mv" && errno == ENOENT;
+   if (step.op == "mv")
+      return false;
+   if (src_st.st_dev == dst_st.st_dev && src_st.st_ino == dst_st.st_ino)
+      return step.op == "link";
+   return S_ISREG(dst_st.st_mode) && dst_st.st_size == src_st.st_size &&
+          sameContents(step.src(), dst);
+}
+
+
+/* function: bytesCopied
+ * -----------------------
+ * Bytes a step run by a command copied, as far as can be told from here:
+ * the size of the file it copies.
+ */
+static size_t bytesCopied(const EditStep& step) {
+   struct stat st;
+   if (step.op == "mkdir" || step.op == "link" || step.op == "mv" ||
+       step.op == "tree" || stat(step.src(), &st) < 0)
+      return 0;
+   return st.st_size;
+}
+
+
+/* class: FolderDevices
+ * ---------------------
+ * Device of each folder steps read from or write in, looked up once per
+ * folder rather than once per step. A folder not made yet is on the device
+ * of the nearest folder above it which exists already.
+ */
+class FolderDevices {
+  public:
+   // Devices step reads from and writes to. Those which only write in a
+   // folder read from it too.
+   pair<dev_t, dev_t> operator()(const EditStep& step) {
+      dev_t to = of(folderOf(step));
+      if (step.op == "mkdir" || step.op == "link" || step.op == "mv")
+         return make_pair(to, to);
+      string src = step.src();
+      size_t slash = src.find_last_of('/');
+      if (step.op != "tree")
+         src = (slash == string::npos) ? "." : src.substr(0, max(slash, (size_t)1));
+      return make_pair(of(src), to);
+   }
+
+  private:
+   dev_t of(const string& folder) {
+      lock_guard<mutex> lk(mtx);
+      unordered_map<string, dev_t>::iterator it = devices.find(folder);
+      if (it != devices.end())
+         return it->second;
+      struct stat st;
+      string dir = folder;
+      while (stat(dir.c_str(), &st) < 0) {
+         size_t slash = dir.find_last_of('/');
+         if (dir == "/" || dir == ".")
+            return devices[folder] = 0;
+         dir = (slash == string::npos) ? "." : dir.substr(0, max(slash, (size_t)1));
+      }
+      return devices[folder] = st.st_dev;
+   }
+
+   mutex mtx;
+   unordered_map<string, dev_t> devices;
+};
+
+
+/* function: runInProcess
+ * ------------------------
+ */
+static void runInProcess(const EditStep& step, CopyEngine& engine) {
+   if (step.op == "mkdir")
+      engine.mkdir(step.dst());
+   else if (step.op == "cp")
+      engine.copy(step.src(), step.dst());
+   else if (step.op == "tree")
+      engine.copyTree(step.src(), step.dst());
+   else if (step.op == "link")
+      engine.link(step.src(), step.dst());
+   else if (step.op == "mv")
+      engine.move(step.src(), step.dst());
+   else // reflink clones where it can, pool keeps an existing copy.
+      engine.copyTo(step.src(), step.dst(), step.op == "pool");
+}
+
+
+/* function: runCommand
+ * --------------------
+ *  Runs the command of step in a child process and waits for it, so no
+ *  signal handler is needed.
+ */
+static void runCommand(const EditStep& step) {
+   pid_t pid;
+   int err = posix_spawnp(&pid, step.com[0], nullptr, nullptr, step.com, environ);
+   if (err != 0)
+      throw system_error(err, system_category(), step.com[0]);
+   int status;
+   while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR)
+         throw system_error(errno, system_category(), step.com[0]);
+   }
+   if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      throw runtime_error(string(step.com[0]) + " failed on " + step.dst());
+}
+
+
+/* function: Plan
+ * --------------
+ */
+Plan::Plan(const vector<EditStep>& s) : steps(s), graph(new StepGraph(steps)), id(0) {}
+
+
+/* function: Plan
+ * --------------
+ * The whole file is read and checked before any of it is used.
+ */
+Plan::Plan(const string& p) : path(p), id(0) {
+   int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      throw system_error(errno, system_category(), path);
+   vector<unsigned char> buf;
+   try {
+      readAll(fd, buf, path);
+   } catch (...) {
+      close(fd);
+      throw;
+   }
+   close(fd);
+   uint32_t version = 0;
+   if (buf.size() >= kHeaderLen)
+      memcpy(&version, buf.data() + sizeof(kMagic), sizeof(version));
+   if (buf.size() < kHeaderLen + sizeof(uint32_t) ||
+       memcmp(buf.data(), kMagic, sizeof(kMagic)) != 0 || version != kVersion)
+      throw runtime_error(path + " is not a plan file of this version.");
+   memcpy(&id, buf.data() + buf.size() - sizeof(id), sizeof(id));
+   if (id != checksum(buf.data(), buf.size() - sizeof(id)))
+      throw runtime_error(path + " is a corrupt plan file.");
+   buf.resize(buf.size() - sizeof(id));
+
+   Reader in{buf, kHeaderLen, path};
+   uint32_t n = in.u32();
+   uint32_t edges = in.u32();
+   in.need((size_t)n * 2 * sizeof(uint32_t));
+   steps.reserve(n);
+   vector<string> command;
+   for (uint32_t i = 0; i < n; i++) {
+      string op = in.str();
+      command.resize(in.u32());
+      if (command.size() >= UNIDUPE_MAX_ARGS)
+         throw runtime_error(path + " is a corrupt plan file.");
+      for (string& arg : command)
+         arg = in.str();
+      try {
+         steps.push_back(EditStep(op, command));
+      } catch (invalid_argument& e) {
+         throw runtime_error(path + " is a corrupt plan file: " + e.what());
+      }
+   }
+   vector<uint32_t> first, deps, counts;
+   in.u32s(first, (size_t)n + 1);
+   in.u32s(deps, edges);
+   in.u32s(counts, n);
+   if (in.pos != buf.size())
+      throw runtime_error(path + " is a corrupt plan file.");
+   try {
+      graph.reset(new StepGraph(steps, move(first), move(deps), move(counts)));
+   } catch (invalid_argument& e) {
+      throw runtime_error(path + " is a corrupt plan file: " + e.what());
+   }
+}
+
+
+/* function: journalPath
+ * ---------------------
+ */
+string Plan::journalPath(const string& path) {
+   return path + ".journal";
+}
+
+
+/* function: save
+ * --------------
+ * Written aside, then installed.
+ */
+void Plan::save(const string& p) {
+   vector<unsigned char> buf(kMagic, kMagic + sizeof(kMagic));
+   putU32(buf, kVersion);
+   const vector<uint32_t>& first = graph->getFirstDependent();
+   const vector<uint32_t>& deps = graph->getDependents();
+   const vector<uint32_t>& counts = graph->getDependencies();
+   putU32(buf, steps.size());
+   putU32(buf, deps.size());
+   vector<string> command;
+   for (const EditStep& step : steps) {
+      command.clear();
+      for (int a = 0; a < UNIDUPE_MAX_ARGS && step.com[a] != nullptr; a++)
+         command.push_back(step.com[a]);
+      putStep(buf, step.op, command);
+   }
+   for (uint32_t v : first)
+      putU32(buf, v);
+   for (uint32_t v : deps)
+      putU32(buf, v);
+   for (uint32_t v : counts)
+      putU32(buf, v);
+   uint32_t check = checksum(buf.data(), buf.size());
+   putU32(buf, check);
+
+   string tmp = p + ".tmp";
+   int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      throw system_error(errno, system_category(), tmp);
+   try {
+      writeAll(fd, buf.data(), buf.size(), tmp);
+   } catch (...) {
+      close(fd);
+      unlink(tmp.c_str());
+      throw;
+   }
+   install(fd, tmp, p);
+   path = p;
+   id = check;
+}
+
+
+/* function: run
+ * -------------
+ *  Steps run as soon as the steps they depend on are done, so a step's
+ *  folder exists by the time it runs unless the plan creates it later.
+ *  Copies from each input device run apart from each other, so one slow
+ *  disk does not hold the copies from another, and each also holds a slot
+ *  of the output device, so writes there are bounded and tuned as well.
+ */
+void Plan::run(unsigned jobs, bool forkCommands, bool journaled) {
+   if (journaled && path.empty())
+      throw logic_error("Plan::run(): only a saved plan can be journaled.");
+   cout << "Tform!" << endl;
+   Metrics::Phase phase("exec");
+   Metrics& metrics = Metrics::get();
+   unique_ptr<Journal> journal;
+   if (journaled) {
+      journal.reset(new Journal(journalPath(path), id, steps.size()));
+      if (journal->doneBefore() > 0)
+         cout << journal->doneBefore() << " of " << steps.size()
+              << " steps done in an earlier run." << endl;
+   }
+   metrics.add(Metrics::kStepsQueued,
+               steps.size() - (journal ? journal->doneBefore() : 0));
+   vector<CopyEngine> engines(jobs);
+   atomic<size_t> failed(0), found(0);
+   mutex errMtx;
+   vector<IoScheduler::DeviceStats> devices;
+   FolderDevices folderDevices;
+   graph->run(jobs, [&](const EditStep& step, unsigned worker) -> uint64_t {
+      uint32_t i = &step - steps.data();
+      size_t copied = 0;
+      try {
+         if (journal) {
+            if (journal->isDone(i))
+               return 0;
+            if (journal->wasStarted(i) && alreadyDone(step)) {
+               found++;
+               metrics.add(Metrics::kStepsDone);
+               journal->finish(i, folderOf(step));
+               return 0;
+            }
+            journal->start(i);
+         }
+         if (forkCommands) {
+            runCommand(step);
+            copied = bytesCopied(step);
+         } else {
+            copied = engines[worker].bytesCopied();
+            runInProcess(step, engines[worker]);
+            copied = engines[worker].bytesCopied() - copied;
+         }
+         metrics.add(Metrics::kBytesCopied, copied);
+         if (journal)
+            journal->finish(i, folderOf(step));
+         metrics.add(Metrics::kStepsDone);
+      } catch (exception& e) {
+         lock_guard<mutex> lk(errMtx);
+         cerr << "Error: " << e.what() << endl;
+         failed++;
+         metrics.add(Metrics::kStepsFailed);
+         copied = 0;
+      }
+      return copied;
+   }, ref(folderDevices), &devices);
+   if (journal)
+      journal->commit();
+   if (found > 0)
+      cout << found << " interrupted steps found done." << endl;
+   for (unsigned m = 0; m < CopyEngine::kMethods; m++) {
+      CopyEngine::Method method = (CopyEngine::Method)m;
+      size_t count = 0;
+      for (CopyEngine& engine : engines)
+         count += engine.count(method);
+      if (count > 0)
+         cout << count << " files "
+              << (method == CopyEngine::kLink ? "made by " :
+                  method == CopyEngine::kMove ? "moved by " : "copied by ")
+              << CopyEngine::name(method) << endl;
+   }
+   // Devices are only worth telling apart when several were used.
+   devices.erase(remove_if(devices.begin(), devices.end(),
+                           [](const IoScheduler::DeviceStats& d) { return d.bytes == 0; }),
+                 devices.end());
+   if (devices.size() > 1) {
+      for (const IoScheduler::DeviceStats& d : devices) {
+         double mib = d.bytes / double(1 << 20);
+         cout << "Device " << major(d.dev) << ":" << minor(d.dev) << ": " << d.items
+              << " steps, " << fixed << setprecision(1) << mib << " MiB";
+         if (d.secs > 0)
+            cout << " at " << mib / d.secs << " MiB/s";
+         cout << defaultfloat << ", up to " << d.peak << " at once" << endl;
+      }
+   }
+   if (failed > 0)
+      cerr << failed << " steps failed." << endl;
+}
+
+
+// Step from must be done before step to runs.
+struct PlanWriter::Edge {
+   uint32_t from;
+   uint32_t to;
+
+   bool operator<(const Edge& o) const {
+      return from != o.from ? from < o.from : to < o.to;
+   }
+   void save(SpillFile& f) const { f.write(this, sizeof(*this)); }
+   bool load(SpillFile& f) { return f.read(this, sizeof(*this)); }
+   size_t heapBytes() const { return 0; }
+};
+
+struct PlanWriter::EdgeSort : ExternalSort<Edge> {
+   using ExternalSort<Edge>::ExternalSort;
+};
+
+
+/* function: PlanWriter
+ * --------------------
+ */
+PlanWriter::PlanWriter(const string& d, size_t b) :
+      dir(d), budget(b), steps(d), edges(new EdgeSort(d, b)), count(0) {}
+
+
+/* function: ~PlanWriter
+ * ---------------------
+ */
+PlanWriter::~PlanWriter() {}
+
+
+/* function: add
+ * -------------
+ */
+uint32_t PlanWriter::add(const string& op, const string& src, const string& dst) {
+   if (count == UINT32_MAX)
+      throw length_error("Too many steps in plan.");
+   vector<string> command = EditStep::command(op, src, dst);
+   steps.putStr(op);
+   steps.putU32(command.size());
+   for (const string& arg : command)
+      steps.putStr(arg);
+   return count++;
+}
+
+
+/* function: depend
+ * ----------------
+ */
+void PlanWriter::depend(uint32_t from, uint32_t to) {
+   if (from >= count || to >= count)
+      throw out_of_range("PlanWriter::depend(): no such step.");
+   edges->push(Edge{from, to});
+}
+
+
+// Plan file being written a part at a time, with the checksum of what was
+// written so far.
+struct PlanOut {
+   int fd;
+   const string& path;
+   vector<unsigned char> buf;
+   uint32_t sum;
+
+   PlanOut(int fd, const string& path) : fd(fd), path(path), sum(checksum(nullptr, 0)) {}
+   void put(const void* data, size_t len) {
+      const unsigned char* p = (const unsigned char*)data;
+      sum = checksum(p, len, sum);
+      buf.insert(buf.end(), p, p + len);
+      if (buf.size() >= SpillFile::kBufLen)
+         flush();
+   }
+   void u32(uint32_t v) { put(&v, sizeof(v)); }
+   void flush() {
+      writeAll(fd, buf.data(), buf.size(), path);
+      buf.clear();
+   }
+};
+
+
+/* function: save
+ * --------------
+ *  The layout of the graph comes from the dependencies sorted by step
+ *  depended on, and again by dependent for the count of each step, so only
+ *  buffers are held whatever the size of the plan.
+ */
+void PlanWriter::save(const string& p) {
+   edges->finish();
+   // Dependents by step, then count of each step.
+   SpillFile first(dir), deps(dir);
+   ExternalSort<Edge> byTo(dir, budget);
+   uint32_t from = 0;
+   uint64_t edgeCount = 0;
+   first.putU32(0);
+   Edge edge;
+   while (edges->next(edge)) {
+      for (; from < edge.from; from++)
+         first.putU32(edgeCount);
+      deps.putU32(edge.to);
+      edgeCount++;
+      byTo.push(Edge{edge.to, edge.from});
+   }
+   for (; from < count; from++)
+      first.putU32(edgeCount);
+   if (edgeCount > UINT32_MAX)
+      throw length_error("Too many dependencies in plan.");
+   byTo.finish();
+
+   string tmp = p + ".tmp";
+   int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      throw system_error(errno, system_category(), tmp);
+   try {
+      PlanOut out(fd, tmp);
+      out.put(kMagic, sizeof(kMagic));
+      out.u32(kVersion);
+      out.u32(count);
+      out.u32(edgeCount);
+      SpillFile* parts[] = {&steps, &first, &deps};
+      vector<unsigned char> chunk(1 << 16);
+      for (SpillFile* part : parts) {
+         part->rewind();
+         for (uint64_t left = part->size(); left > 0; ) {
+            size_t len = min<uint64_t>(left, chunk.size());
+            part->read(chunk.data(), len);
+            out.put(chunk.data(), len);
+            left -= len;
+         }
+      }
+      bool more = byTo.next(edge);
+      for (uint32_t i = 0; i < count; i++) {
+         uint32_t n = 0;
+         for (; more && edge.from == i; more = byTo.next(edge))
+            n++;
+         out.u32(n);
+      }
+      uint32_t check = out.sum;
+      out.u32(check);
+      out.flush();
+   } catch (...) {
+      close(fd);
+      unlink(tmp.c_str());
+      throw;
+   }
+   install(fd, tmp, p);
+}
@@ -0,0 +1,101 @@
+/* file: Plan.h
+ * ------------
+ * The steps of a plan and the order they must run in, built from a planned
+ * tree or loaded from a plan file, so a plan can be run later, elsewhere,
+ * or again after being interrupted. A plan file is a header, the command of
+ * every step, the layout of its StepGraph and a checksum of all of it.
+ * Running a saved plan appends to a journal next to it the steps started
+ * and, once their writes are synced, the steps done. A run resumed from the
+ * journal skips steps done, and checks steps started but not recorded done
+ * before running them again. A plan too large to hold is written a step at
+ * a time by PlanWriter.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "EditStep.h"
+#include "StepGraph.h"
+#include "SpillFile.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+class Plan {
+  public:
+   // Plan of steps, in plan order.
+   explicit Plan(const std::vector<EditStep>& steps);
+   // Loads the plan saved at path. Throws runtime_error if the file is not
+   // a plan or is corrupt.
+   explicit Plan(const std::string& path);
+   Plan(const Plan&) = delete;
+   Plan& operator=(const Plan&) = delete;
+   // Writes the plan to path, replacing the file there and its journal.
+   void save(const std::string& path);
+   // Runs every step on jobs threads, each after those it depends on, in
+   // this process or, with forkCommands, by cp, ln, mv and mkdir processes.
+   // A step which fails is reported and does not stop the others. With
+   // journaled, the plan must be saved or loaded, and its progress is kept
+   // in its journal: steps done in an earlier run are skipped.
+   void run(unsigned jobs, bool forkCommands = false, bool journaled = false);
+   size_t size() const { return steps.size(); }
+   // Journal of the plan file at path.
+   static std::string journalPath(const std::string& path);
+
+  private:
+   std::vector<EditStep> steps;
+   std::unique_ptr<StepGraph> graph;
+   std::string path; // Of the plan file, empty until saved or loaded.
+   uint32_t id; // Checksum of the plan file, to tell its journal.
+};
+
+// Writes a plan file a step at a time, for plans too large to hold, see
+// ExternalMerge. Steps and the order they must run in are spilled to files
+// until the plan is saved.
+class PlanWriter {
+  public:
+   // Spills to files in dir, holding up to budget bytes of dependencies.
+   PlanWriter(const std::string& dir, size_t budget);
+   ~PlanWriter();
+   // Adds a step of op from src to dst, see EditStep::command, and returns
+   // its index.
+   uint32_t add(const std::string& op, const std::string& src,
+                const std::string& dst);
+   // Makes step to run only once step from is done.
+   void depend(uint32_t from, uint32_t to);
+   size_t size() const { return count; }
+   // Writes the plan to path as Plan::save does, for Plan to load.
+   void save(const std::string& path);
+
+  private:
+   struct Edge;
+   struct EdgeSort;
+
+   std::string dir;
+   size_t budget;
+   SpillFile steps; // As laid out in the plan file.
+   std::unique_ptr<EdgeSort> edges; // By step depended on.
+   uint32_t count;
+};
@@ -0,0 +1,211 @@
+/* file: SpillFile.cc
+ * ------------------
+ * Buffered sequential I/O on an unnamed temporary file.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "SpillFile.h"
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+const size_t SpillFile::kBufLen;
+
+
+/* function: SpillFile
+ * -------------------
+ *  Falls back to a named file removed at once where O_TMPFILE is not
+ *  supported.
+ */
+SpillFile::SpillFile(const string& d) : fd(-1), dir(d), pos(0), end(0),
+                                        len(0), reading(false) {
+#ifdef O_TMPFILE
+   fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+   if (fd < 0) {
+      string tmpl = dir + "/.unidupe_spill.XXXXXX";
+      vector<char> name(tmpl.begin(), tmpl.end());
+      name.push_back('\0');
+      fd = mkostemp(name.data(), O_CLOEXEC);
+      if (fd < 0)
+         throw system_error(errno, system_category(), dir);
+      unlink(name.data());
+   }
+}
+
+
+/* function: SpillFile
+ * -------------------
+ */
+SpillFile::SpillFile(SpillFile&& o) : fd(o.fd), dir(move(o.dir)),
+      buf(move(o.buf)), pos(o.pos), end(o.end), len(o.len), reading(o.reading) {
+   o.fd = -1;
+}
+
+
+/* function: operator=
+ * -------------------
+ */
+SpillFile& SpillFile::operator=(SpillFile&& o) {
+   if (this != &o) {
+      if (fd >= 0)
+         close(fd);
+      fd = o.fd;
+      o.fd = -1;
+      dir = move(o.dir);
+      buf = move(o.buf);
+      pos = o.pos;
+      end = o.end;
+      len = o.len;
+      reading = o.reading;
+   }
+   return *this;
+}
+
+
+/* function: ~SpillFile
+ * --------------------
+ */
+SpillFile::~SpillFile() {
+   if (fd >= 0)
+      close(fd);
+}
+
+
+/* function: write
+ * ---------------
+ */
+void SpillFile::write(const void* data, size_t n) {
+   if (reading)
+      throw logic_error("SpillFile::write(): file is being read.");
+   const char* p = (const char*)data;
+   if (buf.empty())
+      buf.resize(kBufLen);
+   len += n;
+   while (n > 0) {
+      size_t part = min(n, buf.size() - pos);
+      memcpy(buf.data() + pos, p, part);
+      pos += part;
+      p += part;
+      n -= part;
+      if (pos == buf.size())
+         flush();
+   }
+}
+
+
+/* function: putStr
+ * ----------------
+ */
+void SpillFile::putStr(const string& s) {
+   putU32(s.size());
+   write(s.data(), s.size());
+}
+
+
+/* function: flush
+ * ---------------
+ */
+void SpillFile::flush() {
+   size_t done = 0;
+   while (done < pos) {
+      ssize_t n = ::write(fd, buf.data() + done, pos - done);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         throw system_error(errno, system_category(), "spill file in " + dir);
+      done += n;
+   }
+   pos = 0;
+}
+
+
+/* function: rewind
+ * ----------------
+ */
+void SpillFile::rewind() {
+   if (!reading && pos > 0)
+      flush();
+   buf = vector<char>();
+   if (lseek(fd, 0, SEEK_SET) < 0)
+      throw system_error(errno, system_category(), "spill file in " + dir);
+   reading = true;
+   pos = end = 0;
+}
+
+
+/* function: read
+ * --------------
+ */
+bool SpillFile::read(void* data, size_t n) {
+   if (!reading)
+      throw logic_error("SpillFile::read(): file is being written.");
+   char* p = (char*)data;
+   if (buf.empty())
+      buf.resize(kBufLen);
+   size_t got = 0;
+   while (got < n) {
+      if (pos == end) {
+         ssize_t r = ::read(fd, buf.data(), buf.size());
+         if (r < 0 && errno == EINTR)
+            continue;
+         if (r < 0)
+            throw system_error(errno, system_category(), "spill file in " + dir);
+         if (r == 0) {
+            if (got == 0)
+               return false;
+            throw runtime_error("Spill file in " + dir + " ends within a record.");
+         }
+         pos = 0;
+         end = r;
+      }
+      size_t part = min(n - got, end - pos);
+      memcpy(p + got, buf.data() + pos, part);
+      pos += part;
+      got += part;
+   }
+   return true;
+}
+
+
+/* function: getStr
+ * ----------------
+ */
+bool SpillFile::getStr(string& s) {
+   uint32_t n;
+   if (!getU32(n))
+      return false;
+   s.resize(n);
+   if (n > 0 && !read(&s[0], n))
+      throw runtime_error("Spill file in " + dir + " ends within a record.");
+   return true;
+}
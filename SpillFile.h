@@ -0,0 +1,76 @@
+/* file: SpillFile.h
+ * -----------------
+ * Anonymous file holding records which do not fit in memory, written in
+ * order then read back in order through a fixed buffer. Used by
+ * ExternalSort and ExternalMerge.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class SpillFile {
+  public:
+   // Creates the file in the folder dir. It has no name, so it is gone once
+   // closed, even after a crash.
+   explicit SpillFile(const std::string& dir);
+   SpillFile(SpillFile&& other);
+   SpillFile& operator=(SpillFile&& other);
+   SpillFile(const SpillFile&) = delete;
+   SpillFile& operator=(const SpillFile&) = delete;
+   ~SpillFile();
+   // Appends len bytes. Only before rewind.
+   void write(const void* data, size_t len);
+   void putU32(uint32_t v) { write(&v, sizeof(v)); }
+   void putStr(const std::string& s);
+   // Ends writing, and starts reading from the beginning. May be called
+   // again to read the file again. Frees the buffer until the next read.
+   void rewind();
+   // Reads the next len bytes. False at the end of the file, throws
+   // runtime_error if it ends within them.
+   bool read(void* data, size_t len);
+   bool getU32(uint32_t& v) { return read(&v, sizeof(v)); }
+   bool getStr(std::string& s);
+   // Bytes written.
+   uint64_t size() const { return len; }
+
+   // Bytes buffered by each file being written or read.
+   static const size_t kBufLen = 256 << 10;
+
+  private:
+   // Writes what is buffered.
+   void flush();
+
+   int fd;
+   std::string dir; // For errors.
+   std::vector<char> buf; // Empty until used.
+   size_t pos; // Next byte of buf to fill or to read.
+   size_t end; // Bytes of buf read from the file.
+   uint64_t len;
+   bool reading;
+};
@@ -0,0 +1,227 @@
+/* file: StepGraph.cc
+ * ------------------
+ * Dependencies between the EditSteps of a plan, run through an IoScheduler.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "StepGraph.h"
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+static const uint32_t kNone = UINT32_MAX;
+
+
+/* function: touches
+ * -----------------
+ * Paths step creates, replaces or, for mv, vacates.
+ */
+static void touches(const EditStep& step, vector<string>& paths) {
+   paths.clear();
+   string dst = step.dst();
+   if (step.op == "cp" || step.op == "tree") {
+      string src = step.src();
+      size_t slash = src.find_last_of('/');
+      dst += "/" + src.substr(slash == string::npos ? 0 : slash + 1);
+   } else if (step.op == "mv") {
+      paths.push_back(step.src());
+   }
+   paths.push_back(dst);
+}
+
+
+/* function: StepGraph
+ * -------------------
+ * Steps are linked to the steps creating the nodes they wait on in a first
+ * pass, since a node may be created later in the plan than it is waited on.
+ */
+StepGraph::StepGraph(const vector<EditStep>& steps) :
+      steps(steps), dependencies(steps.size(), 0) {
+   if (steps.size() >= kNone)
+      throw length_error("Too many steps in plan.");
+   uint32_t n = steps.size();
+   // Steps acting on the same node, chained from the last one.
+   unordered_map<const FsNode*, uint32_t> lastActing;
+   vector<uint32_t> prevActing(n, kNone);
+   for (uint32_t i = 0; i < n; i++) {
+      pair<unordered_map<const FsNode*, uint32_t>::iterator, bool> last =
+         lastActing.insert(make_pair(steps[i].acting, i));
+      if (!last.second) {
+         prevActing[i] = last.first->second;
+         last.first->second = i;
+      }
+   }
+
+   vector<pair<uint32_t, uint32_t>> edges; // From a step to a dependent.
+   unordered_map<string, uint32_t> lastWriter;
+   vector<string> paths;
+   for (uint32_t i = 0; i < n; i++) {
+      for (const FsNode* nd : steps[i].waitsOn) {
+         if (nd == nullptr)
+            continue;
+         unordered_map<const FsNode*, uint32_t>::iterator last = lastActing.find(nd);
+         if (last == lastActing.end()) {
+            // Nodes of an earlier output exist already.
+            if (!nd->inBase)
+               dependencies[i]++; // Held until run() runs it regardless.
+            continue;
+         }
+         for (uint32_t from = last->second; from != kNone; from = prevActing[from]) {
+            if (from != i)
+               edges.push_back(make_pair(from, i));
+         }
+      }
+      touches(steps[i], paths);
+      for (string& path : paths) {
+         pair<unordered_map<string, uint32_t>::iterator, bool> writer =
+            lastWriter.insert(make_pair(path, i));
+         if (!writer.second) {
+            edges.push_back(make_pair(writer.first->second, i));
+            writer.first->second = i;
+         }
+      }
+   }
+
+   // Lay out dependents by step.
+   firstDependent.assign(n + 1, 0);
+   for (pair<uint32_t, uint32_t>& edge : edges) {
+      firstDependent[edge.first + 1]++;
+      dependencies[edge.second]++;
+   }
+   for (uint32_t i = 0; i < n; i++)
+      firstDependent[i + 1] += firstDependent[i];
+   dependents.resize(edges.size());
+   vector<uint32_t> next(firstDependent.begin(), firstDependent.end() - 1);
+   for (pair<uint32_t, uint32_t>& edge : edges)
+      dependents[next[edge.first]++] = edge.second;
+}
+
+
+/* function: StepGraph
+ * -------------------
+ */
+StepGraph::StepGraph(const vector<EditStep>& steps, vector<uint32_t> first,
+                     vector<uint32_t> deps, vector<uint32_t> counts) :
+      steps(steps), firstDependent(move(first)), dependents(move(deps)),
+      dependencies(move(counts)) {
+   uint32_t n = steps.size();
+   if (firstDependent.size() != (size_t)n + 1 || dependencies.size() != n ||
+       firstDependent[n] != dependents.size())
+      throw invalid_argument("StepGraph: layout does not match steps.");
+   for (uint32_t i = 0; i < n; i++) {
+      if (firstDependent[i] > firstDependent[i + 1])
+         throw invalid_argument("StepGraph: layout does not match steps.");
+   }
+   for (uint32_t d : dependents) {
+      if (d >= n)
+         throw invalid_argument("StepGraph: layout does not match steps.");
+   }
+}
+
+
+/* function: run
+ * -------------
+ * A step is claimed when it starts, so one released by its dependencies
+ * after being run regardless is not run twice. Without deviceOf, all steps
+ * share one device with a slot per thread, as on a plain pool.
+ */
+void StepGraph::run(unsigned threads, const Runner& runner, const DeviceOf& deviceOf,
+                    vector<IoScheduler::DeviceStats>* stats) {
+   uint32_t n = steps.size();
+   vector<atomic<uint32_t>> waiting(n);
+   vector<atomic<bool>> started(n);
+   for (uint32_t i = 0; i < n; i++) {
+      waiting[i] = dependencies[i];
+      started[i] = false;
+   }
+   threads = max(threads, 1u);
+   IoScheduler sched(threads, bool(deviceOf));
+   auto push = [&](uint32_t i) {
+      pair<dev_t, dev_t> devs = deviceOf ? deviceOf(steps[i]) : make_pair(dev_t(0), dev_t(0));
+      sched.push(i, devs.first, devs.second);
+   };
+   mutex errMtx;
+   exception_ptr error;
+   auto work = [&](unsigned w) {
+      uint32_t i;
+      dev_t from, to;
+      while (sched.take(i, from, to)) {
+         uint64_t bytes = 0;
+         try {
+            if (!started[i].exchange(true)) {
+               bytes = runner(steps[i], w);
+               for (uint32_t d = firstDependent[i]; d < firstDependent[i + 1]; d++) {
+                  if (--waiting[dependents[d]] == 0)
+                     push(dependents[d]);
+               }
+            }
+         } catch (...) {
+            lock_guard<mutex> lk(errMtx);
+            if (!error)
+               error = current_exception();
+            sched.abort();
+         }
+         sched.done(from, to, bytes);
+      }
+   };
+   // The calling thread only releases held steps, once the workers are idle.
+   vector<thread> workers;
+   for (unsigned w = 0; w < threads; w++)
+      workers.emplace_back(work, w);
+   try {
+      for (uint32_t i = 0; i < n; i++) {
+         if (dependencies[i] == 0)
+            push(i);
+      }
+      sched.wait();
+      // Only held steps are left.
+      for (uint32_t i = 0; i < n; i++) {
+         if (!started[i]) {
+            push(i);
+            sched.wait();
+         }
+      }
+   } catch (...) {
+      lock_guard<mutex> lk(errMtx);
+      if (!error)
+         error = current_exception();
+      sched.abort();
+   }
+   sched.close();
+   for (thread& t : workers)
+      t.join();
+   if (error)
+      rethrow_exception(error);
+   if (stats)
+      *stats = sched.stats();
+}
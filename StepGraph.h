@@ -0,0 +1,80 @@
+/* file: StepGraph.h
+ * -----------------
+ * Dependencies between the EditSteps of a plan, run through an IoScheduler
+ * so the steps of each device run as many at a time as it serves best. A step
+ * waits on the steps creating the nodes it waits on, such as the mkdir of
+ * its folder, and on the previous step writing the same path, so numbered
+ * backups are made in plan order. Nodes of an earlier output merged into
+ * need no step. Each step counts the steps it still waits on, and is
+ * queued the moment the last of them is done.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "EditStep.h"
+#include "IoScheduler.h"
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <utility>
+#include <sys/types.h>
+
+class StepGraph {
+  public:
+   // Called with a step and the index of the worker running it. Returns
+   // the bytes the step moved.
+   typedef std::function<uint64_t(const EditStep&, unsigned)> Runner;
+   // Devices a step reads from and writes to.
+   typedef std::function<std::pair<dev_t, dev_t>(const EditStep&)> DeviceOf;
+
+   // steps must outlive the graph.
+   explicit StepGraph(const std::vector<EditStep>& steps);
+   // Graph of steps as laid out by another, such as one saved with a plan.
+   StepGraph(const std::vector<EditStep>& steps,
+             std::vector<uint32_t> firstDependent,
+             std::vector<uint32_t> dependents,
+             std::vector<uint32_t> dependencies);
+   // Runs every step once on threads workers, each after the steps it
+   // depends on. Steps waiting on a node no step creates, or on each other,
+   // are then run one at a time in plan order, as are the steps they hold.
+   // With deviceOf, steps are queued by the device they read from, hold a
+   // slot of the one they write to as well, and the number run at once on
+   // each device is tuned to what it sustains; stats, if given, then
+   // receives how each device fared.
+   void run(unsigned threads, const Runner& runner, const DeviceOf& deviceOf = nullptr,
+            std::vector<IoScheduler::DeviceStats>* stats = nullptr);
+   // Layout, to save the graph. Counts of dependencies include holds.
+   const std::vector<uint32_t>& getFirstDependent() const { return firstDependent; }
+   const std::vector<uint32_t>& getDependents() const { return dependents; }
+   const std::vector<uint32_t>& getDependencies() const { return dependencies; }
+
+  private:
+   const std::vector<EditStep>& steps;
+   // Steps depending on step i are dependents[firstDependent[i]] up to
+   // dependents[firstDependent[i + 1]].
+   std::vector<uint32_t> firstDependent;
+   std::vector<uint32_t> dependents;
+   std::vector<uint32_t> dependencies; // Count for each step.
+};
@@ -0,0 +1,144 @@
+/* file: TreePrinter.cc
+ * --------------------
+ * Streaming listing of FsNode trees.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "TreePrinter.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const size_t TreePrinter::kBufLen;
+
+
+/* function: TreePrinter
+ * ---------------------
+ */
+TreePrinter::TreePrinter(ostream& o, const Options& opts) : os(o), opts(opts) {
+   buf.reserve(kBufLen);
+}
+
+
+/* function: ~TreePrinter
+ * ----------------------
+ */
+TreePrinter::~TreePrinter() {
+   flush();
+}
+
+
+/* function: listed
+ * ----------------
+ * Files planned in another folder, as history, stay children of the folder
+ * they were found in.
+ */
+bool TreePrinter::listed(const FsNode& nd, const FsNode& child) {
+   return child.dstParent == nullptr || child.dstParent == &nd;
+}
+
+
+/* function: print
+ * ---------------
+ * Depth first, in the order of children, with a frame per open folder.
+ */
+void TreePrinter::print(const FsNode& root) {
+   struct Frame {
+      const FsNode* nd;
+      size_t next; // Index in children of the next one to look at.
+      size_t shown; // Children listed so far.
+   };
+   vector<Frame> stack;
+   line(0, root.name);
+   stack.push_back(Frame{&root, 0, 0});
+   while (!stack.empty()) {
+      Frame& top = stack.back();
+      size_t depth = stack.size();
+      const vector<FsNode*>& children = top.nd->children;
+      while (top.next < children.size() && !listed(*top.nd, *children[top.next]))
+         top.next++;
+      if (top.next == children.size()) {
+         stack.pop_back();
+         continue;
+      }
+      if (opts.maxEntries > 0 && top.shown == opts.maxEntries) {
+         summary(depth, *top.nd, top.next);
+         stack.pop_back();
+         continue;
+      }
+      const FsNode& child = *children[top.next++];
+      top.shown++;
+      if (opts.maxDepth > 0 && depth == opts.maxDepth) {
+         size_t held = 0;
+         for (const FsNode* grandchild : child.children)
+            held += listed(child, *grandchild);
+         line(depth, child.name, held == 0 ? "" :
+                                 " (" + to_string(held) + " entries)");
+      } else {
+         line(depth, child.name);
+         // top is not used past here, as pushing may move it.
+         stack.push_back(Frame{&child, 0, 0});
+      }
+   }
+}
+
+
+/* function: line
+ * --------------
+ */
+void TreePrinter::line(size_t depth, const char* name, const string& note) {
+   buf.append(2 * depth, ' ');
+   buf += name;
+   buf += note;
+   buf += '\n';
+   if (buf.size() >= kBufLen)
+      flush();
+}
+
+
+/* function: summary
+ * -----------------
+ */
+void TreePrinter::summary(size_t depth, const FsNode& nd, size_t first) {
+   size_t files = 0, dirs = 0;
+   for (size_t i = first; i < nd.children.size(); i++) {
+      if (listed(nd, *nd.children[i]))
+         (nd.children[i]->isDir() ? dirs : files)++;
+   }
+   line(depth, "...", " and " + to_string(files + dirs) + " more (" +
+                      to_string(files) + " files, " + to_string(dirs) +
+                      " folders)");
+}
+
+
+/* function: flush
+ * ---------------
+ */
+void TreePrinter::flush() {
+   os.write(buf.data(), buf.size());
+   buf.clear();
+}
@@ -0,0 +1,72 @@
+/* file: TreePrinter.h
+ * -------------------
+ * Streams the listing of a tree of FsNodes to an ostream, one line per
+ * node indented by depth. Walks the tree with its own stack and writes
+ * through a fixed size buffer, so memory does not grow with the tree and
+ * the ostream gets a few large writes rather than one per line. Deep levels
+ * and large folders can be summarized.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FsNode.h"
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+class TreePrinter {
+  public:
+   struct Options {
+      // Levels listed below the root, 0 for all. A folder at the last level
+      // is followed by the count of what it holds.
+      unsigned maxDepth = 0;
+      // Entries listed in a folder, 0 for all. The rest are counted on one
+      // line.
+      size_t maxEntries = 0;
+   };
+
+   TreePrinter(std::ostream& os, const Options& opts);
+   // Writes what is left in the buffer.
+   ~TreePrinter();
+   // Lists root and the nodes under it. A planned folder lists the nodes
+   // planned in it, and a folder found on disk those found in it.
+   void print(const FsNode& root);
+   void flush();
+
+  private:
+   // Whether child is listed under nd.
+   static bool listed(const FsNode& nd, const FsNode& child);
+   // Writes the line of a node at depth, with note after its name.
+   void line(size_t depth, const char* name, const std::string& note = "");
+   // Writes the count of the listed children of nd from index first.
+   void summary(size_t depth, const FsNode& nd, size_t first);
+
+   std::ostream& os;
+   Options opts;
+   std::string buf;
+
+   static const size_t kBufLen = 64 << 10;
+};
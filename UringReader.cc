@@ -0,0 +1,279 @@
+/* file: UringReader.cc
+ * ---------------------
+ * Reads byte ranges of many files at once through io_uring, keeping up to
+ * a fixed number of reads in flight into buffers registered with the
+ * kernel once. Completed chunks of a file are handed to its consumer in
+ * file order, like FileReader does. Linux only: create returns null where
+ * io_uring cannot be set up so callers can fall back to FileReader.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "UringReader.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+using namespace std;
+
+
+#ifdef __linux__
+
+/* function: create
+ * ----------------
+ */
+unique_ptr<UringReader> UringReader::create(unsigned depth, size_t chunkLen) {
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+   int fd = syscall(__NR_io_uring_setup, depth, &params);
+   if (fd < 0)
+      return nullptr;
+
+   unique_ptr<UringReader> ur(new UringReader());
+   ur->ringFd = fd;
+   ur->depth = depth;
+   ur->chunkLen = chunkLen;
+   ur->pendingSubmit = 0;
+   ur->sqRing = ur->cqRing = ur->sqes = MAP_FAILED;
+   ur->bufs = nullptr;
+   ur->slots.assign(depth, Slot{nullptr, -1, 0, 0, 0});
+
+   ur->sqRingLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   ur->cqRingLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+   if (params.features & IORING_FEAT_SINGLE_MMAP)
+      ur->sqRingLen = ur->cqRingLen = max(ur->sqRingLen, ur->cqRingLen);
+   ur->sqRing = mmap(nullptr, ur->sqRingLen, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+   if (ur->sqRing == MAP_FAILED)
+      return nullptr;
+   if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      ur->cqRing = ur->sqRing;
+   } else {
+      ur->cqRing = mmap(nullptr, ur->cqRingLen, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (ur->cqRing == MAP_FAILED)
+         return nullptr;
+   }
+   ur->sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+   ur->sqes = mmap(nullptr, ur->sqesLen, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+   if (ur->sqes == MAP_FAILED)
+      return nullptr;
+
+   char* sq = (char*)ur->sqRing;
+   ur->sqHead = (unsigned*)(sq + params.sq_off.head);
+   ur->sqTail = (unsigned*)(sq + params.sq_off.tail);
+   ur->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+   ur->sqArray = (unsigned*)(sq + params.sq_off.array);
+   char* cq = (char*)ur->cqRing;
+   ur->cqHead = (unsigned*)(cq + params.cq_off.head);
+   ur->cqTail = (unsigned*)(cq + params.cq_off.tail);
+   ur->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+   ur->cqes = cq + params.cq_off.cqes;
+
+   // Registered buffers spare the kernel from mapping them on every read.
+   // Without them, for instance past RLIMIT_MEMLOCK, plain reads still work.
+   size_t page = sysconf(_SC_PAGESIZE);
+   if (posix_memalign((void**)&ur->bufs, page, (size_t)depth * chunkLen) != 0)
+      return nullptr;
+   vector<iovec> iovs(depth);
+   for (unsigned i = 0; i < depth; i++)
+      iovs[i] = iovec{ur->bufs + i * chunkLen, chunkLen};
+   ur->fixedBufs = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                           iovs.data(), depth) == 0;
+   return ur;
+}
+
+
+/* function: ~UringReader
+ * ----------------------
+ */
+UringReader::~UringReader() {
+   for (Slot& slot : slots) {
+      if (slot.fd >= 0) close(slot.fd);
+   }
+   if (sqes != MAP_FAILED) munmap(sqes, sqesLen);
+   if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingLen);
+   if (sqRing != MAP_FAILED) munmap(sqRing, sqRingLen);
+   close(ringFd); // Also unregisters the buffers.
+   free(bufs);
+}
+
+
+/* function: run
+ * -------------
+ * Each file has at most one read in flight so its chunks reach the sink in
+ * order, and up to depth files are read at once.
+ */
+void UringReader::run(vector<Job>& jobs) {
+   size_t next = 0;
+   unsigned busy = 0; // Slots with a read in flight.
+   try {
+      while (next < jobs.size() || busy > 0) {
+         // Fill free slots with the next files.
+         for (unsigned s = 0; s < depth && next < jobs.size(); s++) {
+            if (slots[s].job != nullptr)
+               continue;
+            Job& job = jobs[next++];
+            if (job.ranges.empty())
+               continue;
+            int fd = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+               throw system_error(errno, system_category(), job.path);
+            slots[s] = Slot{&job, fd, 0, 0, 0};
+            submit(s);
+            busy++;
+         }
+         if (busy == 0)
+            continue;
+         enter(pendingSubmit);
+
+         // Reap completions, handing data over and queuing follow-up reads.
+         unsigned head = *cqHead;
+         while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe* cqe = (io_uring_cqe*)cqes + (head & *cqMask);
+            unsigned s = cqe->user_data;
+            int res = cqe->res;
+            __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+            busy--;
+
+            Slot& slot = slots[s];
+            Job& job = *slot.job;
+            if (res < 0 && res != -EINTR && res != -EAGAIN)
+               throw system_error(-res, system_category(), job.path);
+            if (res == 0)
+               throw runtime_error(job.path + " is shorter than expected.");
+            if (res > 0) {
+               job.sink(bufs + (size_t)s * chunkLen, res);
+               slot.done += res;
+               if (slot.done == job.ranges[slot.range].second) {
+                  slot.range++;
+                  slot.done = 0;
+               }
+            }
+            if (slot.range < job.ranges.size()) {
+               submit(s);
+               busy++;
+               continue;
+            }
+            int fd = slot.fd;
+            slot = Slot{nullptr, -1, 0, 0, 0};
+            if (close(fd) < 0)
+               throw system_error(errno, system_category(), job.path);
+         }
+      }
+   } catch (...) {
+      // Reads in flight target our buffers and would complete in a later
+      // run, wait for them before giving up on the batch.
+      while (busy > 0) {
+         long ret = syscall(__NR_io_uring_enter, ringFd, pendingSubmit, 1,
+                            IORING_ENTER_GETEVENTS, nullptr, 0);
+         if (ret < 0 && errno != EINTR)
+            break;
+         if (ret >= 0)
+            pendingSubmit = 0;
+         unsigned head = *cqHead;
+         while (busy > 0 && head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+            busy--;
+         }
+      }
+      for (Slot& slot : slots) {
+         if (slot.fd >= 0) close(slot.fd);
+         slot = Slot{nullptr, -1, 0, 0, 0};
+      }
+      throw;
+   }
+}
+
+
+/* function: submit
+ * ----------------
+ * Short reads are resumed from where they stopped.
+ */
+void UringReader::submit(unsigned s) {
+   Slot& slot = slots[s];
+   const pair<off_t, size_t>& range = slot.job->ranges[slot.range];
+   slot.inFlight = min(chunkLen, range.second - slot.done);
+
+   unsigned tail = *sqTail;
+   unsigned idx = tail & *sqMask;
+   io_uring_sqe* sqe = (io_uring_sqe*)sqes + idx;
+   memset(sqe, 0, sizeof(*sqe));
+   sqe->opcode = fixedBufs ? IORING_OP_READ_FIXED : IORING_OP_READ;
+   sqe->fd = slot.fd;
+   sqe->off = range.first + slot.done;
+   sqe->addr = (unsigned long)(bufs + (size_t)s * chunkLen);
+   sqe->len = slot.inFlight;
+   sqe->buf_index = s;
+   sqe->user_data = s;
+   sqArray[idx] = idx;
+   __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+   pendingSubmit++;
+}
+
+
+/* function: enter
+ * ---------------
+ */
+void UringReader::enter(unsigned toSubmit) {
+   while (true) {
+      int ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, 1,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret >= 0) {
+         pendingSubmit -= min((unsigned)ret, pendingSubmit);
+         return;
+      }
+      if (errno != EINTR)
+         throw system_error(errno, system_category(), "io_uring_enter");
+   }
+}
+
+#else
+
+unique_ptr<UringReader> UringReader::create(unsigned, size_t) {
+   return nullptr;
+}
+
+UringReader::~UringReader() {}
+
+void UringReader::run(vector<Job>&) {}
+
+void UringReader::submit(unsigned) {}
+
+void UringReader::enter(unsigned) {}
+
+#endif
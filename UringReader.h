@@ -0,0 +1,97 @@
+/* file: UringReader.h
+ * --------------------
+ * Reads byte ranges of many files at once through io_uring, keeping up to
+ * a fixed number of reads in flight into buffers registered with the
+ * kernel once. Completed chunks of a file are handed to its consumer in
+ * file order, like FileReader does. Linux only: create returns null where
+ * io_uring cannot be set up so callers can fall back to FileReader.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include "FileReader.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <sys/types.h>
+
+class UringReader {
+  public:
+   // Byte ranges of one file to feed to sink, in order.
+   struct Job {
+      std::string path;
+      std::vector<std::pair<off_t, size_t>> ranges;
+      FileReader::Sink sink;
+   };
+
+   // Ring with depth reads in flight, each into a chunkLen buffer. Returns
+   // null if the kernel or the sandbox does not allow io_uring.
+   static std::unique_ptr<UringReader> create(unsigned depth, size_t chunkLen);
+   ~UringReader();
+   // Reads every job, up to depth files at a time. Throws like
+   // FileReader::read if a file cannot be read or ends early.
+   void run(std::vector<Job>& jobs);
+
+  private:
+   // A file being read into one of the buffers.
+   struct Slot {
+      Job* job; // Null when the slot is free.
+      int fd;
+      size_t range; // Index in job->ranges being read.
+      size_t done; // Bytes of the current range already read.
+      size_t inFlight; // Length of the read in flight.
+   };
+
+   UringReader() {}
+   // Queues a read of the next chunk of slot s.
+   void submit(unsigned s);
+   // Submits queued reads and waits for at least one completion.
+   void enter(unsigned toSubmit);
+
+   int ringFd;
+   unsigned depth;
+   size_t chunkLen;
+   bool fixedBufs; // Whether buffers could be registered.
+   unsigned char* bufs; // depth buffers of chunkLen bytes.
+   std::vector<Slot> slots;
+   unsigned pendingSubmit; // SQEs queued since the last enter.
+
+   // Rings shared with the kernel.
+   void* sqRing;
+   size_t sqRingLen;
+   void* cqRing;
+   size_t cqRingLen;
+   void* sqes;
+   size_t sqesLen;
+   unsigned* sqHead;
+   unsigned* sqTail;
+   unsigned* sqMask;
+   unsigned* sqArray;
+   unsigned* cqHead;
+   unsigned* cqTail;
+   unsigned* cqMask;
+   void* cqes;
+};
@@ -0,0 +1,142 @@
+/* file: WorkPool.cc
+ * ------------------
+ * Pool of worker threads, each with its own deque of tasks. A worker runs
+ * the newest task of its own deque and, when it runs dry, steals the oldest
+ * task of another worker. Tasks may push more tasks, and run() returns once
+ * every task is done.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "WorkPool.h"
+#include <thread>
+#include <stdexcept>
+
+using namespace std;
+
+
+/* function: WorkPool
+ * ------------------
+ */
+WorkPool::WorkPool(unsigned nthreads) : pending(0), queued(0), failed(false) {
+   if (nthreads == 0)
+      throw invalid_argument("WorkPool needs at least one thread.");
+   for (unsigned i = 0; i < nthreads; i++)
+      queues.push_back(unique_ptr<Queue>(new Queue));
+}
+
+
+/* function: push
+ * --------------
+ */
+void WorkPool::push(Task task, unsigned worker) {
+   pending++;
+   {
+      lock_guard<mutex> lk(queues[worker % queues.size()]->m);
+      queues[worker % queues.size()]->tasks.push_back(move(task));
+   }
+   lock_guard<mutex> lk(wakeMtx);
+   queued++;
+   wake.notify_one();
+}
+
+
+/* function: run
+ * -------------
+ */
+void WorkPool::run() {
+   vector<thread> threads;
+   for (unsigned i = 1; i < queues.size(); i++)
+      threads.push_back(thread(&WorkPool::work, this, i));
+   work(0);
+   for (thread& t : threads)
+      t.join();
+   if (failed) {
+      exception_ptr e = error;
+      error = nullptr;
+      failed = false;
+      rethrow_exception(e);
+   }
+}
+
+
+/* function: work
+ * --------------
+ */
+void WorkPool::work(unsigned id) {
+   Task task;
+   while (true) {
+      if (take(id, task)) {
+         if (!failed) {
+            try {
+               task(id);
+            } catch (...) {
+               lock_guard<mutex> lk(wakeMtx);
+               if (!failed) error = current_exception();
+               failed = true;
+            }
+         }
+         task = nullptr;
+         if (--pending == 0) {
+            lock_guard<mutex> lk(wakeMtx);
+            wake.notify_all();
+         }
+         continue;
+      }
+      // A push counts its task under wakeMtx, so one landing between take
+      // and wait is seen here.
+      unique_lock<mutex> lk(wakeMtx);
+      wake.wait(lk, [this] { return queued > 0 || pending == 0; });
+      if (pending == 0)
+         return;
+   }
+}
+
+
+/* function: take
+ * --------------
+ */
+bool WorkPool::take(unsigned id, Task& task) {
+   {
+      Queue& q = *queues[id];
+      lock_guard<mutex> lk(q.m);
+      if (!q.tasks.empty()) {
+         task = move(q.tasks.back());
+         q.tasks.pop_back();
+         queued--;
+         return true;
+      }
+   }
+   for (unsigned i = 1; i < queues.size(); i++) {
+      Queue& q = *queues[(id + i) % queues.size()];
+      lock_guard<mutex> lk(q.m);
+      if (!q.tasks.empty()) {
+         task = move(q.tasks.front());
+         q.tasks.pop_front();
+         queued--;
+         return true;
+      }
+   }
+   return false;
+}
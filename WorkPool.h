@@ -0,0 +1,76 @@
+/* file: WorkPool.h
+ * -----------------
+ * Pool of worker threads, each with its own deque of tasks. A worker runs
+ * the newest task of its own deque and, when it runs dry, steals the oldest
+ * task of another worker. Tasks may push more tasks, and run() returns once
+ * every task is done.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <functional>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+class WorkPool {
+  public:
+   // Called with the index of the worker running it, in [0, size()).
+   typedef std::function<void(unsigned)> Task;
+
+   explicit WorkPool(unsigned nthreads);
+   // Queues task on the deque of worker. Safe to call from tasks.
+   void push(Task task, unsigned worker = 0);
+   // Runs queued tasks on size() threads, the calling one included, until
+   // none are left. Rethrows the first exception thrown by a task, after
+   // which remaining tasks are dropped.
+   void run();
+   unsigned size() const { return queues.size(); }
+
+  private:
+   struct Queue {
+      std::mutex m;
+      std::deque<Task> tasks;
+   };
+   // Loop run by each worker.
+   void work(unsigned id);
+   // Pops from the back of the worker's deque, else steals from the front
+   // of another one.
+   bool take(unsigned id, Task& task);
+
+   std::vector<std::unique_ptr<Queue>> queues;
+   std::atomic<size_t> pending; // Tasks queued or running.
+   // Tasks in the deques, counted up under wakeMtx once pushed, so below
+   // zero while a task is taken before it is counted.
+   std::atomic<long> queued;
+   std::atomic<bool> failed;
+   std::exception_ptr error;
+   std::mutex wakeMtx;
+   std::condition_variable wake;
+};
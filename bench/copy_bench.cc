@@ -0,0 +1,132 @@
+/* file: bench/copy_bench.cc
+ * --------------------------
+ * Compares copying many small files with CopyEngine against running a cp
+ * process per file, at most ten at a time as FsTree::execTform used to with
+ * --fork-commands.
+ *
+ * Usage: copy_bench [files (default 20000)] [dir (default /tmp)]
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "CopyEngine.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <system_error>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+static const unsigned kMaxProc = 10;
+static const size_t kFilesPerDir = 1000;
+
+
+/* function: makeTree
+ * ------------------
+ * Files of a few hundred bytes, spread over folders of kFilesPerDir.
+ */
+static vector<string> makeTree(const string& root, size_t files) {
+   vector<string> paths;
+   string content(300, 'x');
+   for (size_t i = 0; i < files; i++) {
+      string dir = root + "/src/" + to_string(i / kFilesPerDir);
+      if (i % kFilesPerDir == 0 && mkdir(dir.c_str(), 0777) < 0)
+         throw system_error(errno, system_category(), dir);
+      paths.push_back(dir + "/f" + to_string(i));
+      int fd = open(paths.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0 || write(fd, content.data(), content.size()) < 0)
+         throw system_error(errno, system_category(), paths.back());
+      close(fd);
+   }
+   return paths;
+}
+
+
+/* function: dstDirs
+ * -----------------
+ */
+static vector<string> dstDirs(const string& root, size_t files) {
+   vector<string> dirs;
+   mkdir(root.c_str(), 0777);
+   for (size_t i = 0; i < files; i += kFilesPerDir) {
+      dirs.push_back(root + "/" + to_string(i / kFilesPerDir));
+      mkdir(dirs.back().c_str(), 0777);
+   }
+   return dirs;
+}
+
+
+int main(int argc, char** argv) {
+   size_t files = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 20000;
+   string base = (argc > 2) ? argv[2] : "/tmp";
+   string root = base + "/copy_bench.XXXXXX";
+   if (mkdtemp(&root[0]) == nullptr)
+      throw system_error(errno, system_category(), root);
+   mkdir((root + "/src").c_str(), 0777);
+   vector<string> paths = makeTree(root, files);
+
+   vector<string> dirs = dstDirs(root + "/inproc", files);
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   CopyEngine engine;
+   for (size_t i = 0; i < files; i++)
+      engine.copy(paths[i], dirs[i / kFilesPerDir]);
+   chrono::duration<double> inproc = chrono::steady_clock::now() - start;
+
+   dirs = dstDirs(root + "/fork", files);
+   start = chrono::steady_clock::now();
+   unsigned running = 0;
+   for (size_t i = 0; i < files; i++) {
+      if (running == kMaxProc) {
+         wait(nullptr);
+         running--;
+      }
+      pid_t pid = fork();
+      if (pid == 0) {
+         execlp("cp", "cp", "--backup=numbered", paths[i].c_str(),
+                dirs[i / kFilesPerDir].c_str(), (char*)nullptr);
+         _exit(127);
+      }
+      running++;
+   }
+   while (running-- > 0)
+      wait(nullptr);
+   chrono::duration<double> forked = chrono::steady_clock::now() - start;
+
+   cout << fixed << setprecision(0);
+   cout << "inproc " << files << " files " << files / inproc.count()
+        << " files/s" << endl;
+   cout << "fork   " << files << " files " << files / forked.count()
+        << " files/s" << endl;
+   string cleanup = "rm -rf '" + root + "'";
+   return system(cleanup.c_str());
+}
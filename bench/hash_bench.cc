@@ -0,0 +1,76 @@
+/* file: bench/hash_bench.cc
+ * ----------------------------
+ * Reports the throughput of each content hasher over a buffer held in
+ * memory, so only hashing is measured.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Hasher.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+static const size_t kBufLen = 64 << 20;
+static const size_t kChunkLen = 128 << 10; // Like reads fed by FileReader.
+static const int kRounds = 4;
+
+
+/* function: gbPerSec
+ * ------------------
+ * Best of kRounds passes over buf.
+ */
+static double gbPerSec(Hasher::Algo algo, const vector<unsigned char>& buf) {
+   double best = 0;
+   for (int round = 0; round < kRounds; round++) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      unique_ptr<Hasher> hasher = Hasher::create(algo);
+      for (size_t off = 0; off < buf.size(); off += kChunkLen)
+         hasher->update(buf.data() + off, min(kChunkLen, buf.size() - off));
+      unsigned char res[Hasher::kMaxDigestLen];
+      hasher->final(res);
+      chrono::duration<double> secs = chrono::steady_clock::now() - start;
+      best = max(best, buf.size() / secs.count() / 1e9);
+   }
+   return best;
+}
+
+
+int main() {
+   vector<unsigned char> buf(kBufLen);
+   srand(1);
+   for (unsigned char& c : buf) c = rand();
+
+   cout << "sha_ni " << (Hasher::hasShaNi() ? "yes" : "no") << endl;
+   Hasher::Algo algos[] = {Hasher::kMd5, Hasher::kSha256, Hasher::kXxh128};
+   for (Hasher::Algo algo : algos) {
+      cout << left << setw(8) << Hasher::name(algo) << fixed
+           << setprecision(2) << gbPerSec(algo, buf) << " GB/s" << endl;
+   }
+   return 0;
+}
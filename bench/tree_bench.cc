@@ -0,0 +1,202 @@
+/* file: bench/tree_bench.cc
+ * --------------------------
+ * Times each phase of a merge of synthetic trees from bench/tree_gen:
+ * building the input trees (exploring, with hashing under way), resolving
+ * digests, grouping duplicates, merging folders, planning history folders
+ * in makeFileHist, and executing the plan. Runs on tmpfs and on disk by
+ * default, each with a warm page cache as the trees were just written.
+ * Prints a JSON object per phase and folder, one per line, so results can
+ * be collected and compared between versions.
+ *
+ * Phases are timed by Metrics, as for unidupe --stats.
+ *
+ * Usage: tree_bench [--dir=PATH]... [--trees=N] [--depth=N] [--fanout=N]
+ *                   [--files=N] [--min-size=N] [--max-size=N] [--dup=R]
+ *                   [--collide=R] [--seed=N] [--threads=N]
+ *   --files is per folder, --threads is for scanning, hashing and running
+ *   steps alike (default: one per CPU).
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "tree_gen.h"
+#include "FsTree.h"
+#include "FileStore.h"
+#include "NodeArena.h"
+#include "HashPipeline.h"
+#include "Metrics.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <system_error>
+
+#include <getopt.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+using namespace std;
+
+// Writes a JSON line per phase.
+struct Report {
+   ostream& out;
+   string fs;
+   string dir;
+   const TreeGen::Stats& stats;
+
+   void phase(const char* name, double seconds) {
+      out << "{\"bench\":\"tree\",\"fs\":\"" << fs << "\",\"dir\":\"" << dir
+          << "\",\"files\":" << stats.files << ",\"bytes\":" << stats.bytes
+          << ",\"phase\":\"" << name << "\",\"seconds\":" << fixed
+          << setprecision(6) << seconds << "}" << endl;
+   }
+};
+
+
+/* function: fsKind
+ * ----------------
+ */
+static string fsKind(const string& dir) {
+   struct statfs st;
+   if (statfs(dir.c_str(), &st) < 0)
+      throw system_error(errno, system_category(), dir);
+   return (st.f_type == TMPFS_MAGIC) ? "tmpfs" : "disk";
+}
+
+
+/* function: secondsSince
+ * ----------------------
+ */
+static double secondsSince(chrono::steady_clock::time_point start) {
+   chrono::duration<double> secs = chrono::steady_clock::now() - start;
+   return secs.count();
+}
+
+
+/* function: benchIn
+ * -----------------
+ * Generates the trees in a new folder of base, merges them and removes it.
+ * What unidupe prints goes to cout, which the caller silences.
+ */
+static void benchIn(const string& base, const TreeGen::Params& params,
+                    unsigned threads, ostream& out) {
+   string root = base + "/tree_bench.XXXXXX";
+   if (mkdtemp(&root[0]) == nullptr)
+      throw system_error(errno, system_category(), root);
+   TreeGen gen(params);
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   vector<string> paths = gen.generate(root + "/in");
+   Report report{out, fsKind(root), base, gen.getStats()};
+   report.phase("generate", secondsSince(start));
+
+   Metrics& metrics = Metrics::get();
+   metrics.reset();
+   HashPipeline::Options opts;
+   opts.threads = threads;
+   HashPipeline hasher(opts);
+   FileStore fileStore;
+   NodeArena nodeStore;
+   vector<FsTree> trees(paths.size());
+   vector<FsTree*> treePtrs;
+   FsTree::buildAll(trees, paths, fileStore, nodeStore, hasher, threads);
+   for (FsTree& tree : trees)
+      treePtrs.push_back(&tree);
+   FsTree joint(treePtrs, root + "/out", fileStore, hasher);
+   joint.execTform(threads);
+   report.phase("build", metrics.wallSeconds("scan"));
+   for (const char* phase : {"resolve", "group", "merge", "hist", "exec"})
+      report.phase(phase, metrics.wallSeconds(phase));
+
+   string cleanup = "rm -rf '" + root + "'";
+   if (system(cleanup.c_str()) != 0)
+      cerr << "Could not remove " << root << endl;
+}
+
+
+int main(int argc, char** argv) {
+   TreeGen::Params params;
+   vector<string> dirs;
+   unsigned threads = max(1u, thread::hardware_concurrency());
+   static const struct option longopts[] = {
+      {"dir", required_argument, nullptr, 'd'},
+      {"trees", required_argument, nullptr, 't'},
+      {"depth", required_argument, nullptr, 'D'},
+      {"fanout", required_argument, nullptr, 'f'},
+      {"files", required_argument, nullptr, 'n'},
+      {"min-size", required_argument, nullptr, 's'},
+      {"max-size", required_argument, nullptr, 'S'},
+      {"dup", required_argument, nullptr, 'u'},
+      {"collide", required_argument, nullptr, 'c'},
+      {"seed", required_argument, nullptr, 'r'},
+      {"threads", required_argument, nullptr, 'j'},
+      {nullptr, 0, nullptr, 0}
+   };
+   int opt;
+   while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+      switch (opt) {
+         case 'd': dirs.push_back(optarg); break;
+         case 't': params.trees = strtoul(optarg, nullptr, 10); break;
+         case 'D': params.depth = strtoul(optarg, nullptr, 10); break;
+         case 'f': params.fanout = strtoul(optarg, nullptr, 10); break;
+         case 'n': params.filesPerDir = strtoul(optarg, nullptr, 10); break;
+         case 's': params.minSize = strtoull(optarg, nullptr, 10); break;
+         case 'S': params.maxSize = strtoull(optarg, nullptr, 10); break;
+         case 'u': params.dupRatio = strtod(optarg, nullptr); break;
+         case 'c': params.collisionRatio = strtod(optarg, nullptr); break;
+         case 'r': params.seed = strtoull(optarg, nullptr, 10); break;
+         case 'j': threads = max(1ul, strtoul(optarg, nullptr, 10)); break;
+         default:
+            cerr << "Usage: tree_bench [--dir=PATH]... [--trees=N] [--depth=N]"
+                    " [--fanout=N] [--files=N] [--min-size=N] [--max-size=N]"
+                    " [--dup=R] [--collide=R] [--seed=N] [--threads=N]" << endl;
+            return 1;
+      }
+   }
+   if (params.trees < 2) {
+      cerr << "Error: at least 2 trees are merged." << endl;
+      return 1;
+   }
+   if (dirs.empty())
+      dirs = {"/dev/shm", "/var/tmp"};
+
+   // Results go to the real stdout, what unidupe prints nowhere.
+   ostream out(cout.rdbuf());
+   ofstream devnull("/dev/null");
+   cout.rdbuf(devnull.rdbuf());
+   int status = 0;
+   for (const string& dir : dirs) {
+      try {
+         benchIn(dir, params, threads, out);
+      } catch (exception& e) {
+         cerr << "Error: " << dir << ": " << e.what() << endl;
+         status = 1;
+      }
+   }
+   cout.rdbuf(out.rdbuf());
+   return status;
+}
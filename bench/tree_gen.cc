@@ -0,0 +1,147 @@
+/* file: bench/tree_gen.cc
+ * -----------------------
+ * Generation of synthetic input trees.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "tree_gen.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <system_error>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/* function: splitmix
+ * ------------------
+ * Next of a sequence of well mixed words, to fill file contents quickly.
+ */
+static inline uint64_t splitmix(uint64_t& state) {
+   uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+   return z ^ (z >> 31);
+}
+
+
+/* function: makeDir
+ * -----------------
+ */
+static void makeDir(const string& path) {
+   if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+      throw system_error(errno, system_category(), path);
+}
+
+
+/* function: generate
+ * ------------------
+ * Folders are laid out breadth first, the same in every tree. Each file
+ * slot of each tree then draws whether it duplicates earlier contents,
+ * collides with the path of the first tree's file in that slot, or is new.
+ */
+vector<string> TreeGen::generate(const string& root) {
+   mt19937_64 rng(params.seed);
+   uniform_real_distribution<double> unit(0.0, 1.0);
+   double logMin = log((double)max<size_t>(params.minSize, 1));
+   double logMax = log((double)max(params.maxSize, params.minSize));
+
+   vector<string> dirs(1, "");
+   for (size_t first = 0, level = 0; level < params.depth; level++) {
+      size_t last = dirs.size();
+      for (size_t d = first; d < last; d++) {
+         for (unsigned f = 0; f < params.fanout; f++)
+            dirs.push_back(dirs[d] + "/d" + to_string(f));
+      }
+      first = last;
+   }
+
+   // Contents generated so far, as an id and size.
+   vector<pair<uint64_t, size_t>> contents;
+   uint64_t nextId = 0;
+   vector<string> roots;
+   makeDir(root);
+   for (unsigned t = 0; t < params.trees; t++) {
+      roots.push_back(root + "/in" + to_string(t));
+      for (const string& dir : dirs) {
+         makeDir(roots.back() + dir);
+         stats.dirs++;
+         for (unsigned f = 0; f < params.filesPerDir; f++) {
+            double draw = unit(rng);
+            pair<uint64_t, size_t> file;
+            // Files of the first tree are named as the collisions of later
+            // ones, other files by tree so their paths are unique.
+            bool collides = (t == 0) || (draw >= params.dupRatio &&
+                            draw < params.dupRatio + params.collisionRatio);
+            string name = (collides ? "" : "t" + to_string(t) + "_") +
+                          "f" + to_string(f);
+            if (draw < params.dupRatio && !contents.empty()) {
+               file = contents[rng() % contents.size()];
+            } else {
+               file.first = nextId++;
+               file.second = (size_t)exp(logMin + (logMax - logMin) * unit(rng));
+               contents.push_back(file);
+            }
+            writeFile(roots.back() + dir + "/" + name, file.first, file.second);
+         }
+      }
+   }
+   return roots;
+}
+
+
+/* function: writeFile
+ * -------------------
+ */
+void TreeGen::writeFile(const string& path, uint64_t id, size_t size) {
+   buf.resize(size + sizeof(uint64_t));
+   uint64_t state = params.seed ^ (id * 0xd6e8feb86659fd93ULL);
+   for (size_t off = 0; off < size; off += sizeof(uint64_t)) {
+      uint64_t word = splitmix(state);
+      memcpy(buf.data() + off, &word, sizeof(word));
+   }
+   int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      throw system_error(errno, system_category(), path);
+   for (size_t done = 0; done < size; ) {
+      ssize_t n = write(fd, buf.data() + done, size - done);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0) {
+         int err = errno;
+         close(fd);
+         throw system_error(err, system_category(), path);
+      }
+      done += n;
+   }
+   close(fd);
+   stats.files++;
+   stats.bytes += size;
+}
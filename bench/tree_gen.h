@@ -0,0 +1,76 @@
+/* file: bench/tree_gen.h
+ * ----------------------
+ * Deterministic synthetic input trees for benchmarks. The same parameters
+ * and seed always give the same folders, names and file contents, so runs
+ * of different versions measure the same work.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class TreeGen {
+  public:
+   struct Params {
+      unsigned trees = 3; // Input trees, with the same folders.
+      unsigned depth = 3; // Levels of folders under each root.
+      unsigned fanout = 4; // Subfolders of each folder above the last level.
+      unsigned filesPerDir = 20;
+      // File sizes are log-uniform between these, as many small files and
+      // a few large ones.
+      size_t minSize = 1 << 10;
+      size_t maxSize = 64 << 10;
+      // Share of files with the contents of a file generated before them,
+      // in the same tree or an earlier one, under another name.
+      double dupRatio = 0.3;
+      // Share of files of trees after the first at the path of a file of
+      // the first tree, with other contents.
+      double collisionRatio = 0.1;
+      uint64_t seed = 1;
+   };
+   // What was generated.
+   struct Stats {
+      size_t files = 0;
+      size_t dirs = 0;
+      size_t bytes = 0;
+   };
+
+   explicit TreeGen(const Params& params) : params(params) {}
+   // Writes the trees under root, as root/in0, root/in1 and so on, and
+   // returns their paths. Throws system_error if a file cannot be written.
+   std::vector<std::string> generate(const std::string& root);
+   const Stats& getStats() const { return stats; }
+
+  private:
+   // Writes size bytes of the contents numbered id to path.
+   void writeFile(const std::string& path, uint64_t id, size_t size);
+
+   Params params;
+   Stats stats;
+   std::vector<char> buf;
+};
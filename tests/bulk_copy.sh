@@ -0,0 +1,40 @@
+# file: bulk_copy.sh
+# ------------------
+# A folder copied whole by --bulk-copy comes out as copying it file by file
+# does: the same files with the same contents, modes and mtimes. Only the
+# history entries of its files are missing, each the same as the file kept.
+
+. "$(dirname "$0")/lib.sh"
+
+for t in a b c; do
+   for f in src/f1.c src/f2.c src/lib/l1.c src/lib/l2.c src/lib/deep/l3.c; do
+      put $t/proj/$f "contents of $f" 2020-01-01
+   done
+   chmod 640 $t/proj/src/f2.c
+done
+put a/docs/readme "read me" 2020-01-01
+put b/docs/readme "read me, again" 2021-01-01
+put c/other/x "x" 2020-01-01
+
+# Path, mode and mtime of every file outside history folders, and its md5.
+kept() {
+   (cd "$1" && find . -type f ! -path "*_hist/*" -exec stat -c '%n %a %Y' {} + | sort)
+   listing "$1" | grep -v "_hist/"
+}
+
+for mode in "" --fork-commands; do
+   rm -rf per_file bulk
+   merge $mode a b c per_file > /dev/null
+   merge $mode --bulk-copy a b c bulk > /dev/null
+   [ "$(kept per_file)" = "$(kept bulk)" ] ||
+      fail "$mode: $(diff <(kept per_file) <(kept bulk) | head)"
+   missing=$(comm -23 <(listing per_file) <(listing bulk))
+   [ -n "$missing" ] || fail "$mode: nothing was copied as a whole"
+   while read -r path md5; do
+      dir=$(dirname "$path")
+      [ "${dir%_hist}" != "$dir" ] || fail "$mode: $path missing"
+      name=$(basename "$dir" _hist)
+      [ "$(md5sum < "per_file/$(dirname "$dir")/${name#.}" | cut -d' ' -f1)" = "$md5" ] ||
+         fail "$mode: history entry $path missing"
+   done <<< "$missing"
+done
@@ -0,0 +1,52 @@
+/* file: check.h
+ * -------------
+ * Assertions for the unit checks under tests/, each a program run by make
+ * check. A failed CHECK is reported and counted, and the program exits
+ * with the count.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#pragma once
+#include <iostream>
+
+static int checkFailures = 0;
+
+#define CHECK(cond) \
+   do { \
+      if (!(cond)) { \
+         std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" \
+                   << std::endl; \
+         checkFailures++; \
+      } \
+   } while (0)
+
+#define CHECK_EQ(a, b) \
+   do { \
+      if (!((a) == (b))) { \
+         std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #a ", " #b ") failed: " \
+                   << (a) << " != " << (b) << std::endl; \
+         checkFailures++; \
+      } \
+   } while (0)
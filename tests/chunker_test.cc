@@ -0,0 +1,120 @@
+/* file: chunker_test.cc
+ * ---------------------
+ * Chunker cuts where the contents say so: the same chunks however the
+ * bytes are fed, chunks within the bounds asked for, and, after bytes are
+ * inserted, the same chunks before the insertion and again a little after
+ * it.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Chunker.h"
+#include "check.h"
+#include <vector>
+#include <random>
+#include <set>
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+
+typedef pair<uint64_t, uint64_t> Key;
+
+
+/* function: chunks
+ * ----------------
+ * Chunks of data, fed in pieces of piece bytes.
+ */
+static vector<Chunker::Chunk> chunks(const vector<unsigned char>& data, size_t piece,
+                                     const Chunker::Options& opts) {
+   vector<Chunker::Chunk> out;
+   Chunker chunker(opts, [&](const Chunker::Chunk& c) { out.push_back(c); });
+   for (size_t off = 0; off < data.size(); off += piece)
+      chunker.update(data.data() + off, min(piece, data.size() - off));
+   chunker.final();
+   return out;
+}
+
+
+/* function: key
+ * -------------
+ */
+static Key key(const Chunker::Chunk& c) {
+   return make_pair(c.key[0], c.key[1]);
+}
+
+
+int main() {
+   mt19937_64 rng(7);
+   vector<unsigned char> data(4 << 20);
+   for (unsigned char& b : data)
+      b = rng();
+   Chunker::Options opts = Chunker::withAverage(8 << 10);
+   vector<Chunker::Chunk> before = chunks(data, data.size(), opts);
+
+   // Bounds, and the lengths adding up to the whole.
+   size_t total = 0;
+   bool bounded = true;
+   for (size_t i = 0; i < before.size(); i++) {
+      total += before[i].len;
+      bounded = bounded && before[i].len <= opts.maxLen &&
+                (i + 1 == before.size() || before[i].len >= opts.minLen);
+   }
+   CHECK_EQ(total, data.size());
+   CHECK(bounded);
+   size_t avg = data.size() / before.size();
+   CHECK(avg >= opts.avgLen / 2 && avg <= opts.avgLen * 2);
+
+   // Same cuts whatever the pieces fed.
+   for (size_t piece : {1u, 1000u, 65537u}) {
+      vector<Chunker::Chunk> again = chunks(data, piece, opts);
+      bool same = again.size() == before.size();
+      for (size_t i = 0; same && i < again.size(); i++)
+         same = key(again[i]) == key(before[i]) && again[i].len == before[i].len;
+      CHECK(same);
+   }
+
+   // Insert 100 bytes in the middle: chunks wholly before are unchanged,
+   // and but a few chunks around the insertion are new.
+   size_t at = data.size() / 2;
+   vector<unsigned char> edited(data.begin(), data.begin() + at);
+   for (int i = 0; i < 100; i++)
+      edited.push_back(rng());
+   edited.insert(edited.end(), data.begin() + at, data.end());
+   vector<Chunker::Chunk> after = chunks(edited, edited.size(), opts);
+   size_t off = 0, i = 0;
+   bool prefix = true;
+   for (; off + before[i].len <= at; off += before[i].len, i++)
+      prefix = prefix && key(after[i]) == key(before[i]);
+   CHECK(prefix);
+   set<Key> old;
+   for (const Chunker::Chunk& c : before)
+      old.insert(key(c));
+   size_t fresh = 0;
+   for (const Chunker::Chunk& c : after)
+      fresh += old.count(key(c)) == 0;
+   CHECK(fresh <= 3);
+   CHECK(after.size() + 3 >= before.size() && after.size() <= before.size() + 3);
+   return checkFailures;
+}
@@ -0,0 +1,50 @@
+# file: digest_cache.sh
+# ---------------------
+# --cache keeps the digests of every file it hashed, so a second run over
+# unchanged trees reads no file contents. A torn or garbled last record
+# only costs the digests it held. --compact-cache drops superseded records
+# and --clear-cache the whole file, and the cache keeps working after both.
+
+. "$(dirname "$0")/lib.sh"
+
+# Digests computed by a run over a and b, answering n when asked to proceed.
+digests() {
+   echo n | "$UNIDUPE" --no-progress --hide-inputs --cache="$WORK/cache" \
+      --stats="$WORK/stats.json" a b out > /dev/null
+   sed -n 's/.*"digests_computed": \([0-9]*\).*/\1/p' "$WORK/stats.json"
+}
+
+# Each file shares its size with its copy only, and is long enough to be
+# fingerprinted before its contents are hashed.
+for i in 1 2 3 4 5 6; do
+   mkdir -p a b
+   head -c $((20000 + i)) /dev/urandom > a/f$i
+   cp a/f$i b/f$i
+done
+
+[ "$(digests)" = 24 ] || fail "the first run did not hash every file twice"
+[ "$(digests)" = 0 ] || fail "an unchanged tree was read again"
+len=$(stat -c %s cache)
+
+truncate -s $((len - 10)) cache
+n=$(digests)
+[ "$n" -gt 0 ] && [ "$n" -le 2 ] || fail "a torn record cost $n digests"
+[ "$(digests)" = 0 ] || fail "digests lost to a torn record were not kept again"
+
+len=$(stat -c %s cache)
+printf 'X' | dd of=cache bs=1 seek=$((len - 30)) conv=notrunc status=none
+n=$(digests)
+[ "$n" -gt 0 ] && [ "$n" -le 2 ] || fail "a garbled record cost $n digests"
+[ "$(digests)" = 0 ] || fail "digests lost to a garbled record were not kept again"
+
+touch a/f1 b/f2
+[ "$(digests)" = 4 ] || fail "changed files were not hashed again"
+len=$(stat -c %s cache)
+"$UNIDUPE" --cache="$WORK/cache" --compact-cache > /dev/null
+[ "$(stat -c %s cache)" -lt "$len" ] || fail "compacting did not shrink the cache"
+[ "$(digests)" = 0 ] || fail "the compacted cache lost digests"
+
+"$UNIDUPE" --cache="$WORK/cache" --clear-cache > /dev/null
+[ ! -e cache ] || fail "clearing left the cache"
+[ "$(digests)" = 24 ] || fail "a cleared cache still held digests"
+[ "$(digests)" = 0 ] || fail "the cache was not rebuilt after clearing"
@@ -0,0 +1,108 @@
+/* file: disjoint_sets_test.cc
+ * ---------------------------
+ * DisjointSets groups ids as the connected components of the pairs united,
+ * which is what chaining duplicates under one another meant to build. The
+ * components are found again here by a search over the pairs.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "DisjointSets.h"
+#include "check.h"
+#include <vector>
+#include <random>
+#include <utility>
+
+using namespace std;
+
+
+/* function: components
+ * --------------------
+ * Smallest id of the component of each id, for n ids joined by pairs.
+ */
+static vector<uint32_t> components(uint32_t n, const vector<pair<uint32_t, uint32_t>>& pairs) {
+   vector<vector<uint32_t>> adjacent(n);
+   for (const pair<uint32_t, uint32_t>& p : pairs) {
+      adjacent[p.first].push_back(p.second);
+      adjacent[p.second].push_back(p.first);
+   }
+   vector<uint32_t> comp(n, UINT32_MAX);
+   for (uint32_t start = 0; start < n; start++) {
+      if (comp[start] != UINT32_MAX)
+         continue;
+      vector<uint32_t> stack(1, start);
+      comp[start] = start;
+      while (!stack.empty()) {
+         uint32_t id = stack.back();
+         stack.pop_back();
+         for (uint32_t next : adjacent[id]) {
+            if (comp[next] == UINT32_MAX) {
+               comp[next] = start;
+               stack.push_back(next);
+            }
+         }
+      }
+   }
+   return comp;
+}
+
+
+int main() {
+   mt19937 rng(42);
+   for (uint32_t n : {1u, 10u, 1000u, 20000u}) {
+      for (uint32_t edges : {n / 4, n / 2, n}) {
+         DisjointSets sets;
+         for (uint32_t i = 0; i < n; i++)
+            CHECK_EQ(sets.add(), i);
+         vector<pair<uint32_t, uint32_t>> pairs;
+         uniform_int_distribution<uint32_t> pick(0, n - 1);
+         for (uint32_t e = 0; e < edges; e++) {
+            // Chains of neighbours, as files sharing a path, and random
+            // pairs, as files sharing contents.
+            uint32_t a = pick(rng);
+            uint32_t b = (e % 2 == 0) ? min(a + 1, n - 1) : pick(rng);
+            pairs.push_back(make_pair(a, b));
+            bool joined = sets.unite(a, b);
+            CHECK(!joined || a != b);
+         }
+         vector<uint32_t> comp = components(n, pairs);
+         vector<uint32_t> count(n, 0);
+         for (uint32_t i = 0; i < n; i++)
+            count[comp[i]]++;
+         bool same = true, sized = true;
+         for (uint32_t i = 0; i < n; i++) {
+            same = same && (sets.find(i) == sets.find(comp[i]));
+            sized = sized && (sets.setSize(i) == count[comp[i]]);
+            // Ids of different components are in different sets.
+            uint32_t j = pick(rng);
+            same = same && ((sets.find(i) == sets.find(j)) == (comp[i] == comp[j]));
+         }
+         CHECK(same);
+         CHECK(sized);
+         CHECK(!sets.unite(pairs.empty() ? 0 : pairs[0].first,
+                           pairs.empty() ? 0 : pairs[0].second));
+      }
+   }
+   return checkFailures;
+}
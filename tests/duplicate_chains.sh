@@ -0,0 +1,22 @@
+# file: duplicate_chains.sh
+# -------------------------
+# Files joined through any chain of shared contents and shared paths end up
+# in one set: one of them is kept and all the others go to its history
+# folder, none lost and none split over several history folders.
+
+. "$(dirname "$0")/lib.sh"
+
+put a/x "1" 2020-01-01
+put b/x "2" 2021-01-01 # Shares a path with a/x,
+put b/y "1" 2022-01-01 # contents with a/x,
+put c/y "3" 2023-01-01 # and a path with b/y.
+put c/z "9" 2023-01-01
+merge a b c out > /dev/null
+
+hists=$(cd out && find . -name "*_hist" -type d)
+[ "$hists" = "./.y_hist" ] || fail "history folders: $hists"
+[ ! -e out/x ] || fail "out/x kept outside the set of y"
+kept=$(cat out/y)
+got=$( (echo "$kept"; for f in out/.y_hist/*; do cat "$f"; echo; done) | sort | tr '\n' ' ')
+[ "$got" = "1 1 2 3 " ] || fail "set of y holds $got"
+expect out/z "9"
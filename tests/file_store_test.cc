@@ -0,0 +1,156 @@
+/* file: file_store_test.cc
+ * ------------------------
+ * FileStore groups ids whose keys are equal, byte for byte, and only
+ * those, however keys collide in its table, as it grows, or as keys change.
+ * Groups are checked against a map from the bytes of each key.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "FileStore.h"
+#include "check.h"
+#include <vector>
+#include <map>
+#include <cstring>
+#include <string>
+#include <random>
+
+using namespace std;
+
+
+/* function: keyOf
+ * ---------------
+ * Content key of size whose digest starts with n, of the given split.
+ */
+static Digest keyOf(uint64_t size, uint64_t n, uint32_t split = 0,
+                    Digest::Kind kind = Digest::kContent) {
+   unsigned char res[Hasher::kMaxDigestLen] = {};
+   memcpy(res, &n, sizeof(n));
+   Digest key = Digest::of(kind, size, res, sizeof(res));
+   key.split = split;
+   return key;
+}
+
+
+/* function: checkGroups
+ * ---------------------
+ * Every id is in exactly one group, with the ids sharing its key, in id
+ * order, and find gives that group for the key.
+ */
+static void checkGroups(FileStore& store) {
+   map<string, vector<FileStore::Id>> want;
+   for (FileStore::Id id = 0; id < store.size(); id++) {
+      const Digest& key = store.key(id);
+      want[string((const char*)&key, sizeof(key))].push_back(id);
+   }
+   const vector<FileStore::Group>& groups = store.groups();
+   CHECK_EQ(groups.size(), want.size());
+   vector<int> seen(store.size(), 0);
+   for (const FileStore::Group& group : groups) {
+      const FileStore::Id* ids = store.members(group);
+      const Digest& key = store.key(ids[0]);
+      const vector<FileStore::Id>& same = want[string((const char*)&key, sizeof(key))];
+      CHECK(vector<FileStore::Id>(ids, ids + group.count) == same);
+      for (FileStore::Id i = 0; i < group.count; i++)
+         seen[ids[i]]++;
+      CHECK(store.find(key) == &group);
+   }
+   CHECK(seen == vector<int>(store.size(), 1));
+}
+
+
+int main() {
+   vector<FsNode> nodes(4096);
+   mt19937_64 rng(7);
+
+   // Keys alike but for one field each are told apart.
+   {
+      FileStore store;
+      vector<Digest> keys = {keyOf(10, 1), keyOf(11, 1), keyOf(10, 2),
+                             keyOf(10, 1, 1), keyOf(10, 1, 2),
+                             keyOf(10, 1, 0, Digest::kFingerprint),
+                             Digest::bySize(10), Digest::bySize(11)};
+      for (size_t i = 0; i < 2 * keys.size(); i++)
+         store.add(&nodes[i], keys[i % keys.size()]);
+      checkGroups(store);
+      CHECK_EQ(store.groups().size(), keys.size());
+      CHECK(store.find(keyOf(10, 1, 3)) == nullptr);
+      CHECK(store.find(Digest::bySize(12)) == nullptr);
+   }
+
+   // Keys landing on the same slot of a large table probe past each other,
+   // and keys missing from it are not found.
+   {
+      const size_t mask = (1 << 12) - 1;
+      vector<Digest> alike;
+      for (uint64_t n = 0; alike.size() < 40; n++) {
+         Digest key = keyOf(1000, n);
+         if ((key.hash() & mask) == 5)
+            alike.push_back(key);
+      }
+      FileStore store;
+      for (size_t i = 0; i < 1500; i++)
+         store.add(&nodes[i], i < 120 ? alike[i % 30] : keyOf(i, i));
+      checkGroups(store);
+      for (size_t i = 30; i < alike.size(); i++)
+         CHECK(store.find(alike[i]) == nullptr);
+   }
+
+   // Groups stay right as the table grows one file at a time, with few and
+   // many files per key.
+   for (uint64_t distinct : {1, 3, 50, 4096}) {
+      FileStore store;
+      for (size_t i = 0; i < 600; i++) {
+         store.add(&nodes[i], keyOf(rng() % distinct, 0));
+         checkGroups(store);
+      }
+   }
+
+   // Keys changed after grouping, as resolve and verify do, regroup, and
+   // so do stores merged together.
+   {
+      FileStore store, other;
+      for (size_t i = 0; i < 2000; i++)
+         store.add(&nodes[i], Digest::bySize(rng() % 300));
+      checkGroups(store);
+      for (int round = 0; round < 5; round++) {
+         for (size_t i = 0; i < 400; i++) {
+            FileStore::Id id = rng() % store.size();
+            Digest key = store.key(id);
+            key.kind = Digest::kContent;
+            key.split = rng() % 3;
+            store.setKey(id, key);
+         }
+         checkGroups(store);
+      }
+      for (size_t i = 2000; i < 2500; i++)
+         other.add(&nodes[i], Digest::bySize(rng() % 300));
+      store.merge(other);
+      CHECK_EQ(store.size(), 2500u);
+      CHECK_EQ(other.size(), 0u);
+      CHECK(other.groups().empty());
+      checkGroups(store);
+   }
+   return checkFailures;
+}
@@ -0,0 +1,156 @@
+/* file: hash_pipeline_test.cc
+ * ---------------------------
+ * HashPipeline fingerprints queued files and hashes the contents of files
+ * whose fingerprints collide while exploring, and resolve keys files with
+ * what was computed then, or throws the error computing it.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "HashPipeline.h"
+#include "FileStore.h"
+#include "NodeArena.h"
+#include "Metrics.h"
+#include "check.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+
+#include <unistd.h>
+
+using namespace std;
+
+static const size_t kBig = 64 << 10;
+
+
+/* function: put
+ * -------------
+ */
+static void put(const string& path, const string& contents) {
+   ofstream out(path, ios::binary);
+   out << contents;
+   if (!out)
+      throw runtime_error("Could not write " + path);
+}
+
+
+/* function: waitDigests
+ * ---------------------
+ * Waits up to ten seconds for n more digests to be computed than at base.
+ */
+static uint64_t waitDigests(uint64_t base, uint64_t n) {
+   Metrics& metrics = Metrics::get();
+   for (int i = 0; i < 1000; i++) {
+      if (metrics.value(Metrics::kDigestsComputed) - base >= n)
+         break;
+      this_thread::sleep_for(chrono::milliseconds(10));
+   }
+   return metrics.value(Metrics::kDigestsComputed) - base;
+}
+
+
+/* function: offerAll
+ * ------------------
+ * Adds the files at paths to store, keyed by size, and offers them to hasher
+ * as explorers do.
+ */
+static void offerAll(const vector<string>& paths, NodeArena& nodes,
+                     FileStore& store, HashPipeline& hasher) {
+   for (const string& path : paths) {
+      FsNode nd;
+      nd.name = nodes.intern(path); // A root, so its path is its name.
+      nd.kind = FsNode::kFile;
+      ifstream in(path, ios::binary | ios::ate);
+      nd.size = in ? (size_t)in.tellg() : kBig;
+      FsNode* made = nodes.make(nd);
+      store.add(made, Digest::bySize(nd.size));
+      hasher.offer(made);
+   }
+}
+
+
+int main() {
+   char tmpl[] = "/tmp/hash_pipeline_testXXXXXX";
+   string dir = mkdtemp(tmpl);
+   string same(kBig, 'a');
+   string middle = same;
+   middle[kBig / 2] = 'b';
+   string head = same;
+   head[0] = 'b';
+   put(dir + "/a", same);
+   put(dir + "/b", same);
+   put(dir + "/c", middle); // Same fingerprint as a, other contents.
+   put(dir + "/d", head); // Same size as a, other fingerprint.
+   put(dir + "/e", "small");
+   put(dir + "/f", "small");
+
+   HashPipeline::Options opts;
+   opts.threads = 2;
+   Metrics& metrics = Metrics::get();
+
+   // Hashers fingerprint a to d, hash the contents of a to c, whose
+   // fingerprints collide, and of e and f, before resolve is called.
+   {
+      NodeArena nodes;
+      FileStore store;
+      HashPipeline hasher(opts);
+      uint64_t base = metrics.value(Metrics::kDigestsComputed);
+      offerAll({dir + "/a", dir + "/b", dir + "/c", dir + "/d", dir + "/e",
+                dir + "/f"}, nodes, store, hasher);
+      CHECK_EQ(waitDigests(base, 9), 9u);
+      hasher.resolve(store);
+      CHECK_EQ(metrics.value(Metrics::kDigestsComputed) - base, 9u);
+      CHECK(store.key(0).kind == Digest::kContent);
+      CHECK(store.key(0) == store.key(1));
+      CHECK(store.key(2).kind == Digest::kContent);
+      CHECK(store.key(2) != store.key(0));
+      CHECK(store.key(3).kind == Digest::kFingerprint);
+      CHECK(store.key(4).kind == Digest::kContent);
+      CHECK(store.key(4) == store.key(5));
+   }
+
+   // A file which could not be read while exploring fails resolve.
+   {
+      NodeArena nodes;
+      FileStore store;
+      HashPipeline hasher(opts);
+      offerAll({dir + "/a", dir + "/missing"}, nodes, store, hasher);
+      bool threw = false;
+      try {
+         hasher.resolve(store);
+      } catch (exception&) {
+         threw = true;
+      }
+      CHECK(threw);
+   }
+
+   for (const char* name : {"a", "b", "c", "d", "e", "f"})
+      unlink((dir + "/" + name).c_str());
+   rmdir(dir.c_str());
+   return checkFailures;
+}
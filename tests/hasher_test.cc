@@ -0,0 +1,143 @@
+/* file: hasher_test.cc
+ * --------------------
+ * Known answers of each Hasher algo. Those of xxh128 cover every length
+ * class of XXH3-128, on the buffer xxHash's own sanity checks use, and were
+ * taken from the libxxhash shipped by the system, built apart from the copy
+ * vendored here. Each input is also hashed in uneven pieces, and again by
+ * a hasher reset after other input.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "Hasher.h"
+#include "check.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+struct Answer {
+   size_t len;
+   const char* digest;
+};
+
+static const Answer kXxh128[] = {
+   {0, "99aa06d3014798d86001c324468d497f"},
+   {1, "a6cd5e9392000f6ac44bdff4074eecdb"},
+   {6, "082afe0b8162d12a3e7039bdda43cfc6"},
+   {12, "6e3efd8fc7802b18061a192713f69ad9"},
+   {24, "0ce966e4678d37611e7044d28b1b901d"},
+   {48, "a002ac4e5478227ef942219aed80f67b"},
+   {80, "fdf2cefde9eaac8a454ae6bf7a8a532d"},
+   {195, "7729543a26b207ee3fb593c086a66075"},
+   {403, "1b6de21e332dd73dcdeb804d65c6dea4"},
+   {512, "18d2d110dcc9bca1617e49599013cb6b"},
+   {2048, "f736557fd47073a5dd59e2c3a5f038e0"},
+   {2240, "ccb134fbfa7ce49d6e73a90539cf2948"},
+   {2367, "e89c0f6ff369b427cb37aeb9e5d361ed"},
+   {4096, "b9cfaea2ca5626a4e91206429d1f48f9"},
+};
+
+
+/* function: sanityBuffer
+ * ----------------------
+ * Bytes of xxHash's sanity checks.
+ */
+static vector<unsigned char> sanityBuffer(size_t len) {
+   vector<unsigned char> buf(len);
+   uint64_t gen = 2654435761U;
+   for (size_t i = 0; i < len; i++) {
+      buf[i] = gen >> 56;
+      gen *= 11400714785074694797ULL;
+   }
+   return buf;
+}
+
+
+/* function: hex
+ * -------------
+ */
+static string hex(const unsigned char* digest, size_t len) {
+   string s;
+   char byte[3];
+   for (size_t i = 0; i < len; i++) {
+      snprintf(byte, sizeof(byte), "%02x", digest[i]);
+      s += byte;
+   }
+   return s;
+}
+
+
+/* function: digest
+ * ----------------
+ * Hex digest of data fed in pieces of growing length when split.
+ */
+static string digest(Hasher::Algo algo, const unsigned char* data, size_t len, bool split) {
+   unique_ptr<Hasher> hasher = Hasher::create(algo);
+   size_t piece = split ? 1 : len;
+   while (len > 0) {
+      size_t n = min(piece, len);
+      hasher->update(data, n);
+      data += n;
+      len -= n;
+      piece = piece * 3 + 1;
+   }
+   unsigned char res[Hasher::kMaxDigestLen];
+   hasher->final(res);
+   return hex(res, Hasher::digestLen(algo));
+}
+
+
+int main() {
+   const unsigned char* abc = (const unsigned char*)"abc";
+   CHECK_EQ(digest(Hasher::kMd5, abc, 3, false), "900150983cd24fb0d6963f7d28e17f72");
+   CHECK_EQ(digest(Hasher::kSha256, abc, 3, true),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+   vector<unsigned char> buf = sanityBuffer(4096);
+   for (const Answer& a : kXxh128) {
+      CHECK_EQ(digest(Hasher::kXxh128, buf.data(), a.len, false), a.digest);
+      CHECK_EQ(digest(Hasher::kXxh128, buf.data(), a.len, true), a.digest);
+   }
+   // A reset hasher forgets what it was fed before, finished or not.
+   for (Hasher::Algo algo : {Hasher::kMd5, Hasher::kSha256, Hasher::kXxh128}) {
+      unique_ptr<Hasher> hasher = Hasher::create(algo);
+      unsigned char res[Hasher::kMaxDigestLen];
+      hasher->update(buf.data(), 100);
+      hasher->final(res);
+      hasher->reset();
+      hasher->update(buf.data(), 7);
+      hasher->reset();
+      hasher->update(abc, 3);
+      hasher->final(res);
+      CHECK_EQ(hex(res, Hasher::digestLen(algo)), digest(algo, abc, 3, false));
+   }
+   Hasher::Algo algo;
+   CHECK(Hasher::parse("fast128", algo) && algo == Hasher::kXxh128);
+   CHECK(Hasher::parse("xxh128", algo) && algo == Hasher::kXxh128);
+   return checkFailures;
+}
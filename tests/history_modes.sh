@@ -0,0 +1,66 @@
+# file: history_modes.sh
+# ----------------------
+# --history=hardlink links older duplicates in history folders to the kept
+# copy. --history=pool keeps one object per contents in .unidupe_pool,
+# named by digest and size, and links history entries to it instead. Files
+# which only share a path with the kept one are copied in every mode, and
+# every mode writes the same names and contents, planned in memory or not.
+
+. "$(dirname "$0")/lib.sh"
+
+put a/x "same" 2020-01-01
+put b/x "same" 2021-01-01
+put c/x "same" 2019-01-01
+put a/y "one" 2020-01-01
+put a/z "dup" 2020-01-01
+sleep 0.05 # Inputs are dated by when they last changed.
+put b/y "two" 2021-01-01
+put b/w "dup" 2021-01-01
+
+ino() {
+   stat -c %i "$1"
+}
+
+# Fails unless every path given shares the inode of the first.
+same_file() {
+   for f in "$@"; do
+      [ "$(ino "$f")" = "$(ino "$1")" ] || fail "$mode$limit: $f is not $1"
+   done
+}
+
+# Fails unless path is a file of its own with contents text.
+own_copy() {
+   expect "$1" "$2"
+   [ "$(stat -c %h "$1")" = 1 ] || fail "$mode$limit: $1 is linked"
+}
+
+rm -rf out
+merge a b c out > /dev/null
+listing out > copy.txt
+for limit in "" --memory-limit=8M; do
+   for mode in hardlink pool; do
+      rm -rf out
+      merge --history=$mode $limit a b c out > /dev/null
+      own_copy out/.y_hist/y "one"
+      expect out/y "two"
+      if [ $mode = hardlink ]; then
+         same_file out/x out/.x_hist/x out/.x_hist/x.~1~
+         same_file out/w out/.w_hist/z
+      else
+         own_copy out/x "same"
+         own_copy out/w "dup"
+         objs=$(ls out/.unidupe_pool)
+         [ "$(echo "$objs" | wc -l)" = 2 ] ||
+            fail "$mode$limit: pool holds $(echo $objs)"
+         for text in same dup; do
+            obj=out/.unidupe_pool/$(printf '%s' "$text" | md5sum | cut -d' ' -f1)-${#text}
+            expect "$obj" "$text"
+         done
+         same_file out/.unidupe_pool/*-4 out/.x_hist/x out/.x_hist/x.~1~
+         same_file out/.unidupe_pool/*-3 out/.w_hist/z
+         rm -r out/.unidupe_pool
+      fi
+      listing out | cmp -s - copy.txt ||
+         fail "$mode$limit: names or contents differ from --history=copy"
+   done
+done
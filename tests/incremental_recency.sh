@@ -0,0 +1,20 @@
+# file: incremental_recency.sh
+# ----------------------------
+# --incremental judges the files of pathout by their mtime, which earlier
+# runs kept whether steps ran in process or as cp commands. A newer input
+# made before pathout was written still replaces the older copy there.
+
+. "$(dirname "$0")/lib.sh"
+
+put a1/f "old" 2020-01-01
+put a2/g "other" 2020-01-01
+put b/f "newer-version" 2021-01-01
+sleep 1
+for mode in --fork-commands ""; do
+   rm -rf out
+   merge $mode a1 a2 out > /dev/null
+   merge $mode --incremental b out > /dev/null
+   expect out/f "newer-version"
+   expect out/.f_hist/f "old"
+   expect out/g "other"
+done
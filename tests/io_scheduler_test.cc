@@ -0,0 +1,173 @@
+/* file: io_scheduler_test.cc
+ * -------------------------
+ * IoScheduler never runs more items of a device at once than its slots,
+ * runs devices side by side, and tunes slots to the device: up for one
+ * serving many items at once as fast as one, down for one serving a single
+ * item at a time.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "IoScheduler.h"
+#include "check.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+struct Device {
+   atomic<unsigned> running{0};
+   atomic<unsigned> peak{0};
+   mutex serial; // Held by each item of a device serving one at a time.
+};
+
+
+/* function: raiseTo
+ * -----------------
+ * Sets most to v if v is larger.
+ */
+static void raiseTo(atomic<unsigned>& most, unsigned v) {
+   unsigned seen = most;
+   while (v > seen && !most.compare_exchange_weak(seen, v)) {}
+}
+
+
+/* function: run
+ * -------------
+ * Runs items[d] items reading from device d and writing to writesTo[d]
+ * for each d, on threads threads, each item sleeping ms, one at a time on
+ * serial devices. Returns the stats.
+ */
+static vector<IoScheduler::DeviceStats> run(IoScheduler& sched, unsigned threads,
+                                            const vector<uint32_t>& items,
+                                            const vector<dev_t>& writesTo,
+                                            const vector<bool>& serial, int ms,
+                                            vector<Device>& devices,
+                                            atomic<unsigned>& together) {
+   for (uint32_t k = 0, pushed = 0; pushed < items.size(); k++) {
+      pushed = 0;
+      for (dev_t d = 0; d < items.size(); d++) {
+         if (k < items[d])
+            sched.push(k, d, writesTo[d]);
+         else
+            pushed++;
+      }
+   }
+   auto work = [&]() {
+      uint32_t item;
+      dev_t d, to;
+      while (sched.take(item, d, to)) {
+         Device& dev = devices[d];
+         raiseTo(dev.peak, ++dev.running);
+         if (to != d)
+            raiseTo(devices[to].peak, ++devices[to].running);
+         unsigned busy = 0;
+         for (Device& other : devices)
+            busy += other.running > 0;
+         raiseTo(together, busy);
+         if (serial[d]) {
+            lock_guard<mutex> lk(dev.serial);
+            this_thread::sleep_for(chrono::milliseconds(ms));
+         } else {
+            this_thread::sleep_for(chrono::milliseconds(ms));
+         }
+         dev.running--;
+         if (to != d)
+            devices[to].running--;
+         sched.done(d, to, 1 << 20);
+      }
+   };
+   vector<thread> workers;
+   for (unsigned w = 0; w < threads; w++)
+      workers.emplace_back(work);
+   sched.wait();
+   sched.close();
+   for (thread& t : workers)
+      t.join();
+   return sched.stats();
+}
+
+
+int main() {
+   // Fixed slots: two per device, both devices busy at once.
+   {
+      IoScheduler sched(2, false);
+      vector<Device> devices(2);
+      atomic<unsigned> together(0);
+      vector<IoScheduler::DeviceStats> stats =
+         run(sched, 8, {200, 200}, {0, 1}, {false, false}, 1, devices, together);
+      CHECK_EQ(stats.size(), 2u);
+      for (size_t d = 0; d < stats.size(); d++) {
+         CHECK_EQ(stats[d].items, 200u);
+         CHECK_EQ(stats[d].bytes, 200u << 20);
+         CHECK(devices[d].peak <= 2);
+         CHECK_EQ(stats[d].peak, devices[d].peak.load());
+      }
+      CHECK_EQ(together.load(), 2u);
+   }
+   // Tuned slots: device 0 serves any number at once, device 1 one at a
+   // time.
+   {
+      IoScheduler sched(8, true);
+      vector<Device> devices(2);
+      atomic<unsigned> together(0);
+      vector<IoScheduler::DeviceStats> stats =
+         run(sched, 16, {6000, 1200}, {0, 1}, {false, true}, 2, devices, together);
+      CHECK(devices[0].peak <= 8 && devices[1].peak <= 8);
+      CHECK(stats[0].peak >= 5);
+      CHECK(stats[1].slots <= 3);
+      CHECK(stats[1].slots < stats[0].slots);
+   }
+   // Copies from two devices to a third: reads from both overlap, while
+   // the slots of the device written to bound the two together.
+   {
+      IoScheduler sched(2, false);
+      vector<Device> devices(3);
+      atomic<unsigned> together(0);
+      vector<IoScheduler::DeviceStats> stats =
+         run(sched, 8, {200, 200}, {2, 2}, {false, false}, 1, devices, together);
+      CHECK_EQ(stats.size(), 3u);
+      CHECK(devices[2].peak <= 2);
+      CHECK_EQ(devices[2].peak.load(), 2u);
+      for (const IoScheduler::DeviceStats& st : stats) {
+         CHECK_EQ(st.items, st.dev == 2 ? 400u : 200u);
+         CHECK_EQ(st.peak, devices[st.dev].peak.load());
+      }
+   }
+   // Nothing is taken after abort.
+   {
+      IoScheduler sched(4, true);
+      sched.push(0, 1, 1);
+      sched.abort();
+      uint32_t item;
+      dev_t d, to;
+      CHECK(!sched.take(item, d, to));
+      sched.wait();
+   }
+   return checkFailures;
+}
@@ -0,0 +1,40 @@
+# file: lib.sh
+# ------------
+# Sourced by each check, run as `bash tests/NAME.sh path/to/unidupe`. Gives
+# it a scratch folder, removed on exit, and helpers to build trees and
+# compare outputs.
+
+set -eu
+UNIDUPE=$(realpath "$1")
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/unidupe_check.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+# Reports the failure of the current check and stops it.
+fail() {
+   echo "FAIL: $(basename "$0" .sh): $*" >&2
+   exit 1
+}
+
+# Writes text to path, making its folder, with mtime set to date.
+put() {
+   mkdir -p "$(dirname "$1")"
+   printf '%s' "$2" > "$1"
+   touch -d "$3" "$1"
+}
+
+# Runs unidupe, answering Y when it asks whether to proceed.
+merge() {
+   echo Y | "$UNIDUPE" --no-progress --hide-inputs "$@"
+}
+
+# Path and md5 of every file under dir, one per line, sorted.
+listing() {
+   (cd "$1" && find . -type f -exec md5sum {} + | awk '{ print $2, $1 }' | sort)
+}
+
+# Contents of the file at path, or fails the check if it has other ones.
+expect() {
+   [ "$(cat "$1" 2>/dev/null)" = "$2" ] ||
+      fail "$1 holds '$(cat "$1" 2>/dev/null)', not '$2'"
+}
@@ -0,0 +1,46 @@
+# file: many_inputs.sh
+# --------------------
+# Merging four inputs keeps the most recent of the files found at one path
+# in any of them, and keeps all the others in its history folder, most
+# recent first, whatever order the inputs are given in. Inputs are dated
+# by when they last changed, so files are written oldest first.
+
+. "$(dirname "$0")/lib.sh"
+
+# Writes text to path, after the files written before it changed.
+newer() {
+   sleep 0.05
+   put "$1" "$2" 2020-01-01
+}
+
+newer d/f "d-f"
+newer a/f "a-f"
+newer c/g "same"
+newer a/s/k "a-k"
+newer c/f "c-f"
+newer a/g "same"
+newer d/s/k "d-k"
+newer b/f "b-f"
+newer b/g "same"
+newer c/s/k "c-k"
+newer c/h "only"
+
+for inputs in "a b c d" "d c b a" "b d a c"; do
+   rm -rf out
+   merge $inputs out > /dev/null
+   expect out/f "b-f"
+   expect out/.f_hist/f.~1~ "c-f"
+   expect out/.f_hist/f.~2~ "a-f"
+   expect out/.f_hist/f "d-f"
+   expect out/g "same"
+   expect out/.g_hist/g.~1~ "same"
+   expect out/.g_hist/g "same"
+   expect out/s/k "c-k"
+   expect out/s/.k_hist/k.~1~ "d-k"
+   expect out/s/.k_hist/k "a-k"
+   expect out/h "only"
+   [ "$(find out -type f | wc -l)" = 11 ] || fail "$inputs: $(find out -type f)"
+   listing out > "listing $inputs"
+   cmp -s "listing $inputs" "listing a b c d" ||
+      fail "inputs $inputs give another output than a b c d"
+done
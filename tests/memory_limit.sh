@@ -0,0 +1,38 @@
+# file: memory_limit.sh
+# ---------------------
+# Planning out of core with --memory-limit makes the same tree as planning
+# in memory, in each history mode, including with size groups too large to
+# hash in one batch, and with a set of duplicates joined through a long
+# chain of shared paths and shared contents.
+
+. "$(dirname "$0")/lib.sh"
+
+for t in a b c; do
+   for i in $(seq 600); do
+      # Contents repeat across trees and within them; many files share a
+      # size, and some share a path with different contents.
+      put $t/d$((i % 9))/e$((i % 4))/f$i "$((i % 250))-$((i % 7 == 0 ? 1 : 0))$t" \
+         "2020-01-0$((i % 9 + 1))"
+   done
+   put $t/same "shared contents" 2020-01-01
+done
+# More files of one size than a batch of 8M holds, some of them equal.
+mkdir b/big
+long=$(printf 'n%.0s' $(seq 150))
+for i in $(seq 4000); do
+   printf '%08d' $((i % 3000)) > b/big/$long$i
+done
+# a/pI and b/pI share a path, b/pI and a/pI+1 their contents, so all are
+# one set, which spreading labels would only find after 400 passes.
+for i in $(seq 200); do
+   put a/chain/p$i "link $i" 2020-01-01
+   put b/chain/p$i "link $((i + 1))" 2020-01-02
+done
+for hist in copy pool; do
+   rm -rf in_memory out_of_core
+   merge --history=$hist a b c in_memory > /dev/null
+   merge --history=$hist --memory-limit=8M --spill-dir="$WORK" a b c out_of_core > log 2>&1 ||
+      fail "--memory-limit failed: $(cat log)"
+   [ "$(listing in_memory)" = "$(listing out_of_core)" ] ||
+      fail "$hist: $(diff <(listing in_memory) <(listing out_of_core) | head)"
+done
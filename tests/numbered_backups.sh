@@ -0,0 +1,37 @@
+# file: numbered_backups.sh
+# -------------------------
+# A copy onto an existing name moves that file aside first, numbered as cp
+# --backup=numbered does, and keeps the mode and mtime of its source. Runs
+# in process and as cp commands leave the same files behind.
+
+. "$(dirname "$0")/lib.sh"
+
+# Name, mode, mtime and contents of every file of out, sorted by name.
+files() {
+   (cd out && for f in $(ls -A); do
+      echo "$f $(stat -c '%a %Y' "$f") $(cat "$f")"
+   done)
+}
+
+mkdir -p b
+put b/g "other" 2020-01-01
+for mode in --fork-commands ""; do
+   rm -rf out
+   n=0
+   for text in one two three; do
+      n=$((n + 1))
+      put a/f "$text" 2020-01-0$n
+      chmod 64$n a/f
+      merge $mode a b out > /dev/null
+   done
+   expect out/f "three"
+   expect out/f.~1~ "one"
+   expect out/f.~2~ "two"
+   [ ! -e out/f.~3~ ] || fail "a third backup of f was made"
+   [ "$(stat -c '%a %Y' out/f)" = "$(stat -c '%a %Y' a/f)" ] ||
+      fail "the copy of f did not keep its mode and mtime"
+   [ "$(stat -c %a out/f.~1~)" = 641 ] || fail "the first backup changed mode"
+   files > "files$mode"
+done
+cmp -s files files--fork-commands ||
+   fail "copies in process and as cp commands differ: $(diff files files--fork-commands)"
@@ -0,0 +1,33 @@
+# file: read_buffer.sh
+# --------------------
+# Hashing files much larger than --max-read-buffer keeps the peak resident
+# set of unidupe far below their size. unidupe waits at its prompt once the
+# plan is made, hashing done, which is when its VmHWM is read.
+
+. "$(dirname "$0")/lib.sh"
+
+size=$((256 << 20))
+mkdir a b
+head -c "$size" /dev/urandom > a/big
+cp a/big b/big
+mkfifo answer
+"$UNIDUPE" --no-progress --hide-inputs --hash-threads=2 --scan-threads=1 \
+   --max-read-buffer=4M a b out < answer > log 2>&1 &
+pid=$!
+exec 3> answer
+hwm=
+for i in $(seq 600); do
+   if grep -q "proceed" log; then
+      hwm=$(awk '/^VmHWM/ { print $2 }' /proc/$pid/status)
+      break
+   fi
+   kill -0 $pid 2> /dev/null || break
+   sleep 0.1
+done
+echo n >&3
+exec 3>&-
+wait $pid || fail "unidupe failed: $(cat log)"
+[ -n "$hwm" ] || fail "unidupe never asked to proceed: $(cat log)"
+# Two buffers of 4M, and the rest of the process.
+[ "$hwm" -lt $((64 << 10)) ] ||
+   fail "peak resident set of ${hwm}K hashing two files of $((size >> 20))M"
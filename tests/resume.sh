@@ -0,0 +1,38 @@
+# file: resume.sh
+# ---------------
+# A plan whose run is killed part way, then resumed from its journal, makes
+# the same tree as a run left alone: steps done are not run again, and
+# steps under way are only run again when what they make is missing.
+
+. "$(dirname "$0")/lib.sh"
+
+for i in $(seq 400); do
+   put a/d$((i % 7))/f$i "a$i" 2020-01-01
+   put b/d$((i % 5))/f$i "b$((i % 3))" 2021-01-01
+done
+merge --fork-commands a b ref > /dev/null
+
+echo n | "$UNIDUPE" --no-progress --hide-inputs --plan=plan a b out > /dev/null
+"$UNIDUPE" --no-progress --fork-commands --jobs=4 --resume=plan > log 2>&1 &
+pid=$!
+# Killed once the journal holds a few records past its header.
+while kill -0 $pid 2> /dev/null && [ "$(stat -c %s plan.journal 2>/dev/null || echo 0)" -lt 400 ]; do
+   sleep 0.01
+done
+{ kill -9 $pid && wait $pid; } 2> /dev/null || true
+grep -q "steps done in an earlier run" log && fail "first run found a journal"
+
+"$UNIDUPE" --no-progress --fork-commands --jobs=4 --resume=plan > log 2>&1 ||
+   fail "resume failed: $(cat log)"
+grep -q "interrupted steps found done\|steps done in an earlier run" log ||
+   fail "the first run was not interrupted: $(cat log)"
+[ "$(listing out)" = "$(listing ref)" ] ||
+   fail "resumed output differs: $(diff <(listing ref) <(listing out) | head)"
+
+# Every step is journaled as done now, so none runs again.
+"$UNIDUPE" --no-progress --resume=plan > log 2>&1 || fail "resume failed: $(cat log)"
+steps=$(grep -o "^[0-9]* of [0-9]* steps done in an earlier run" log) ||
+   fail "no steps found done: $(cat log)"
+set -- $steps
+[ "$1" = "$3" ] || fail "$steps"
+[ "$(listing out)" = "$(listing ref)" ] || fail "second resume changed the output"
@@ -0,0 +1,122 @@
+/* file: step_graph_test.cc
+ * ------------------------
+ * StepGraph runs every step once, after the steps it depends on, and runs
+ * held steps, those waiting on steps which never release them, after all
+ * others, one at a time with the steps they hold.
+ *
+ * -----------------------------------------------------------------
+ *  MIT License
+ *
+ *  Copyright (c) 2017 dansternik (Dominique Piens)
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "StepGraph.h"
+#include "EditStep.h"
+#include "check.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+
+
+/* function: runGraph
+ * ------------------
+ * Runs a graph of n steps in which step i + 1 depends on step i for each i
+ * in chained, and steps in held wait on one more step than depends on
+ * them. Each step held after the first also holds the next one. Returns
+ * the order steps ran in.
+ */
+static vector<uint32_t> runGraph(uint32_t n, const vector<uint32_t>& chained,
+                                 const vector<uint32_t>& held, unsigned threads) {
+   vector<EditStep> steps;
+   for (uint32_t i = 0; i < n; i++)
+      steps.push_back(EditStep("mkdir", {"mkdir", "-p", "/step" + to_string(i)}));
+   vector<vector<uint32_t>> out(n);
+   vector<uint32_t> dependencies(n, 0);
+   for (uint32_t i : chained) {
+      out[i].push_back(i + 1);
+      dependencies[i + 1]++;
+   }
+   for (size_t k = 0; k < held.size(); k++) {
+      dependencies[held[k]]++;
+      if (k + 1 < held.size()) {
+         out[held[k]].push_back(held[k + 1]);
+         dependencies[held[k + 1]]++;
+      }
+   }
+   vector<uint32_t> first, dependents;
+   for (uint32_t i = 0; i < n; i++) {
+      first.push_back(dependents.size());
+      dependents.insert(dependents.end(), out[i].begin(), out[i].end());
+   }
+   first.push_back(dependents.size());
+   StepGraph graph(steps, first, dependents, dependencies);
+   mutex m;
+   vector<uint32_t> order;
+   atomic<unsigned> badWorker(0);
+   graph.run(threads, [&](const EditStep& step, unsigned worker) -> uint64_t {
+      if (worker >= threads)
+         badWorker++;
+      lock_guard<mutex> lk(m);
+      order.push_back(&step - steps.data());
+      return 0;
+   });
+   CHECK_EQ(badWorker.load(), 0u);
+   return order;
+}
+
+
+/* function: position
+ * ------------------
+ */
+static vector<size_t> position(const vector<uint32_t>& order, uint32_t n) {
+   vector<size_t> pos(n, SIZE_MAX);
+   for (size_t k = 0; k < order.size(); k++)
+      pos[order[k]] = k;
+   return pos;
+}
+
+
+int main() {
+   // 0 -> 1 -> 2, 3 free, 4 and 5 held, 5 also behind 4.
+   for (unsigned threads : {1u, 4u}) {
+      vector<uint32_t> order = runGraph(6, {0, 1}, {4, 5}, threads);
+      CHECK_EQ(order.size(), 6u);
+      vector<size_t> pos = position(order, 6);
+      CHECK(pos[0] < pos[1] && pos[1] < pos[2]);
+      CHECK(pos[4] >= 4 && pos[5] == pos[4] + 1);
+   }
+   // Many held steps, each run once, in plan order.
+   uint32_t n = 2000;
+   vector<uint32_t> held;
+   for (uint32_t i = 1000; i < n; i++)
+      held.push_back(i);
+   vector<uint32_t> order = runGraph(n, {}, held, 8);
+   CHECK_EQ(order.size(), n);
+   vector<size_t> pos = position(order, n);
+   bool inOrder = true;
+   for (uint32_t i = 1000; i < n; i++)
+      inOrder = inOrder && pos[i] == i;
+   CHECK(inOrder);
+   return checkFailures;
+}
@@ -44,45 +44,413 @@
 
 #include "FsTree.h"
 #include "FsNode.h"
+#include "FileStore.h"
+#include "NodeArena.h"
+#include "FileReader.h"
+#include "HashPipeline.h"
+#include "DigestCache.h"
+#include "Hasher.h"
+#include "Plan.h"
+#include "ExternalMerge.h"
+#include "NearDupes.h"
+#include "Metrics.h"
+#include "TreePrinter.h"
 #include <iostream>
 #include <string>
 #include <unordered_map>
-#include <list>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
 
 using namespace std;
 
+/* function: printUsage
+ * --------------------
+ */
+static void printUsage() {
+   cerr << "\tUsage: unidupe [options] pathin1 pathin2 [pathin...] pathout" << endl;
+   cerr << "\t       unidupe [options] --incremental pathin [pathin...] pathout" << endl;
+   cerr << "\t       unidupe [--jobs=N] [--fork-commands] --resume=FILE" << endl;
+   cerr << "\t       unidupe [--cache=FILE] --compact-cache|--clear-cache" << endl;
+   cerr << "\t  --max-read-buffer=SIZE  Bytes of a file held in memory at"
+           " once while hashing (default 64M)" << endl;
+   cerr << "\t  --scan-threads=N        Threads exploring directories"
+           " (default: one per CPU)" << endl;
+   cerr << "\t  --hash-threads=N        Threads hashing file contents"
+           " (default: one per CPU)" << endl;
+   cerr << "\t  --io-uring              Read files to hash through io_uring,"
+           " many at a time" << endl;
+   cerr << "\t  --hash=ALGO             Digest of file contents: md5, sha256 or"
+           " xxh128 (default md5)" << endl;
+   cerr << "\t  --verify, --no-verify   Compare files with equal digests byte"
+           " by byte (default: with xxh128 only)" << endl;
+   cerr << "\t  --history=MODE          Older duplicates as copy, hardlink or"
+           " reflink of the kept copy, or pool (default copy)" << endl;
+   cerr << "\t  --incremental           Fold inputs into pathout, the output of"
+           " an earlier merge" << endl;
+   cerr << "\t  --near-dupes[=PERCENT]  Keep files sharing PERCENT of their chunks"
+           " in history together (default 90)" << endl;
+   cerr << "\t  --chunk-size=SIZE       Average chunk length of --near-dupes"
+           " (default 8K)" << endl;
+   cerr << "\t  --bulk-copy             Copy folders identical in every input in"
+           " one step, without history" << endl;
+   cerr << "\t  --jobs=N                Steps of the plan run at once"
+           " (default: one per CPU)" << endl;
+   cerr << "\t  --fork-commands         Run a cp or mkdir process per step rather"
+           " than copying within unidupe" << endl;
+   cerr << "\t  --plan=FILE             Save the plan to FILE and journal its"
+           " execution, so it can be resumed" << endl;
+   cerr << "\t  --resume=FILE           Run the plan saved in FILE, skipping steps"
+           " done by an earlier run" << endl;
+   cerr << "\t  --progress, --no-progress  Show rates and time left on stderr"
+           " (default: if stderr is a terminal)" << endl;
+   cerr << "\t  --stats=FILE            Write counters and time spent in each"
+           " phase to FILE as JSON" << endl;
+   cerr << "\t  --memory-limit=SIZE     Plan out of core, holding about SIZE bytes"
+           " whatever the number of files" << endl;
+   cerr << "\t  --spill-dir=DIR         Folder for records spilled by"
+           " --memory-limit (default $TMPDIR, else /var/tmp)" << endl;
+   cerr << "\t  --print-depth=N         List trees N levels deep, with the count"
+           " of what deeper folders hold" << endl;
+   cerr << "\t  --print-entries=N       List N entries of a folder, with the"
+           " count of the rest" << endl;
+   cerr << "\t  --hide-inputs           List the planned tree only, not the input"
+           " trees" << endl;
+   cerr << "\t  --cache[=FILE]          Reuse digests of files unchanged since"
+           " a previous run (default " << DigestCache::defaultPath() << ")" << endl;
+   cerr << "\t  --compact-cache         Drop superseded entries from the cache"
+           << endl;
+   cerr << "\t  --clear-cache           Delete the cache" << endl;
+}
+
+
+/* function: parseSize
+ * -------------------
+ * Parses a byte count with an optional K, M or G suffix into size.
+ */
+static bool parseSize(const char* arg, size_t& size) {
+   char* end;
+   errno = 0;
+   unsigned long long v = strtoull(arg, &end, 10);
+   if (errno != 0 || end == arg)
+      return false;
+   switch (*end) {
+      case 'G': case 'g': v <<= 10; // fall through
+      case 'M': case 'm': v <<= 10; // fall through
+      case 'K': case 'k': v <<= 10; end++; break;
+   }
+   if (*end != '\0')
+      return false;
+   size = v;
+   return true;
+}
+
+
+/* function: parseCount
+ * --------------------
+ * Parses a strictly positive count.
+ */
+static bool parseCount(const char* arg, unsigned& count) {
+   char* end;
+   errno = 0;
+   unsigned long v = strtoul(arg, &end, 10);
+   if (errno != 0 || end == arg || *end != '\0' || v == 0 || v > 4096)
+      return false;
+   count = v;
+   return true;
+}
+
+
+/* function: finish
+ * ----------------
+ * Stops the progress line and writes the --stats report, if asked for.
+ */
+static void finish(const string& statsPath) {
+   Metrics::get().stopProgress();
+   if (!statsPath.empty())
+      Metrics::get().writeJson(statsPath);
+}
+
+
 int main(int argc, char** argv) {
    cout << "\t\t--== unidupe ==--\t\t" << endl;
 
-   // TODO Change internals so more than two directories can be merged in
-   // one call by repeatedly merging the previous result of a merge with
-   // the next directory.
-
-   // Get input paths from args.
-   if (argc != 4) {
-      cerr << "Error: Expected 3 arguments." << endl;
-      cerr << "\tUsage: unidupe pathin1 pathin2 pathout" << endl;
+   // Get options, then input paths from args.
+   HashPipeline::Options hashOpts;
+   unsigned scanThreads = max(1u, thread::hardware_concurrency());
+   hashOpts.threads = scanThreads;
+   enum { kVerifyDefault, kVerify, kNoVerify } verify = kVerifyDefault;
+   bool useCache = false;
+   unsigned jobs = scanThreads;
+   bool forkCommands = false;
+   bool incremental = false;
+   FsTree::History history = FsTree::kHistCopy;
+   string cachePath = DigestCache::defaultPath();
+   string planPath;
+   string resumePath;
+   string statsPath;
+   bool progress = isatty(STDERR_FILENO);
+   TreePrinter::Options printOpts;
+   unsigned printEntries = 0;
+   bool hideInputs = false;
+   size_t memoryLimit = 0;
+   bool nearDupes = false;
+   bool bulkCopy = false;
+   NearDupes::Options nearOpts;
+   size_t chunkSize = nearOpts.chunking.avgLen;
+   bool readBufferSet = false;
+   const char* tmpdir = getenv("TMPDIR");
+   string spillDir = (tmpdir != nullptr && *tmpdir != '\0') ? tmpdir : "/var/tmp";
+   enum { kMerge, kCompactCache, kClearCache } command = kMerge;
+   static const struct option longopts[] = {
+      {"max-read-buffer", required_argument, nullptr, 'b'},
+      {"scan-threads", required_argument, nullptr, 's'},
+      {"hash-threads", required_argument, nullptr, 'h'},
+      {"io-uring", no_argument, nullptr, 'u'},
+      {"hash", required_argument, nullptr, 'H'},
+      {"verify", no_argument, nullptr, 'v'},
+      {"no-verify", no_argument, nullptr, 'V'},
+      {"cache", optional_argument, nullptr, 'c'},
+      {"compact-cache", no_argument, nullptr, 'C'},
+      {"clear-cache", no_argument, nullptr, 'X'},
+      {"fork-commands", no_argument, nullptr, 'F'},
+      {"history", required_argument, nullptr, 'y'},
+      {"jobs", required_argument, nullptr, 'j'},
+      {"incremental", no_argument, nullptr, 'I'},
+      {"plan", required_argument, nullptr, 'p'},
+      {"resume", required_argument, nullptr, 'r'},
+      {"stats", required_argument, nullptr, 'S'},
+      {"progress", no_argument, nullptr, 'g'},
+      {"no-progress", no_argument, nullptr, 'G'},
+      {"print-depth", required_argument, nullptr, 'd'},
+      {"print-entries", required_argument, nullptr, 'e'},
+      {"hide-inputs", no_argument, nullptr, 'i'},
+      {"memory-limit", required_argument, nullptr, 'M'},
+      {"spill-dir", required_argument, nullptr, 'T'},
+      {"near-dupes", optional_argument, nullptr, 'N'},
+      {"chunk-size", required_argument, nullptr, 'z'},
+      {"bulk-copy", no_argument, nullptr, 'B'},
+      {nullptr, 0, nullptr, 0}
+   };
+   int opt;
+   while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+      if (opt == 'b' && parseSize(optarg, hashOpts.maxReadBuffer)) {
+         readBufferSet = true;
+         continue;
+      }
+      if (opt == 'M' && parseSize(optarg, memoryLimit) &&
+          memoryLimit >= ExternalMerge::kMinMemory)
+         continue;
+      if (opt == 'T') {
+         spillDir = optarg;
+         continue;
+      }
+      if (opt == 'N' && (optarg == nullptr ||
+                         (parseCount(optarg, nearOpts.percent) && nearOpts.percent <= 100))) {
+         nearDupes = true;
+         continue;
+      }
+      if (opt == 'z' && parseSize(optarg, chunkSize) && chunkSize >= 256 &&
+          chunkSize <= (16 << 20))
+         continue;
+      if (opt == 's' && parseCount(optarg, scanThreads))
+         continue;
+      if (opt == 'h' && parseCount(optarg, hashOpts.threads))
+         continue;
+      if (opt == 'u') {
+         hashOpts.useUring = true;
+         continue;
+      }
+      if (opt == 'H' && Hasher::parse(optarg, hashOpts.algo))
+         continue;
+      if (opt == 'v' || opt == 'V') {
+         verify = (opt == 'v') ? kVerify : kNoVerify;
+         continue;
+      }
+      if (opt == 'y' && FsTree::parseHistory(optarg, history))
+         continue;
+      if (opt == 'j' && parseCount(optarg, jobs))
+         continue;
+      if (opt == 'I') {
+         incremental = true;
+         continue;
+      }
+      if (opt == 'p' || opt == 'r' || opt == 'S') {
+         (opt == 'p' ? planPath : opt == 'r' ? resumePath : statsPath) = optarg;
+         continue;
+      }
+      if (opt == 'g' || opt == 'G') {
+         progress = (opt == 'g');
+         continue;
+      }
+      if (opt == 'd' && parseCount(optarg, printOpts.maxDepth))
+         continue;
+      if (opt == 'e' && parseCount(optarg, printEntries)) {
+         printOpts.maxEntries = printEntries;
+         continue;
+      }
+      if (opt == 'i' || opt == 'B') {
+         (opt == 'i' ? hideInputs : bulkCopy) = true;
+         continue;
+      }
+      if (opt == 'F') {
+         forkCommands = true;
+         continue;
+      }
+      if (opt == 'c') {
+         useCache = true;
+         if (optarg != nullptr) cachePath = optarg;
+         continue;
+      }
+      if (opt == 'C' || opt == 'X') {
+         command = (opt == 'C') ? kCompactCache : kClearCache;
+         continue;
+      }
+      if (opt == 'b' || opt == 's' || opt == 'h' || opt == 'H' || opt == 'y' ||
+          opt == 'j' || opt == 'd' || opt == 'e' || opt == 'M' || opt == 'N' ||
+          opt == 'z')
+         cerr << "Error: Invalid value " << optarg << endl;
+      printUsage();
+      return -1;
+   }
+   if (command == kCompactCache) {
+      DigestCache cache(cachePath);
+      cache.compact();
+      cout << "Compacted " << cachePath << " to " << cache.size()
+           << " entries." << endl;
+      return 0;
+   }
+   if (command == kClearCache) {
+      if (unlink(cachePath.c_str()) < 0 && errno != ENOENT) {
+         cerr << "Error: Could not remove " << cachePath << endl;
+         return -1;
+      }
+      cout << "Cleared " << cachePath << endl;
+      return 0;
+   }
+   if (progress)
+      Metrics::get().startProgress();
+   if (!resumePath.empty()) {
+      if (optind != argc) {
+         cerr << "Error: --resume takes no paths." << endl;
+         printUsage();
+         return -1;
+      }
+      Plan plan(resumePath);
+      cout << "Resuming " << resumePath << ", " << plan.size() << " steps."
+           << endl;
+      plan.run(jobs, forkCommands, true);
+      finish(statsPath);
+      return 0;
+   }
+   if (memoryLimit > 0 && (incremental || nearDupes || bulkCopy)) {
+      cerr << "Error: " << (incremental ? "--incremental" :
+                            nearDupes ? "--near-dupes" : "--bulk-copy")
+           << " does not work with --memory-limit." << endl;
+      return -1;
+   }
+   int minArgs = incremental ? 2 : 3;
+   if (argc - optind < minArgs) {
+      cerr << "Error: Expected at least " << minArgs << " arguments." << endl;
+      printUsage();
       return -1;
    }
-   string path1 = argv[1];
-   string path2 = argv[2];
-   string pathout = argv[3];
+   vector<string> pathsin(argv + optind, argv + argc - 1);
+   string pathout = argv[argc - 1];
+   if (verify == kVerifyDefault)
+      hashOpts.verify = !Hasher::isCryptographic(hashOpts.algo);
+   else
+      hashOpts.verify = (verify == kVerify);
+   if (memoryLimit > 0 && !readBufferSet) {
+      size_t perThread = ExternalMerge::readBudget(memoryLimit) / hashOpts.threads;
+      hashOpts.maxReadBuffer = max<size_t>(perThread, 64 << 10);
+   }
+   unique_ptr<DigestCache> cache;
+   if (useCache)
+      cache.reset(new DigestCache(cachePath, hashOpts.algo));
+   HashPipeline hasher(hashOpts, cache.get());
+
+   if (memoryLimit > 0) {
+      // No tree is held, so none is listed: the plan goes straight to a
+      // file, kept only with --plan.
+      ExternalMerge::Options mergeOpts;
+      mergeOpts.memoryLimit = memoryLimit;
+      mergeOpts.spillDir = spillDir;
+      mergeOpts.history = history;
+      ExternalMerge merge(mergeOpts, hasher);
+      string path = planPath.empty() ?
+         spillDir + "/unidupe." + to_string(getpid()) + ".plan" : planPath;
+      size_t steps = merge.plan(pathsin, pathout, path);
+      cout << "Planned " << steps << " steps";
+      if (!planPath.empty())
+         cout << ", saved to " << planPath;
+      cout << endl;
+      char resp = '\0';
+      while (resp != 'n' && resp != 'Y') {
+         cout << "Do you wish to proceed with transformation? (Y, n): ";
+         cin >> resp;
+      }
+      try {
+         if (resp == 'Y')
+            Plan(path).run(jobs, forkCommands, !planPath.empty());
+      } catch (...) {
+         if (planPath.empty())
+            unlink(path.c_str());
+         throw;
+      }
+      if (planPath.empty())
+         unlink(path.c_str());
+      finish(statsPath);
+      return 0;
+   }
 
    // Build trees and file hash table.
-   unordered_multimap<string, FsNode> fileStore;
-   list<FsNode> folderStore;
-   FsTree ft1;
-   ft1.build(path1, fileStore, folderStore);
-   cout << "=== Tree 1 ===" << endl << ft1 << endl;
-   FsTree ft2;
-   ft2.build(path2, fileStore, folderStore);
-   cout << "=== Tree 2 ===" << endl << ft2 << endl;
+   FileStore fileStore;
+   NodeArena nodeStore;
+   FsTree base;
+   if (incremental) {
+      base.build(pathout, fileStore, nodeStore, hasher, scanThreads, true);
+      if (!hideInputs) {
+         cout << "=== Base ===" << endl;
+         base.print(cout, printOpts);
+         cout << endl;
+      }
+   }
+   vector<FsTree> trees(pathsin.size());
+   vector<FsTree*> treePtrs;
+   FsTree::buildAll(trees, pathsin, fileStore, nodeStore, hasher, scanThreads);
+   for (size_t i = 0; i < pathsin.size(); i++) {
+      if (!hideInputs) {
+         cout << "=== Tree " << i + 1 << " ===" << endl;
+         trees[i].print(cout, printOpts);
+         cout << endl;
+      }
+      treePtrs.push_back(&trees[i]);
+   }
 
    // Compute transformation of input FSs for unified FS.
-   FsTree ftJoint(ft1, ft2, pathout, fileStore);
+   unique_ptr<NearDupes> near;
+   if (nearDupes) {
+      nearOpts.chunking = Chunker::withAverage(chunkSize);
+      nearOpts.threads = hashOpts.threads;
+      nearOpts.maxReadBuffer = hashOpts.maxReadBuffer;
+      near.reset(new NearDupes(nearOpts));
+   }
+   FsTree ftJoint(treePtrs, pathout, fileStore, hasher, history,
+                  incremental ? &base : nullptr, near.get(), bulkCopy);
 
    // Output proposed solution.
-   cout << ftJoint << endl;
+   ftJoint.print(cout, printOpts);
+   cout << endl;
+   if (!planPath.empty()) {
+      ftJoint.savePlan(planPath);
+      cout << "Plan saved to " << planPath << endl;
+   }
 
    // Implement proposed solution.
    char resp = '\0';
@@ -91,7 +459,8 @@ int main(int argc, char** argv) {
       cin >> resp;
    }
 
-   if (resp == 'Y') ftJoint.execTform();
+   if (resp == 'Y') ftJoint.execTform(jobs, forkCommands, planPath);
 
+   finish(statsPath);
    return 0;
 }